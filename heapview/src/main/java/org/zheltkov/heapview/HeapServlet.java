@@ -14,8 +14,15 @@ import java.io.PrintWriter;
 @WebServlet(name = "HeapServlet", urlPatterns = "/heap")
 public class HeapServlet extends HttpServlet {
 
+    private static final int PAGE_SIZE = 50;
+
     protected void doGet(HttpServletRequest request, HttpServletResponse response) throws ServletException, IOException {
 
+        if (request.getParameter("node") != null) {
+            browse(request, response);
+            return;
+        }
+
         response.setContentType("text/html");
 
         String heapInfo;
@@ -30,4 +37,36 @@ public class HeapServlet extends HttpServlet {
         writer.println(heapInfo);
         writer.close();
     }
+
+    /**
+     * One page of the edges of a node of the published snapshot:
+     * /heap?node=0&dir=out|in&order=retained|shallow&limit=50&cursor=...
+     * The cursor comes from the previous page.
+     */
+    private void browse(HttpServletRequest request, HttpServletResponse response) throws IOException {
+        int node;
+        int limit;
+        try {
+            node = Integer.parseInt(request.getParameter("node"));
+            String limitParameter = request.getParameter("limit");
+            limit = limitParameter != null ? Integer.parseInt(limitParameter) : PAGE_SIZE;
+        } catch (NumberFormatException e) {
+            response.sendError(HttpServletResponse.SC_BAD_REQUEST, "node and limit must be numbers");
+            return;
+        }
+        boolean incoming = "in".equals(request.getParameter("dir"));
+        boolean byRetained = !"shallow".equals(request.getParameter("order"));
+
+        String page;
+        try {
+            page = new Heapview("web").browseEdges(node, incoming, byRetained, limit, request.getParameter("cursor"));
+        } catch (UnsatisfiedLinkError e) {
+            page = "{\"error\":\"agent not loaded\"}";
+        }
+
+        response.setContentType("application/json");
+        PrintWriter writer = response.getWriter();
+        writer.println(page);
+        writer.close();
+    }
 }
@@ -15,6 +15,12 @@ public class Heapview {
 
     public Heapview ref;
 
+    /**
+     * Set by the budgeted queries to the coverage of their walk, 100 for a
+     * complete walk, -1 when a partial walk cannot be estimated.
+     */
+    private int walkCoverage = 100;
+
     public Heapview(String value) {
         this.value = value;
     }
@@ -65,11 +71,163 @@ public class Heapview {
 
     public native int references(Object object);
 
+    public native int renderReferences(Object object, int format, int maxDepth, int maxChildren);
+
     public native int instances();
 
+    public native int duplicates(int top);
+
+    public native int sparseArrays(int top);
+
+    public native int retainedByField(int top);
+
+    public native int classLoaders(int top);
+
+    public native int threadRetention(int top);
+
+    public native int saveSnapshot(String path);
+
+    public native int publishSnapshot();
+
+    public native int snapshotSummary(int top);
+
+    public native int filterObjects(String expression, int top);
+
+    public native int dashboard(String filter, int top);
+
+    public native int walkBudget(int millis, int objects);
+
+    public native int telemetry(int last);
+
+    public native int emergencySnapshot();
+
+    public native int largestObjects(int top);
+
+    public native int collectionOverhead(int top);
+
+    public native String browseEdges(int node, boolean incoming, boolean byRetained, int limit, String cursor);
+
+    public native int watchFields(String pattern, int seconds, int top);
+
+    public native int trackAges(int intervalKB);
+
+    public native int objectAges(int top);
+
     public String instanceInfo() {
         int instances = instances();
-        return String.format("\nClass instances %d\n", instances);
+        return String.format("\nClass instances %d%s\n", instances, partialInfo());
+    }
+
+    public String walkBudgetInfo(int millis, int objects) {
+        walkBudget(millis, objects);
+        return millis > 0 || objects > 0 ? String.format("\nHeap walks limited to %d ms, %d objects\n", millis, objects)
+                : "\nHeap walks not limited\n";
+    }
+
+    private String partialInfo() {
+        int coverage = walkCoverage;
+        return coverage == 100 ? "" : coverage < 0 ? ", partial" : String.format(", partial, about %d%% covered", coverage);
+    }
+
+    public String duplicateInfo(int top) {
+        int duplicates = duplicates(top);
+        return String.format("\nDuplicated values %d%s\n", duplicates, partialInfo());
+    }
+
+    public String sparseArrayInfo(int top) {
+        int arrays = sparseArrays(top);
+        return String.format("\nScanned arrays %d%s\n", arrays, partialInfo());
+    }
+
+    public String retainedByFieldInfo(int top) {
+        int fields = retainedByField(top);
+        return String.format("\nRetaining fields %d\n", fields);
+    }
+
+    public String classLoaderInfo(int top) {
+        int leaks = classLoaders(top);
+        return String.format("\nSuspected class loader leaks %d\n", leaks);
+    }
+
+    public String threadRetentionInfo(int top) {
+        int threads = threadRetention(top);
+        return String.format("\nThreads with stack roots %d\n", threads);
+    }
+
+    public String saveSnapshotInfo(String path) {
+        int objects = saveSnapshot(path);
+        return objects < 0 ? String.format("\nSnapshot not written to %s\n", path)
+                : String.format("\nSnapshot of %d objects written to %s\n", objects, path);
+    }
+
+    public String publishSnapshotInfo() {
+        int objects = publishSnapshot();
+        return String.format("\nPublished snapshot of %d objects\n", objects);
+    }
+
+    public String snapshotSummaryInfo(int top) {
+        int objects = snapshotSummary(top);
+        return objects < 0 ? "\nNo snapshot published\n"
+                : String.format("\nObjects in the published snapshot %d\n", objects);
+    }
+
+    public String filterInfo(String expression, int top) {
+        int objects = filterObjects(expression, top);
+        return objects < 0 ? String.format("\nInvalid filter %s\n", expression)
+                : String.format("\nMatching objects %d%s\n", objects, partialInfo());
+    }
+
+    public String dashboardInfo(String filter, int top) {
+        int objects = dashboard(filter, top);
+        return objects < 0 ? "\nDashboard not available\n"
+                : String.format("\nObjects walked %d%s\n", objects, partialInfo());
+    }
+
+    public String telemetryInfo(int last) {
+        int samples = telemetry(last);
+        return String.format("\nHeap samples %d\n", samples);
+    }
+
+    public String emergencySnapshotInfo() {
+        int bytes = emergencySnapshot();
+        return bytes < 0 ? "\nEmergency snapshot not written\n"
+                : String.format("\nEmergency snapshot of %d bytes written\n", bytes);
+    }
+
+    public String largestObjectsInfo(int top) {
+        int kept = largestObjects(top);
+        return kept < 0 ? "\nNo snapshot published\n"
+                : String.format("\nLargest objects kept %d\n", kept);
+    }
+
+    public String collectionOverheadInfo(int top) {
+        int collections = collectionOverhead(top);
+        return collections < 0 ? "\nNo snapshot published\n"
+                : String.format("\nCollections in the published snapshot %d\n", collections);
+    }
+
+    public String watchFieldsInfo(String pattern, int seconds, int top) {
+        int hits = watchFields(pattern, seconds, top);
+        return hits < 0 ? "\nNo fields watched\n"
+                : String.format("\nField hits %d\n", hits);
+    }
+
+    public String trackAgesInfo(int intervalKB) {
+        return trackAges(intervalKB) < 0 ? "\nAllocation sampling not available\n"
+                : intervalKB > 0 ? String.format("\nSampling allocation ages every %d KB\n", intervalKB)
+                : "\nAllocation age sampling stopped\n";
+    }
+
+    public String objectAgesInfo(int top) {
+        int live = objectAges(top);
+        return live < 0 ? "\nObject ages not available\n"
+                : String.format("\nLive sampled objects %d%s\n", live, partialInfo());
+    }
+
+    public String renderReferencesInfo(Object object, int format, int maxDepth, int maxChildren) {
+        int rendered = renderReferences(object, format, maxDepth, maxChildren);
+        return rendered < 0 ? "\nReferences not rendered\n"
+                : String.format("\nRendered objects %d\n", rendered);
     }
 
     public String referenceInfo() {
@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+
+#include "agent_util.hpp"
+#include "snapshotFile.hpp"
+#include "fieldRetention.hpp"
+#include "classLoaders.hpp"
+
+/* Offline analysis of snapshot files written by Heapview.saveSnapshot().
+ *   Queries about single classes or objects decode only the blocks they
+ *   touch, the reports over the whole heap load the complete graph.
+ */
+
+/* Decoded blocks of the file, each decoded once on first use */
+typedef struct NodeLookup
+{
+	SnapshotFile* file;
+	std::unordered_map<uint32_t, SnapshotNodes> nodes;
+	std::unordered_map<uint32_t, SnapshotDominators> dominators;
+	std::unordered_map<uint32_t, SnapshotParents> parents;
+	std::unordered_map<uint32_t, SnapshotEdges> edges;
+} NodeLookup;
+
+static void failed(SnapshotFile* file)
+{
+	fatal_error("ERROR: %s\n", file->error.c_str());
+}
+
+static const SnapshotNodes* nodeBlock(NodeLookup* lookup, NodeId node)
+{
+	uint32_t block = snapshotBlockOf(node);
+	auto it = lookup->nodes.find(block);
+	if (it == lookup->nodes.end())
+	{
+		it = lookup->nodes.insert(std::make_pair(block, SnapshotNodes())).first;
+		if (!readSnapshotNodes(lookup->file, block, &it->second))
+		{
+			failed(lookup->file);
+		}
+	}
+	return &it->second;
+}
+
+static const SnapshotDominators* dominatorBlock(NodeLookup* lookup, NodeId node)
+{
+	uint32_t block = snapshotBlockOf(node);
+	auto it = lookup->dominators.find(block);
+	if (it == lookup->dominators.end())
+	{
+		it = lookup->dominators.insert(std::make_pair(block, SnapshotDominators())).first;
+		if (!readSnapshotDominators(lookup->file, block, &it->second))
+		{
+			failed(lookup->file);
+		}
+	}
+	return &it->second;
+}
+
+static const SnapshotParents* parentBlock(NodeLookup* lookup, NodeId node)
+{
+	uint32_t block = snapshotBlockOf(node);
+	auto it = lookup->parents.find(block);
+	if (it == lookup->parents.end())
+	{
+		it = lookup->parents.insert(std::make_pair(block, SnapshotParents())).first;
+		if (!readSnapshotParents(lookup->file, block, &it->second))
+		{
+			failed(lookup->file);
+		}
+	}
+	return &it->second;
+}
+
+static const SnapshotEdges* edgeBlock(NodeLookup* lookup, NodeId node)
+{
+	uint32_t block = snapshotBlockOf(node);
+	auto it = lookup->edges.find(block);
+	if (it == lookup->edges.end())
+	{
+		it = lookup->edges.insert(std::make_pair(block, SnapshotEdges())).first;
+		if (!readSnapshotEdges(lookup->file, block, &it->second))
+		{
+			failed(lookup->file);
+		}
+	}
+	return &it->second;
+}
+
+static uint32_t classIdOf(NodeLookup* lookup, NodeId node)
+{
+	const SnapshotNodes* block = nodeBlock(lookup, node);
+	return block->classIds[node - block->first];
+}
+
+static uint64_t sizeOf(NodeLookup* lookup, NodeId node)
+{
+	const SnapshotNodes* block = nodeBlock(lookup, node);
+	return block->sizes[node - block->first];
+}
+
+static uint8_t flagsOf(NodeLookup* lookup, NodeId node)
+{
+	const SnapshotNodes* block = nodeBlock(lookup, node);
+	return block->flags[node - block->first];
+}
+
+static uint64_t retainedOf(NodeLookup* lookup, NodeId node)
+{
+	const SnapshotDominators* block = dominatorBlock(lookup, node);
+	return block->retained[node - block->first];
+}
+
+static std::string nameOf(NodeLookup* lookup, const ClassTable* classes, NodeId node)
+{
+	return describeObject(classes, node, classIdOf(lookup, node), flagsOf(lookup, node));
+}
+
+static void checkNode(SnapshotFile* file, NodeId node)
+{
+	if (node >= snapshotNodeCount(file))
+	{
+		fatal_error("ERROR: no object #%u in this snapshot\n", node);
+	}
+}
+
+static void printObject(NodeLookup* lookup, const ClassTable* classes, int rank, NodeId node)
+{
+	stdout_message(" %3d. #%-10u %-50s shallow %10lld, retained %14lld bytes\n", rank, node,
+	               nameOf(lookup, classes, node).c_str(), (long long)sizeOf(lookup, node), (long long)retainedOf(lookup, node));
+}
+
+static void summary(SnapshotFile* file)
+{
+	stdout_message("Snapshot file version %u, %lld nodes\n", file->version, (long long)snapshotNodeCount(file));
+	for (auto it = file->sections.begin(); it != file->sections.end(); ++it)
+	{
+		stdout_message("  section %u: %lld items in %d blocks\n", it->type, (long long)it->items, int(it->blocks.size()));
+	}
+}
+
+/* Needs the node columns and the dominators only, the edges stay mapped */
+static void histogram(SnapshotFile* file, const ClassTable* classes, int top)
+{
+	HeapGraph graph;
+	DominatorTree tree;
+	std::vector<ClassHistogramEntry> entries;
+	uint64_t nodes = snapshotNodeCount(file);
+
+	for (NodeId first = 0; first < nodes; first += kSnapshotBlockNodes)
+	{
+		SnapshotNodes block;
+		SnapshotDominators dominators;
+		if (!readSnapshotNodes(file, snapshotBlockOf(first), &block) ||
+			!readSnapshotDominators(file, snapshotBlockOf(first), &dominators))
+		{
+			failed(file);
+		}
+		graph.classIds.insert(graph.classIds.end(), block.classIds.begin(), block.classIds.end());
+		graph.sizes.insert(graph.sizes.end(), block.sizes.begin(), block.sizes.end());
+		graph.flags.insert(graph.flags.end(), block.flags.begin(), block.flags.end());
+		tree.retained.insert(tree.retained.end(), dominators.retained.begin(), dominators.retained.end());
+	}
+
+	computeClassHistogram(&graph, &tree, &entries);
+
+	size_t shown = std::min(entries.size(), size_t(top > 0 ? top : 0));
+	stdout_message("Classes with instances: %d\n", int(entries.size()));
+	for (size_t i = 0; i < shown; ++i)
+	{
+		stdout_message(" %3d. %-60s instances %10lld, shallow %14lld bytes, largest retained %14lld bytes\n",
+		               int(i + 1), classNameOf(classes, entries[i].classId), (long long)entries[i].instances,
+		               (long long)entries[i].shallow, (long long)entries[i].maxRetained);
+	}
+}
+
+static void instancesOf(NodeLookup* lookup, const ClassTable* classes, const char* name, int top)
+{
+	std::vector<NodeId> nodes;
+	int found = 0;
+
+	for (size_t c = 0; c < classes->classes.size(); ++c)
+	{
+		if (classes->classes[c].name != name)
+		{
+			continue;
+		}
+
+		found++;
+		if (!readSnapshotInstances(lookup->file, uint32_t(c + 1), &nodes))
+		{
+			failed(lookup->file);
+		}
+
+		std::vector<std::pair<uint64_t, NodeId> > ranked;
+		uint64_t shallow = 0;
+		for (auto it = nodes.begin(); it != nodes.end(); ++it)
+		{
+			ranked.push_back(std::make_pair(retainedOf(lookup, *it), *it));
+			shallow += sizeOf(lookup, *it);
+		}
+		size_t shown = std::min(ranked.size(), size_t(top > 0 ? top : 0));
+		std::partial_sort(ranked.begin(), ranked.begin() + shown, ranked.end(),
+		                  std::greater<std::pair<uint64_t, NodeId> >());
+
+		stdout_message("%s: %d instances, shallow %lld bytes\n", name, int(nodes.size()), (long long)shallow);
+		for (size_t i = 0; i < shown; ++i)
+		{
+			printObject(lookup, classes, int(i + 1), ranked[i].second);
+		}
+	}
+	if (found == 0)
+	{
+		stdout_message("No class %s in this snapshot\n", name);
+	}
+}
+
+static void topRetained(NodeLookup* lookup, const ClassTable* classes, int top)
+{
+	std::vector<NodeId> nodes;
+
+	if (!readSnapshotTopRetained(lookup->file, &nodes))
+	{
+		failed(lookup->file);
+	}
+
+	size_t shown = std::min(nodes.size(), size_t(top > 0 ? top : 0));
+	stdout_message("Objects with the largest retained size:\n");
+	for (size_t i = 0; i < shown; ++i)
+	{
+		printObject(lookup, classes, int(i + 1), nodes[i]);
+	}
+}
+
+static void pathToRoot(NodeLookup* lookup, const ClassTable* classes, NodeId node)
+{
+	std::vector<std::pair<NodeId, uint32_t> > steps;
+
+	checkNode(lookup->file, node);
+	for (NodeId n = node; n != kRootNode; )
+	{
+		const SnapshotParents* block = parentBlock(lookup, n);
+		NodeId parent = block->parent[n - block->first];
+		if (parent == kNoNode)
+		{
+			stdout_message("#%u is not reachable\n", node);
+			return;
+		}
+		steps.push_back(std::make_pair(n, block->label[n - block->first]));
+		n = parent;
+	}
+
+	stdout_message("Shortest path from a GC root to #%u:\n", node);
+	NodeId from = kRootNode;
+	for (auto it = steps.rbegin(); it != steps.rend(); ++it)
+	{
+		stdout_message("  %-40s #%-10u %s\n",
+		               describeReference(classes, from, classIdOf(lookup, from), flagsOf(lookup, from), it->second).c_str(),
+		               it->first, nameOf(lookup, classes, it->first).c_str());
+		from = it->first;
+	}
+}
+
+static void object(NodeLookup* lookup, const ClassTable* classes, NodeId node, int top)
+{
+	checkNode(lookup->file, node);
+
+	const SnapshotDominators* tree = dominatorBlock(lookup, node);
+	NodeId idom = tree->idom[node - tree->first];
+	stdout_message("#%u %s\n", node, nameOf(lookup, classes, node).c_str());
+	stdout_message("  shallow %lld bytes, retained %lld bytes\n", (long long)sizeOf(lookup, node), (long long)retainedOf(lookup, node));
+	if (idom != kNoNode)
+	{
+		stdout_message("  dominated by #%u %s\n", idom, nameOf(lookup, classes, idom).c_str());
+	}
+
+	const SnapshotEdges* edges = edgeBlock(lookup, node);
+	uint64_t begin = edges->edgeStarts[node - edges->first];
+	uint64_t end = edges->edgeStarts[node - edges->first + 1];
+	std::vector<std::pair<NodeId, uint32_t> > targets;
+	for (uint64_t e = begin; e < end; ++e)
+	{
+		targets.push_back(std::make_pair(edges->edgeTargets[e], edges->edgeLabels[e]));
+	}
+
+	stdout_message("  references %d objects\n", int(targets.size()));
+	uint32_t class_id = classIdOf(lookup, node);
+	uint8_t flags = flagsOf(lookup, node);
+	for (size_t i = 0; i < targets.size() && i < size_t(top); ++i)
+	{
+		NodeId target = targets[i].first;
+		stdout_message("  %-40s #%-10u %-40s retained %lld bytes\n",
+		               describeReference(classes, node, class_id, flags, targets[i].second).c_str(), target,
+		               nameOf(lookup, classes, target).c_str(), (long long)retainedOf(lookup, target));
+	}
+}
+
+static void loadSnapshot(SnapshotFile* file, HeapSnapshot* snapshot)
+{
+	if (!loadSnapshotGraph(file, &snapshot->graph, &snapshot->dominators) ||
+		!loadSnapshotThreads(file, &snapshot->threads, &snapshot->frames))
+	{
+		failed(file);
+	}
+	clearLargestObjects(&snapshot->largest);
+	snapshot->collections.instances.clear();
+	snapshot->generation = 0;
+}
+
+static void usage()
+{
+	fatal_error("usage: heapcli <snapshot> <command> [arguments]\n"
+	            "  summary               sections of the file\n"
+	            "  histogram [top]       instances and bytes per class\n"
+	            "  class <name> [top]    instances of a class, largest retained size first\n"
+	            "  top [count]           objects with the largest retained size\n"
+	            "  path <object>         shortest path from a GC root to an object\n"
+	            "  object <object> [top] sizes, dominator and references of an object\n"
+	            "  fields [top]          retained bytes by field\n"
+	            "  loaders [top]         class loaders and loader leaks\n");
+}
+
+static int numberArgument(int argc, char** argv, int index, int fallback)
+{
+	return index < argc ? atoi(argv[index]) : fallback;
+}
+
+int main(int argc, char** argv)
+{
+	SnapshotFile file;
+	ClassTable classes;
+	NodeLookup lookup;
+
+	if (argc < 3)
+	{
+		usage();
+	}
+	if (!openSnapshotFile(argv[1], &file))
+	{
+		fatal_error("ERROR: %s: %s\n", argv[1], file.error.c_str());
+	}
+	if (!loadSnapshotClasses(&file, &classes))
+	{
+		failed(&file);
+	}
+	lookup.file = &file;
+
+	const char* command = argv[2];
+	if (strcmp(command, "summary") == 0)
+	{
+		summary(&file);
+	}
+	else if (strcmp(command, "histogram") == 0)
+	{
+		histogram(&file, &classes, numberArgument(argc, argv, 3, 30));
+	}
+	else if (strcmp(command, "class") == 0 && argc > 3)
+	{
+		instancesOf(&lookup, &classes, argv[3], numberArgument(argc, argv, 4, 20));
+	}
+	else if (strcmp(command, "top") == 0)
+	{
+		topRetained(&lookup, &classes, numberArgument(argc, argv, 3, 20));
+	}
+	else if (strcmp(command, "path") == 0 && argc > 3)
+	{
+		pathToRoot(&lookup, &classes, NodeId(strtoul(argv[3], nullptr, 10)));
+	}
+	else if (strcmp(command, "object") == 0 && argc > 3)
+	{
+		object(&lookup, &classes, NodeId(strtoul(argv[3], nullptr, 10)), numberArgument(argc, argv, 4, 50));
+	}
+	else if (strcmp(command, "fields") == 0)
+	{
+		HeapSnapshot snapshot;
+		loadSnapshot(&file, &snapshot);
+		reportRetainedByField(&snapshot, &classes, numberArgument(argc, argv, 3, 30));
+	}
+	else if (strcmp(command, "loaders") == 0)
+	{
+		HeapSnapshot snapshot;
+		loadSnapshot(&file, &snapshot);
+		reportClassLoaders(&snapshot, &classes, numberArgument(argc, argv, 3, 30));
+	}
+	else
+	{
+		usage();
+	}
+
+	closeSnapshotFile(&file);
+	return 0;
+}
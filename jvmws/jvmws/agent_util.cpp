@@ -266,6 +266,71 @@ allocate(jvmtiEnv* jvmti, jint len)
 	return ptr;
 }
 
+/* Size in bytes of one element of a primitive array or field */
+jint
+primitive_type_size(jvmtiPrimitiveType type)
+{
+	switch (type)
+	{
+	case JVMTI_PRIMITIVE_TYPE_BOOLEAN:
+	case JVMTI_PRIMITIVE_TYPE_BYTE:
+		return 1;
+	case JVMTI_PRIMITIVE_TYPE_CHAR:
+	case JVMTI_PRIMITIVE_TYPE_SHORT:
+		return 2;
+	case JVMTI_PRIMITIVE_TYPE_INT:
+	case JVMTI_PRIMITIVE_TYPE_FLOAT:
+		return 4;
+	case JVMTI_PRIMITIVE_TYPE_LONG:
+	case JVMTI_PRIMITIVE_TYPE_DOUBLE:
+	default:
+		return 8;
+	}
+}
+
+/* Short name of a heap reference kind, used to label roots and edges */
+const char*
+reference_kind_name(jvmtiHeapReferenceKind kind)
+{
+	switch (kind)
+	{
+	case JVMTI_HEAP_REFERENCE_CLASS:
+		return "class";
+	case JVMTI_HEAP_REFERENCE_FIELD:
+		return "field";
+	case JVMTI_HEAP_REFERENCE_ARRAY_ELEMENT:
+		return "array element";
+	case JVMTI_HEAP_REFERENCE_CLASS_LOADER:
+		return "class loader";
+	case JVMTI_HEAP_REFERENCE_SIGNERS:
+		return "signers";
+	case JVMTI_HEAP_REFERENCE_PROTECTION_DOMAIN:
+		return "protection domain";
+	case JVMTI_HEAP_REFERENCE_INTERFACE:
+		return "interface";
+	case JVMTI_HEAP_REFERENCE_STATIC_FIELD:
+		return "static field";
+	case JVMTI_HEAP_REFERENCE_CONSTANT_POOL:
+		return "constant pool";
+	case JVMTI_HEAP_REFERENCE_SUPERCLASS:
+		return "superclass";
+	case JVMTI_HEAP_REFERENCE_JNI_GLOBAL:
+		return "jni global";
+	case JVMTI_HEAP_REFERENCE_SYSTEM_CLASS:
+		return "system class";
+	case JVMTI_HEAP_REFERENCE_MONITOR:
+		return "monitor";
+	case JVMTI_HEAP_REFERENCE_STACK_LOCAL:
+		return "stack local";
+	case JVMTI_HEAP_REFERENCE_JNI_LOCAL:
+		return "jni local";
+	case JVMTI_HEAP_REFERENCE_THREAD:
+		return "thread";
+	default:
+		return "other";
+	}
+}
+
 /* Add demo jar file to boot class path (the BCI Tracker class must be
  *     in the boot classpath)
  *
@@ -67,6 +67,8 @@ extern "C"
 	void deallocate(jvmtiEnv* jvmti, unsigned char* ptr);
 	void* allocate(jvmtiEnv* jvmti, jint len);
 	void add_demo_jar_to_bootclasspath(jvmtiEnv* jvmti, char* demo_name);
+	jint primitive_type_size(jvmtiPrimitiveType type);
+	const char* reference_kind_name(jvmtiHeapReferenceKind kind);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -0,0 +1,99 @@
+#pragma once
+
+
+#ifndef ANALYSIS_TAGS_H
+#define ANALYSIS_TAGS_H
+
+#include <stdint.h>
+
+#include <jni.h>
+
+/* Tags set through the analysis JVMTI environment:
+ *   class objects    index of the class in the ClassTable plus one
+ *   snapshot nodes   kNodeTag | generation << 40 | node index
+ *   sampled objects  age stamp << 52, kept when a node tag is set
+ *   scratch values   negative, set and cleared again within one heap walk
+ *   scratch keys     age stamp | kScratchTag | index, see makeScratchTag
+ *   A node tag is only valid for the snapshot generation that set it and
+ *   is never cleared, every object a snapshot reached keeps its entry in
+ *   the tag map of the analysis environment until it dies. That map grows
+ *   to the live object count, costing memory and time in every GC, which
+ *   processes the tag maps of all environments. Generations wrap after
+ *   4096 snapshots, a tag is turned into a node only through nodeOfTag,
+ *   which also checks the index against the graph.
+ */
+static const jlong kNodeTag = jlong(1) << 62;
+static const int kNodeGenerationShift = 40;
+static const jlong kNodeGenerationMask = 0xFFF;
+static const jlong kNodeIndexMask = (jlong(1) << kNodeGenerationShift) - 1;
+
+/* GC epoch of a sampled allocation modulo kAgeEpochs, plus one */
+static const int kAgeShift = 52;
+static const jlong kAgeEpochs = 0x3FF;
+static const jlong kAgeMask = kAgeEpochs << kAgeShift;
+
+inline bool isClassTag(jlong tag)
+{
+	return tag > 0 && tag <= kNodeIndexMask;
+}
+
+inline jlong makeNodeTag(jlong generation, jlong index)
+{
+	return kNodeTag | ((generation & kNodeGenerationMask) << kNodeGenerationShift) | index;
+}
+
+inline bool isNodeTagOf(jlong tag, jlong generation)
+{
+	return tag > 0 && (tag & ~(kNodeIndexMask | kAgeMask)) == makeNodeTag(generation, 0);
+}
+
+/* The age stamp bits of a tag, to carry over when it is replaced */
+inline jlong ageBitsOf(jlong tag)
+{
+	return tag > 0 ? (tag & kAgeMask) : 0;
+}
+
+inline jlong makeAgeStamp(uint32_t epoch)
+{
+	return (jlong(epoch % kAgeEpochs) + 1) << kAgeShift;
+}
+
+/* GCs survived since the stamp, modulo kAgeEpochs; -1 when not stamped */
+inline jlong ageOfTag(jlong tag, uint32_t epoch)
+{
+	jlong stamp = ageBitsOf(tag) >> kAgeShift;
+	if (stamp == 0)
+	{
+		return -1;
+	}
+	return (jlong(epoch % kAgeEpochs) - (stamp - 1) + kAgeEpochs) % kAgeEpochs;
+}
+
+inline jlong nodeTagIndex(jlong tag)
+{
+	return tag & kNodeIndexMask;
+}
+
+/* A sampled object without a node tag carries only its age stamp, which it
+ *   shares with every object sampled in the same epoch. Walks that key
+ *   objects by tag replace such a stamp with a scratch key unique within
+ *   the walk, the stamp bits stay in place, and restore the bare stamp
+ *   before the walk ends. */
+static const jlong kScratchTag = jlong(1) << 51;
+
+inline bool isBareAgeStamp(jlong tag)
+{
+	return tag > 0 && (tag & ~kAgeMask) == 0;
+}
+
+inline jlong makeScratchTag(jlong stamp, jlong index)
+{
+	return (stamp & kAgeMask) | kScratchTag | (index & kNodeIndexMask);
+}
+
+inline bool isScratchTag(jlong tag)
+{
+	return tag > 0 && (tag & ~(kAgeMask | kNodeIndexMask)) == kScratchTag;
+}
+
+#endif
@@ -0,0 +1,336 @@
+#include <string.h>
+
+#include "arrayScan.hpp"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define ARRAY_SCAN_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define ARRAY_SCAN_AVX2
+#else
+#define ARRAY_SCAN_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+/* The hash consumes 32 byte stripes into four 64-bit lanes, the lane
+ *   layout of one AVX2 register. Every 16 stripes the lanes are scrambled
+ *   so that long runs of equal data do not cancel out. Bytes that do not
+ *   fill a whole stripe are folded in by the scalar finalizer.
+ */
+static const size_t kStripeLength = 32;
+static const size_t kStripesPerBlock = 16;
+
+static const uint64_t kPrime32 = 0x9E3779B1ULL;
+static const uint64_t kPrime64[4] = {
+	0x9E3779B185EBCA87ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0x85EBCA77C2B2AE63ULL
+};
+static const uint64_t kSecret[4] = {
+	0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL
+};
+
+typedef void (*AccumulateFunction)(uint64_t* acc, const unsigned char* data, size_t stripes);
+typedef void (*ScanZerosFunction)(const unsigned char* data, size_t count, size_t elementSize, ArrayZeroScan* result);
+
+/* Variants picked once for this CPU */
+typedef struct ScanFunctions
+{
+	AccumulateFunction accumulate;
+	ScanZerosFunction scanZeros;
+} ScanFunctions;
+
+static inline uint64_t mix64(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	return x;
+}
+
+static void accumulateScalar(uint64_t* acc, const unsigned char* data, size_t stripes)
+{
+	for (size_t s = 0; s < stripes; ++s, data += kStripeLength)
+	{
+		uint64_t lanes[4];
+		memcpy(lanes, data, sizeof(lanes));
+
+		for (auto i = 0; i < 4; ++i)
+		{
+			uint64_t key = lanes[i] ^ kSecret[i];
+			acc[i ^ 1] += lanes[i];
+			acc[i] += (key & 0xFFFFFFFFULL) * (key >> 32);
+		}
+
+		if ((s + 1) % kStripesPerBlock == 0)
+		{
+			for (auto i = 0; i < 4; ++i)
+			{
+				acc[i] ^= acc[i] >> 47;
+				acc[i] ^= kSecret[i];
+				acc[i] *= kPrime32;
+			}
+		}
+	}
+}
+
+template <typename T>
+static void scanZerosScalar(const unsigned char* data, size_t begin, size_t count, ArrayZeroScan* result)
+{
+	for (size_t i = begin; i < count; ++i)
+	{
+		T value;
+		memcpy(&value, data + i * sizeof(T), sizeof(T));
+		if (value == 0)
+		{
+			result->zeroElements++;
+		}
+		else
+		{
+			result->usedLength = i + 1;
+		}
+	}
+}
+
+static void scanZerosScalar(const unsigned char* data, size_t count, size_t elementSize, ArrayZeroScan* result)
+{
+	switch (elementSize)
+	{
+	case 1:
+		scanZerosScalar<uint8_t>(data, 0, count, result);
+		break;
+	case 2:
+		scanZerosScalar<uint16_t>(data, 0, count, result);
+		break;
+	case 4:
+		scanZerosScalar<uint32_t>(data, 0, count, result);
+		break;
+	default:
+		scanZerosScalar<uint64_t>(data, 0, count, result);
+		break;
+	}
+}
+
+#ifdef ARRAY_SCAN_X86
+
+static inline uint32_t popCount32(uint32_t x)
+{
+#if defined(_MSC_VER)
+	return __popcnt(x);
+#else
+	return uint32_t(__builtin_popcount(x));
+#endif
+}
+
+static inline uint32_t highestBit32(uint32_t x)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse(&index, x);
+	return uint32_t(index);
+#else
+	return uint32_t(31 - __builtin_clz(x));
+#endif
+}
+
+/* Compares whole 32 byte blocks element-wise against zero. The byte mask
+ *   of the comparison gives the zero element count by population count and
+ *   the last non-zero element by its highest clear bit.
+ */
+template <typename T>
+ARRAY_SCAN_AVX2
+static void scanZerosAvx2(const unsigned char* data, size_t count, ArrayZeroScan* result)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	size_t bytes = count * sizeof(T);
+	size_t zeroBytes = 0;
+	size_t i = 0;
+
+	for (; i + kStripeLength <= bytes; i += kStripeLength)
+	{
+		__m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+		__m256i equal;
+		if (sizeof(T) == 1)
+		{
+			equal = _mm256_cmpeq_epi8(value, zero);
+		}
+		else if (sizeof(T) == 2)
+		{
+			equal = _mm256_cmpeq_epi16(value, zero);
+		}
+		else if (sizeof(T) == 4)
+		{
+			equal = _mm256_cmpeq_epi32(value, zero);
+		}
+		else
+		{
+			equal = _mm256_cmpeq_epi64(value, zero);
+		}
+
+		uint32_t zeroMask = uint32_t(_mm256_movemask_epi8(equal));
+		zeroBytes += popCount32(zeroMask);
+		if (zeroMask != 0xFFFFFFFFu)
+		{
+			result->usedLength = (i + highestBit32(~zeroMask)) / sizeof(T) + 1;
+		}
+	}
+
+	result->zeroElements += zeroBytes / sizeof(T);
+	scanZerosScalar<T>(data, i / sizeof(T), count, result);
+}
+
+static void scanZerosAvx2(const unsigned char* data, size_t count, size_t elementSize, ArrayZeroScan* result)
+{
+	switch (elementSize)
+	{
+	case 1:
+		scanZerosAvx2<uint8_t>(data, count, result);
+		break;
+	case 2:
+		scanZerosAvx2<uint16_t>(data, count, result);
+		break;
+	case 4:
+		scanZerosAvx2<uint32_t>(data, count, result);
+		break;
+	default:
+		scanZerosAvx2<uint64_t>(data, count, result);
+		break;
+	}
+}
+
+ARRAY_SCAN_AVX2
+static void accumulateAvx2(uint64_t* acc, const unsigned char* data, size_t stripes)
+{
+	const __m256i secret = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(kSecret));
+	const __m256i prime = _mm256_set1_epi64x(static_cast<long long>(kPrime32));
+	__m256i lanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc));
+
+	for (size_t s = 0; s < stripes; ++s, data += kStripeLength)
+	{
+		__m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+		__m256i key = _mm256_xor_si256(value, secret);
+		__m256i product = _mm256_mul_epu32(key, _mm256_srli_epi64(key, 32));
+		/* acc[i ^ 1] += lanes[i] of the scalar version */
+		__m256i swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+		lanes = _mm256_add_epi64(lanes, _mm256_add_epi64(product, swapped));
+
+		if ((s + 1) % kStripesPerBlock == 0)
+		{
+			lanes = _mm256_xor_si256(lanes, _mm256_srli_epi64(lanes, 47));
+			lanes = _mm256_xor_si256(lanes, secret);
+			__m256i low = _mm256_mul_epu32(lanes, prime);
+			__m256i high = _mm256_mul_epu32(_mm256_srli_epi64(lanes, 32), prime);
+			lanes = _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));
+		}
+	}
+
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(acc), lanes);
+}
+
+static bool cpuHasAvx2()
+{
+#if defined(_MSC_VER)
+	int info[4];
+
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return false;
+	}
+	/* AVX and OSXSAVE, then check the OS saves the YMM state */
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+	{
+		return false;
+	}
+	if ((_xgetbv(0) & 6) != 6)
+	{
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif
+
+static ScanFunctions selectScanFunctions()
+{
+	ScanFunctions functions;
+
+#ifdef ARRAY_SCAN_X86
+	if (cpuHasAvx2())
+	{
+		functions.accumulate = &accumulateAvx2;
+		functions.scanZeros = &scanZerosAvx2;
+		return functions;
+	}
+#endif
+	functions.accumulate = &accumulateScalar;
+	functions.scanZeros = &scanZerosScalar;
+	return functions;
+}
+
+static const ScanFunctions* scanFunctions()
+{
+	static const ScanFunctions functions = selectScanFunctions();
+	return &functions;
+}
+
+bool arrayScanUsesAvx2()
+{
+	return scanFunctions()->accumulate != &accumulateScalar;
+}
+
+uint64_t hashArrayBytes(const void* data, size_t length, uint64_t seed)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	uint64_t acc[4];
+	size_t stripes = length / kStripeLength;
+	size_t tail = length % kStripeLength;
+
+	for (auto i = 0; i < 4; ++i)
+	{
+		acc[i] = kPrime64[i] ^ seed;
+	}
+
+	if (stripes > 0)
+	{
+		scanFunctions()->accumulate(acc, bytes, stripes);
+		bytes += stripes * kStripeLength;
+	}
+
+	uint64_t h = seed ^ (static_cast<uint64_t>(length) * kPrime64[0]);
+	for (auto i = 0; i < 4; ++i)
+	{
+		h = mix64(h ^ mix64(acc[i] + kSecret[i]));
+	}
+
+	while (tail >= 8)
+	{
+		uint64_t word;
+		memcpy(&word, bytes, sizeof(word));
+		h = (h ^ mix64(word ^ kPrime64[1])) * kPrime64[0];
+		bytes += 8;
+		tail -= 8;
+	}
+	if (tail > 0)
+	{
+		uint64_t word = 0;
+		memcpy(&word, bytes, tail);
+		h = (h ^ mix64(word ^ kPrime64[2] ^ tail)) * kPrime64[0];
+	}
+
+	return mix64(h);
+}
+
+void scanArrayZeros(const void* data, size_t count, size_t elementSize, ArrayZeroScan* result)
+{
+	result->zeroElements = 0;
+	result->usedLength = 0;
+	scanFunctions()->scanZeros(static_cast<const unsigned char*>(data), count, elementSize, result);
+}
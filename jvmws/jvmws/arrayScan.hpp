@@ -0,0 +1,36 @@
+#pragma once
+
+
+#ifndef ARRAY_SCAN_H
+#define ARRAY_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Vectorized scanning of primitive array contents as delivered by the
+ *   array_primitive_value_callback heap callback.
+ *   Each routine has an AVX2 variant, picked once at runtime when the CPU
+ *   and OS support it, and a scalar variant that gives identical results.
+ */
+
+/* Returns true when the AVX2 variants are in use */
+bool arrayScanUsesAvx2();
+
+/* 64-bit hash of a block of array contents */
+uint64_t hashArrayBytes(const void* data, size_t length, uint64_t seed);
+
+/* Zero statistics of the elements of a primitive array */
+typedef struct ArrayZeroScan
+{
+	/* Elements whose bits are all zero */
+	size_t zeroElements;
+
+	/* Index of the last non-zero element plus one, the elements after it
+	 *   form the trailing zero run */
+	size_t usedLength;
+} ArrayZeroScan;
+
+/* Scans count elements of elementSize (1, 2, 4 or 8) bytes */
+void scanArrayZeros(const void* data, size_t count, size_t elementSize, ArrayZeroScan* result);
+
+#endif
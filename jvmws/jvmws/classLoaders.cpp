@@ -0,0 +1,198 @@
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+
+#include "agent_util.hpp"
+#include "classLoaders.hpp"
+
+typedef struct LoaderStats
+{
+	/* Node of the loader object, kNoNode for the bootstrap loader */
+	NodeId loader;
+	std::vector<NodeId> classNodes;
+	uint64_t instances;
+	uint64_t instanceBytes;
+	uint64_t retained;
+} LoaderStats;
+
+/* Defining loader of a class object: the target of its CLASS_LOADER edge */
+static NodeId definingLoader(const HeapGraph* graph, NodeId klass)
+{
+	for (uint64_t e = graph->edgeStarts[klass]; e < graph->edgeStarts[klass + 1]; ++e)
+	{
+		if (edgeLabelKind(graph->edgeLabels[e]) == JVMTI_HEAP_REFERENCE_CLASS_LOADER)
+		{
+			return graph->edgeTargets[e];
+		}
+	}
+	return kNoNode;
+}
+
+/* Memory freed when a loader goes away with its classes: the retained
+ *   sizes of the loader and its class objects, leaving out members that
+ *   another member of the group already dominates.
+ */
+static void computeGroupRetained(const HeapSnapshot* snapshot, std::vector<LoaderStats>& loaders)
+{
+	const DominatorTree* tree = &snapshot->dominators;
+	std::vector<uint32_t> group(graphNodeCount(&snapshot->graph), 0);
+
+	for (size_t g = 0; g < loaders.size(); ++g)
+	{
+		if (loaders[g].loader != kNoNode)
+		{
+			group[loaders[g].loader] = uint32_t(g + 1);
+		}
+		for (auto it = loaders[g].classNodes.begin(); it != loaders[g].classNodes.end(); ++it)
+		{
+			group[*it] = uint32_t(g + 1);
+		}
+	}
+
+	for (size_t g = 0; g < loaders.size(); ++g)
+	{
+		std::vector<NodeId> members(loaders[g].classNodes);
+		if (loaders[g].loader != kNoNode)
+		{
+			members.push_back(loaders[g].loader);
+		}
+
+		for (auto it = members.begin(); it != members.end(); ++it)
+		{
+			bool nested = false;
+			for (NodeId d = tree->idom[*it]; d != kNoNode && d != kRootNode; d = tree->idom[d])
+			{
+				if (group[d] == g + 1)
+				{
+					nested = true;
+					break;
+				}
+			}
+			if (!nested && tree->idom[*it] != kNoNode)
+			{
+				loaders[g].retained += tree->retained[*it];
+			}
+		}
+	}
+}
+
+static void printPathToRoot(const HeapSnapshot* snapshot, const ShortestPaths* paths, const ClassTable* classes, NodeId node)
+{
+	const HeapGraph* graph = &snapshot->graph;
+	std::vector<NodeId> path = pathFromRoot(paths, node);
+
+	for (auto it = path.begin(); it != path.end(); ++it)
+	{
+		NodeId from = paths->parent[*it];
+		uint32_t label = graph->edgeLabels[paths->parentEdge[*it]];
+		stdout_message("        %s %s\n", describeEdge(graph, classes, from, label).c_str(),
+		               describeNode(graph, classes, *it).c_str());
+	}
+}
+
+static bool moreRetained(const LoaderStats* a, const LoaderStats* b)
+{
+	return a->retained > b->retained;
+}
+
+jint reportClassLoaders(const HeapSnapshot* snapshot, const ClassTable* classes, jint top)
+{
+	const HeapGraph* graph = &snapshot->graph;
+	size_t nodes = graphNodeCount(graph);
+	std::vector<LoaderStats> loaders(1);
+	std::unordered_map<NodeId, size_t> loaderIndex;
+
+	/* Group 0 is the bootstrap loader, classes without a loader edge */
+	loaders[0].loader = kNoNode;
+
+	/* Class objects, the loader of each class tag */
+	std::vector<uint32_t> classGroup;
+	for (NodeId n = 1; n < nodes; ++n)
+	{
+		if ((graph->flags[n] & kNodeIsClass) == 0)
+		{
+			continue;
+		}
+
+		NodeId loader = definingLoader(graph, n);
+		size_t g = 0;
+		if (loader != kNoNode)
+		{
+			auto it = loaderIndex.find(loader);
+			if (it == loaderIndex.end())
+			{
+				LoaderStats stats = {};
+				stats.loader = loader;
+				loaders.push_back(stats);
+				it = loaderIndex.insert(std::make_pair(loader, loaders.size() - 1)).first;
+			}
+			g = it->second;
+		}
+		loaders[g].classNodes.push_back(n);
+
+		uint32_t class_id = graph->classIds[n];
+		if (class_id >= classGroup.size())
+		{
+			classGroup.resize(size_t(class_id) + 1, 0);
+		}
+		classGroup[class_id] = uint32_t(g);
+	}
+
+	/* Instances, by the loader of their class */
+	for (NodeId n = 1; n < nodes; ++n)
+	{
+		uint32_t class_id = graph->classIds[n];
+		if ((graph->flags[n] & (kNodeIsClass | kNodeIsVirtual)) == 0 && class_id < classGroup.size())
+		{
+			LoaderStats* stats = &loaders[classGroup[class_id]];
+			stats->instances++;
+			stats->instanceBytes += graph->sizes[n];
+		}
+	}
+
+	computeGroupRetained(snapshot, loaders);
+
+	std::vector<const LoaderStats*> sorted;
+	std::vector<const LoaderStats*> leaks;
+	for (auto it = loaders.begin(); it != loaders.end(); ++it)
+	{
+		sorted.push_back(&*it);
+		if (it->loader != kNoNode && it->instances == 0)
+		{
+			leaks.push_back(&*it);
+		}
+	}
+
+	size_t shown = std::min(sorted.size(), size_t(top > 0 ? top : 0));
+	std::partial_sort(sorted.begin(), sorted.begin() + shown, sorted.end(), &moreRetained);
+	std::sort(leaks.begin(), leaks.end(), &moreRetained);
+
+	stdout_message("Class loaders: %d\n", int(loaders.size()));
+	for (size_t i = 0; i < shown; ++i)
+	{
+		const LoaderStats* stats = sorted[i];
+		std::string name = stats->loader == kNoNode ? "<bootstrap>" : describeNode(graph, classes, stats->loader);
+		stdout_message(" %3d. %-50s classes %6d, instances %10lld (%lld bytes), retained %14lld bytes\n",
+		               int(i + 1), name.c_str(), int(stats->classNodes.size()), (long long)stats->instances,
+		               (long long)stats->instanceBytes, (long long)stats->retained);
+	}
+
+	if (!leaks.empty())
+	{
+		ShortestPaths paths;
+		computeShortestPaths(graph, &paths);
+
+		stdout_message("\nReachable loaders without instances of their classes: %d\n", int(leaks.size()));
+		for (size_t i = 0; i < leaks.size(); ++i)
+		{
+			const LoaderStats* stats = leaks[i];
+			stdout_message(" %3d. %s, classes %d, retained %lld bytes, kept alive by:\n", int(i + 1),
+			               describeNode(graph, classes, stats->loader).c_str(), int(stats->classNodes.size()),
+			               (long long)stats->retained);
+			printPathToRoot(snapshot, &paths, classes, stats->loader);
+		}
+	}
+
+	return jint(leaks.size());
+}
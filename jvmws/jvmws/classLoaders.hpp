@@ -0,0 +1,20 @@
+#pragma once
+
+
+#ifndef CLASS_LOADERS_H
+#define CLASS_LOADERS_H
+
+#include <jni.h>
+
+#include "classTable.hpp"
+#include "heapSnapshot.hpp"
+
+/* Prints the memory retained by each class loader together with the
+ *   classes it defined, and the loaders that look leaked: still reachable
+ *   but without a single instance of their classes left, each with the
+ *   shortest path from a GC root keeping it alive.
+ *   Returns the number of suspected leaks.
+ */
+jint reportClassLoaders(const HeapSnapshot* snapshot, const ClassTable* classes, jint top);
+
+#endif
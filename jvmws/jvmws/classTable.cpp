@@ -0,0 +1,259 @@
+#include <algorithm>
+
+#include "agent_util.hpp"
+#include "analysisTags.hpp"
+#include "classTable.hpp"
+
+/* "Ljava/lang/String;" -> "java.lang.String", "[[I" -> "int[][]" */
+static std::string javaNameOf(const char* signature)
+{
+	std::string name;
+	int dimensions = 0;
+
+	while (*signature == '[')
+	{
+		dimensions++;
+		signature++;
+	}
+
+	switch (*signature)
+	{
+	case 'Z': name = "boolean"; break;
+	case 'B': name = "byte"; break;
+	case 'C': name = "char"; break;
+	case 'S': name = "short"; break;
+	case 'I': name = "int"; break;
+	case 'J': name = "long"; break;
+	case 'F': name = "float"; break;
+	case 'D': name = "double"; break;
+	case 'L':
+		for (signature++; *signature != 0 && *signature != ';'; ++signature)
+		{
+			name += (*signature == '/') ? '.' : *signature;
+		}
+		break;
+	default:
+		name = signature;
+		break;
+	}
+
+	for (auto i = 0; i < dimensions; ++i)
+	{
+		name += "[]";
+	}
+	return name;
+}
+
+static jlong ensureClass(jvmtiEnv* jvmti, JNIEnv* env, ClassTable* table, jclass klass);
+
+/* Builds the field layout of a class from the layout of its superclass and
+ *   the fields of its interfaces. Classes that are not prepared yet are
+ *   left unresolved and retried by the next refresh.
+ */
+static void resolveFields(jvmtiEnv* jvmti, JNIEnv* env, ClassTable* table, jlong tag, jclass klass)
+{
+	jvmtiError err;
+	jint field_count;
+	jfieldID* fields;
+	jint interface_count;
+	jclass* direct_interfaces;
+	std::vector<FieldInfo> layout;
+	std::vector<jlong> interfaces;
+	bool resolved = true;
+
+	err = jvmti->GetClassFields(klass, &field_count, &fields);
+	if (err == JVMTI_ERROR_CLASS_NOT_PREPARED)
+	{
+		return;
+	}
+	check_jvmti_error(jvmti, err, "get class fields");
+
+	err = jvmti->GetImplementedInterfaces(klass, &interface_count, &direct_interfaces);
+	check_jvmti_error(jvmti, err, "get implemented interfaces");
+
+	for (auto i = 0; i < interface_count; ++i)
+	{
+		jlong interface_tag = ensureClass(jvmti, env, table, direct_interfaces[i]);
+		const ClassInfo* info = &table->classes[size_t(interface_tag - 1)];
+		resolved = resolved && info->fieldsResolved;
+		interfaces.push_back(interface_tag);
+		interfaces.insert(interfaces.end(), info->interfaces.begin(), info->interfaces.end());
+		env->DeleteLocalRef(direct_interfaces[i]);
+	}
+	deallocate(jvmti, reinterpret_cast<unsigned char*>(direct_interfaces));
+
+	if (!table->classes[size_t(tag - 1)].isInterface)
+	{
+		jclass superclass = env->GetSuperclass(klass);
+		if (superclass != nullptr)
+		{
+			jlong super_tag = ensureClass(jvmti, env, table, superclass);
+			const ClassInfo* info = &table->classes[size_t(super_tag - 1)];
+			resolved = resolved && info->fieldsResolved;
+			layout = info->fields;
+			interfaces.insert(interfaces.end(), info->interfaces.begin(), info->interfaces.end());
+			env->DeleteLocalRef(superclass);
+		}
+	}
+
+	std::sort(interfaces.begin(), interfaces.end());
+	interfaces.erase(std::unique(interfaces.begin(), interfaces.end()), interfaces.end());
+
+	jint interface_fields = 0;
+	for (auto it = interfaces.begin(); it != interfaces.end(); ++it)
+	{
+		interface_fields += table->classes[size_t(*it - 1)].declaredFieldCount;
+	}
+
+	for (auto i = 0; i < field_count; ++i)
+	{
+		char* name;
+		char* signature;
+		jint modifiers;
+		FieldInfo field;
+
+		err = jvmti->GetFieldName(klass, fields[i], &name, &signature, nullptr);
+		check_jvmti_error(jvmti, err, "get field name");
+		err = jvmti->GetFieldModifiers(klass, fields[i], &modifiers);
+		check_jvmti_error(jvmti, err, "get field modifiers");
+
+		field.name = name;
+		field.declaringClassTag = tag;
+		field.type = signature[0];
+		field.isStatic = (modifiers & 0x0008) != 0;
+		layout.push_back(field);
+
+		deallocate(jvmti, reinterpret_cast<unsigned char*>(name));
+		deallocate(jvmti, reinterpret_cast<unsigned char*>(signature));
+	}
+	deallocate(jvmti, reinterpret_cast<unsigned char*>(fields));
+
+	/* Entries may have moved while the supertypes were added */
+	ClassInfo* info = &table->classes[size_t(tag - 1)];
+	if (info->declaredFieldCount != field_count)
+	{
+		info->declaredFieldCount = field_count;
+		++table->version;
+	}
+	if (resolved)
+	{
+		info->fields.swap(layout);
+		info->interfaces.swap(interfaces);
+		info->interfaceFieldCount = interface_fields;
+		info->fieldsResolved = true;
+		++table->version;
+	}
+}
+
+/* Class tag of a class, adding it to the table when it is new */
+static jlong ensureClass(jvmtiEnv* jvmti, JNIEnv* env, ClassTable* table, jclass klass)
+{
+	jvmtiError err;
+	jlong tag;
+
+	err = jvmti->GetTag(klass, &tag);
+	check_jvmti_error(jvmti, err, "get class tag");
+
+	/* Classes loaded during a snapshot walk carry a node tag */
+	if (!isClassTag(tag) || size_t(tag) > table->classes.size())
+	{
+		char* signature;
+		jboolean is_interface;
+		ClassInfo info;
+
+		err = jvmti->GetClassSignature(klass, &signature, nullptr);
+		check_jvmti_error(jvmti, err, "get class signature");
+		err = jvmti->IsInterface(klass, &is_interface);
+		check_jvmti_error(jvmti, err, "is interface");
+
+		info.signature = signature;
+		info.name = javaNameOf(signature);
+		info.isArray = signature[0] == '[';
+		info.primitiveArrayType = (signature[0] == '[' && signature[1] != '[' && signature[1] != 'L') ? signature[1] : 0;
+		info.isInterface = is_interface;
+		info.interfaceFieldCount = 0;
+		info.declaredFieldCount = 0;
+		/* Arrays have no fields of their own */
+		info.fieldsResolved = info.isArray;
+		deallocate(jvmti, reinterpret_cast<unsigned char*>(signature));
+
+		table->classes.push_back(info);
+		++table->version;
+		tag = jlong(table->classes.size());
+		err = jvmti->SetTag(klass, tag);
+		check_jvmti_error(jvmti, err, "set class tag");
+	}
+
+	if (!table->classes[size_t(tag - 1)].fieldsResolved)
+	{
+		resolveFields(jvmti, env, table, tag, klass);
+	}
+	return tag;
+}
+
+void refreshClassTable(jvmtiEnv* jvmti, JNIEnv* env, ClassTable* table)
+{
+	jvmtiError err;
+	jint class_count;
+	jclass* classes;
+
+	err = jvmti->GetLoadedClasses(&class_count, &classes);
+	check_jvmti_error(jvmti, err, "get loaded classes");
+
+	for (auto i = 0; i < class_count; ++i)
+	{
+		ensureClass(jvmti, env, table, classes[i]);
+		env->DeleteLocalRef(classes[i]);
+	}
+
+	deallocate(jvmti, reinterpret_cast<unsigned char*>(classes));
+}
+
+const ClassInfo* findClassInfo(const ClassTable* table, jlong class_tag)
+{
+	if (class_tag <= 0 || size_t(class_tag) > table->classes.size())
+	{
+		return nullptr;
+	}
+	return &table->classes[size_t(class_tag - 1)];
+}
+
+const char* classNameOf(const ClassTable* table, jlong class_tag)
+{
+	const ClassInfo* info = findClassInfo(table, class_tag);
+	return info != nullptr ? info->name.c_str() : "<unknown>";
+}
+
+const FieldInfo* findFieldInfo(const ClassTable* table, jlong class_tag, jint index)
+{
+	const ClassInfo* info = findClassInfo(table, class_tag);
+	if (info == nullptr)
+	{
+		return nullptr;
+	}
+
+	index -= info->interfaceFieldCount;
+	if (index < 0 || size_t(index) >= info->fields.size())
+	{
+		return nullptr;
+	}
+	return &info->fields[size_t(index)];
+}
+
+std::string fieldNameOf(const ClassTable* table, jlong class_tag, jint index)
+{
+	const FieldInfo* field = findFieldInfo(table, class_tag, index);
+	if (field == nullptr)
+	{
+		return "field#" + std::to_string((long long)index);
+	}
+
+	/* Declaring class without its package */
+	std::string name = classNameOf(table, field->declaringClassTag);
+	size_t dot = name.rfind('.');
+	if (dot != std::string::npos)
+	{
+		name.erase(0, dot + 1);
+	}
+	return name + "." + field->name;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+
+#ifndef CLASS_TABLE_H
+#define CLASS_TABLE_H
+
+#include <vector>
+#include <string>
+
+#include <stdint.h>
+
+#include <jni.h>
+#include <ibmjvmti.h>
+
+/* A field in the layout of a class */
+typedef struct FieldInfo
+{
+	std::string name;
+
+	/* Class tag of the declaring class */
+	jlong declaringClassTag;
+
+	/* First character of the field signature, 'L' or '[' for references */
+	char type;
+
+	jboolean isStatic;
+} FieldInfo;
+
+/* Loaded classes known to the heap analyses. Every class is tagged in the
+ *   analysis JVMTI environment with its index in the table plus one, so the
+ *   class_tag passed to the heap callbacks leads straight to its entry.
+ */
+typedef struct ClassInfo
+{
+	/* JVM signature, e.g. "Ljava/lang/String;" or "[B" */
+	std::string signature;
+
+	/* Java name, e.g. "java.lang.String" or "byte[]" */
+	std::string name;
+
+	jboolean isArray;
+
+	/* Element signature character of primitive arrays, 0 otherwise */
+	char primitiveArrayType;
+
+	jboolean isInterface;
+
+	/* Fields in the index order of the JVMTI heap callbacks: the fields of
+	 *   java.lang.Object down to this class (only its own for interfaces),
+	 *   each class in GetClassFields order. The indexes start after the
+	 *   fields of all implemented interfaces, which are not listed.
+	 */
+	std::vector<FieldInfo> fields;
+	jint interfaceFieldCount;
+	jint declaredFieldCount;
+
+	/* Class tags of all interfaces implemented, directly or inherited */
+	std::vector<jlong> interfaces;
+
+	/* False until the class is prepared and its layout built */
+	jboolean fieldsResolved;
+} ClassInfo;
+
+typedef struct ClassTable
+{
+	std::vector<ClassInfo> classes;
+
+	/* Bumped by every change refreshClassTable makes, copies of the table
+	 *   compare it to tell whether they are still current */
+	uint64_t version;
+} ClassTable;
+
+/* Tags the loaded classes that are not in the table yet and builds the
+ *   field layouts still missing */
+void refreshClassTable(jvmtiEnv* jvmti, JNIEnv* env, ClassTable* table);
+
+/* Entry of a class tag, nullptr for untagged or unknown classes */
+const ClassInfo* findClassInfo(const ClassTable* table, jlong class_tag);
+
+/* Java name of a class tag, "<unknown>" when not in the table */
+const char* classNameOf(const ClassTable* table, jlong class_tag);
+
+/* Field of a FIELD or STATIC_FIELD reference index, nullptr when unknown.
+ *   For static fields class_tag is the tag of the referring class itself. */
+const FieldInfo* findFieldInfo(const ClassTable* table, jlong class_tag, jint index);
+
+/* "DeclaringClass.field", or "field#index" when the field is unknown */
+std::string fieldNameOf(const ClassTable* table, jlong class_tag, jint index);
+
+#endif
@@ -0,0 +1,319 @@
+#include <string.h>
+
+#include <string>
+#include <algorithm>
+
+#include "agent_util.hpp"
+#include "heapSnapshot.hpp"
+#include "collectionOverhead.hpp"
+
+/* HashMap and HashSet with this many entries or less count as tiny */
+static const jint kTinyMap = 2;
+
+static const jint kDefaultListCapacity = 10;
+static const jint kDefaultMapCapacity = 16;
+
+static const char* const kCollectionNames[kCollectionKinds] = { "", "ArrayList", "HashMap", "HashSet" };
+
+/* The collection fields a class declares or inherits */
+static CollectionLayout findCollectionLayout(const ClassTable* classes, const ClassInfo* info)
+{
+	CollectionLayout layout = { kNotCollection, -1, -1 };
+	jint listSize = -1;
+	jint listData = -1;
+	jint mapSize = -1;
+	jint mapTable = -1;
+	jint setMap = -1;
+
+	for (size_t f = 0; f < info->fields.size(); ++f)
+	{
+		const FieldInfo* field = &info->fields[f];
+		jint index = info->interfaceFieldCount + jint(f);
+		if (field->isStatic)
+		{
+			continue;
+		}
+
+		const char* declaring = classNameOf(classes, field->declaringClassTag);
+		if (strcmp(declaring, "java.util.ArrayList") == 0)
+		{
+			listSize = field->name == "size" ? index : listSize;
+			listData = field->name == "elementData" ? index : listData;
+		}
+		else if (strcmp(declaring, "java.util.HashMap") == 0)
+		{
+			mapSize = field->name == "size" ? index : mapSize;
+			mapTable = field->name == "table" ? index : mapTable;
+		}
+		else if (strcmp(declaring, "java.util.HashSet") == 0)
+		{
+			setMap = field->name == "map" ? index : setMap;
+		}
+	}
+
+	if (listSize >= 0 && listData >= 0)
+	{
+		layout.kind = kArrayList;
+		layout.sizeField = listSize;
+		layout.backingField = listData;
+	}
+	else if (mapSize >= 0 && mapTable >= 0)
+	{
+		layout.kind = kHashMap;
+		layout.sizeField = mapSize;
+		layout.backingField = mapTable;
+	}
+	else if (setMap >= 0)
+	{
+		layout.kind = kHashSet;
+		layout.backingField = setMap;
+	}
+	return layout;
+}
+
+void initCollectionCapture(CollectionCapture* capture, const ClassTable* classes, CollectionCensus* census)
+{
+	CollectionLayout none = { kNotCollection, -1, -1 };
+
+	capture->layouts.layouts.assign(classes->classes.size() + 1, none);
+	for (size_t c = 0; c < classes->classes.size(); ++c)
+	{
+		if (!classes->classes[c].isArray && classes->classes[c].fieldsResolved)
+		{
+			capture->layouts.layouts[c + 1] = findCollectionLayout(classes, &classes->classes[c]);
+		}
+	}
+	capture->census = census;
+	capture->census->instances.clear();
+	capture->records.clear();
+}
+
+void noteCollection(CollectionCapture* capture, const CollectionLayout* layout, NodeId node, NodeId owner, uint32_t label)
+{
+	CollectionInstance instance = { node, owner, label, layout->kind, false, 0, 0, 0, kNoCollection };
+
+	capture->records[node] = uint32_t(capture->census->instances.size());
+	capture->census->instances.push_back(instance);
+}
+
+void noteCollectionSize(CollectionCapture* capture, NodeId node, jint size)
+{
+	auto record = capture->records.find(node);
+	if (record != capture->records.end())
+	{
+		capture->census->instances[record->second].size = size;
+	}
+}
+
+void noteCollectionBacking(CollectionCapture* capture, NodeId node, NodeId target, jint length, jlong size)
+{
+	auto record = capture->records.find(node);
+	if (record == capture->records.end())
+	{
+		return;
+	}
+
+	CollectionInstance* instance = &capture->census->instances[record->second];
+	if (instance->kind == kHashSet)
+	{
+		auto map = capture->records.find(target);
+		if (map != capture->records.end())
+		{
+			instance->backing = map->second;
+			capture->census->instances[map->second].inSet = true;
+		}
+	}
+	else if (length > 0)
+	{
+		/* Empty lists share zero-length arrays, they cost nothing */
+		instance->capacity = length;
+		instance->backingBytes = uint64_t(size);
+	}
+}
+
+typedef struct CollectionWaste
+{
+	uint64_t collections;
+	uint64_t empty;
+	uint64_t tiny;
+	uint64_t oversized;
+	uint64_t bytes;
+	uint64_t wasted;
+} CollectionWaste;
+
+/* Who a collection is charged to. Array elements and roots are not told
+ *   apart by index, so one array or root kind is one owner. */
+typedef struct CollectionOwner
+{
+	uint32_t classId;
+	uint32_t label;
+	uint8_t flags;
+	uint8_t kind;
+
+	bool operator==(const CollectionOwner& other) const
+	{
+		return classId == other.classId && label == other.label && flags == other.flags && kind == other.kind;
+	}
+} CollectionOwner;
+
+struct CollectionOwnerHash
+{
+	size_t operator()(const CollectionOwner& owner) const
+	{
+		uint64_t h = (uint64_t(owner.classId) << 32 | owner.label) * 0x9E3779B185EBCA87ULL;
+		h ^= (uint64_t(owner.flags) << 8 | owner.kind) * 0xC2B2AE3D27D4EB4FULL;
+		return size_t(h ^ (h >> 29));
+	}
+};
+
+typedef struct OwnerWaste
+{
+	CollectionOwner owner;
+
+	/* An owner node, to describe the reference */
+	NodeId sample;
+	CollectionWaste waste;
+} OwnerWaste;
+
+static void measureCollection(const HeapGraph* graph, const CollectionCensus* census, const CollectionInstance& instance,
+                              CollectionWaste* waste)
+{
+	uint64_t bytes = graph->sizes[instance.node];
+	jint size = instance.size;
+	jint capacity = instance.capacity;
+	uint64_t backingBytes = instance.backingBytes;
+
+	if (instance.backing != kNoCollection)
+	{
+		const CollectionInstance& map = census->instances[instance.backing];
+		bytes += graph->sizes[map.node];
+		size = map.size;
+		capacity = map.capacity;
+		backingBytes = map.backingBytes;
+	}
+	bytes += backingBytes;
+
+	waste->collections++;
+	waste->bytes += bytes;
+	if (size <= 0)
+	{
+		waste->empty++;
+		waste->wasted += bytes;
+		return;
+	}
+
+	/* Maps resize at three quarters full */
+	uint64_t needed = instance.kind == kArrayList ? uint64_t(size) : (uint64_t(size) * 4 + 2) / 3;
+	if (capacity > 0 && uint64_t(capacity) > needed)
+	{
+		waste->wasted += (uint64_t(capacity) - needed) * backingBytes / uint64_t(capacity);
+	}
+
+	jint defaultCapacity = instance.kind == kArrayList ? kDefaultListCapacity : kDefaultMapCapacity;
+	if (instance.kind != kArrayList && size <= kTinyMap)
+	{
+		waste->tiny++;
+	}
+	else if (capacity > defaultCapacity && uint64_t(capacity) > 2 * needed)
+	{
+		waste->oversized++;
+	}
+}
+
+static void addWaste(CollectionWaste* total, const CollectionWaste& waste)
+{
+	total->collections += waste.collections;
+	total->empty += waste.empty;
+	total->tiny += waste.tiny;
+	total->oversized += waste.oversized;
+	total->bytes += waste.bytes;
+	total->wasted += waste.wasted;
+}
+
+static bool moreWasted(const OwnerWaste& a, const OwnerWaste& b)
+{
+	return a.waste.wasted > b.waste.wasted;
+}
+
+static std::string describeOwner(const HeapGraph* graph, const ClassTable* classes, const OwnerWaste& owner)
+{
+	uint32_t kind = edgeLabelKind(owner.owner.label);
+
+	if (owner.sample != kRootNode && (owner.owner.flags & kNodeIsVirtual) == 0 &&
+	    kind == JVMTI_HEAP_REFERENCE_ARRAY_ELEMENT)
+	{
+		return std::string(classNameOf(classes, owner.owner.classId)) + " elements";
+	}
+	return describeEdge(graph, classes, owner.sample, owner.owner.label);
+}
+
+jint reportCollectionOverhead(const HeapGraph* graph, const CollectionCensus* census, const ClassTable* classes, jint top)
+{
+	CollectionWaste byKind[kCollectionKinds] = {};
+	CollectionWaste all = {};
+	std::unordered_map<CollectionOwner, size_t, CollectionOwnerHash> ownerIndex;
+	std::vector<OwnerWaste> owners;
+
+	for (auto it = census->instances.begin(); it != census->instances.end(); ++it)
+	{
+		if (it->inSet)
+		{
+			continue;
+		}
+
+		CollectionWaste waste = {};
+		measureCollection(graph, census, *it, &waste);
+		addWaste(&byKind[it->kind], waste);
+		addWaste(&all, waste);
+
+		uint32_t kind = edgeLabelKind(it->ownerLabel);
+		CollectionOwner owner;
+		owner.classId = graph->classIds[it->owner];
+		owner.flags = graph->flags[it->owner];
+		owner.kind = it->kind;
+		owner.label = kind == JVMTI_HEAP_REFERENCE_FIELD || kind == JVMTI_HEAP_REFERENCE_STATIC_FIELD ?
+			it->ownerLabel : packEdgeLabel(kind, 0);
+		if (it->owner == kRootNode)
+		{
+			owner.classId = 0;
+		}
+
+		auto found = ownerIndex.find(owner);
+		if (found == ownerIndex.end())
+		{
+			OwnerWaste entry = {};
+			entry.owner = owner;
+			entry.sample = it->owner;
+			owners.push_back(entry);
+			found = ownerIndex.insert(std::make_pair(owner, owners.size() - 1)).first;
+		}
+		addWaste(&owners[found->second].waste, waste);
+	}
+
+	stdout_message("Collections:\n");
+	stdout_message("  %-10s %12s %12s %12s %12s %16s %16s\n", "", "instances", "empty", "tiny", "oversized", "bytes", "wasted");
+	for (int kind = kArrayList; kind < kCollectionKinds; ++kind)
+	{
+		const CollectionWaste* waste = &byKind[kind];
+		stdout_message("  %-10s %12lld %12lld %12lld %12lld %16lld %16lld\n", kCollectionNames[kind],
+		               (long long)waste->collections, (long long)waste->empty, (long long)waste->tiny,
+		               (long long)waste->oversized, (long long)waste->bytes, (long long)waste->wasted);
+	}
+	stdout_message("  wasted by empty collections and unused capacity: %lld of %lld bytes\n",
+	               (long long)all.wasted, (long long)all.bytes);
+
+	size_t shown = std::min(owners.size(), size_t(top > 0 ? top : 0));
+	std::partial_sort(owners.begin(), owners.begin() + shown, owners.end(), &moreWasted);
+
+	stdout_message("\nTop %d owners by wasted bytes:\n", int(shown));
+	for (size_t i = 0; i < shown; ++i)
+	{
+		const CollectionWaste* waste = &owners[i].waste;
+		stdout_message(" %3d. %-50s %-9s collections %10lld, empty %10lld, tiny %10lld, oversized %10lld, wasted %14lld bytes\n",
+		               int(i + 1), describeOwner(graph, classes, owners[i]).c_str(), kCollectionNames[owners[i].owner.kind],
+		               (long long)waste->collections, (long long)waste->empty, (long long)waste->tiny,
+		               (long long)waste->oversized, (long long)waste->wasted);
+	}
+
+	return jint(all.collections);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+
+#ifndef COLLECTION_OVERHEAD_H
+#define COLLECTION_OVERHEAD_H
+
+#include <vector>
+#include <unordered_map>
+
+#include <stdint.h>
+
+#include <jni.h>
+#include <ibmjvmti.h>
+
+#include "heapGraph.hpp"
+#include "classTable.hpp"
+
+/* Overhead of the JDK collections, gathered by the snapshot walk. Classes
+ *   holding the fields of java.util.ArrayList, HashMap or HashSet are
+ *   recognized from the class table before the walk, subclasses included.
+ *   The walk reads their size from the primitive field callback and the
+ *   capacity from the length of the array their elementData or table
+ *   field references, a HashSet takes both from its map. Nothing is
+ *   called per collection, it costs a class tag lookup per field.
+ *   Collections are charged to the class and field that first referenced
+ *   them.
+ */
+enum CollectionKind
+{
+	kNotCollection,
+	kArrayList,
+	kHashMap,
+	kHashSet,
+	kCollectionKinds
+};
+
+/* Fields of a collection class, in the index order of the heap callbacks */
+typedef struct CollectionLayout
+{
+	uint8_t kind;
+	jint sizeField;
+
+	/* elementData, table, or the map of a HashSet */
+	jint backingField;
+} CollectionLayout;
+
+/* Layouts by class tag */
+typedef struct CollectionLayouts
+{
+	std::vector<CollectionLayout> layouts;
+} CollectionLayouts;
+
+static const uint32_t kNoCollection = 0xFFFFFFFFu;
+
+typedef struct CollectionInstance
+{
+	NodeId node;
+
+	/* First referrer and the label of its reference */
+	NodeId owner;
+	uint32_t ownerLabel;
+
+	uint8_t kind;
+
+	/* The map of a set, charged to the set */
+	bool inSet;
+	jint size;
+	jint capacity;
+	uint64_t backingBytes;
+
+	/* The map record of a HashSet, kNoCollection otherwise */
+	uint32_t backing;
+} CollectionInstance;
+
+typedef struct CollectionCensus
+{
+	std::vector<CollectionInstance> instances;
+} CollectionCensus;
+
+/* State of the snapshot walk */
+typedef struct CollectionCapture
+{
+	CollectionLayouts layouts;
+	CollectionCensus* census;
+
+	/* Record of a collection node */
+	std::unordered_map<NodeId, uint32_t> records;
+} CollectionCapture;
+
+void initCollectionCapture(CollectionCapture* capture, const ClassTable* classes, CollectionCensus* census);
+
+inline const CollectionLayout* collectionLayoutOf(const CollectionCapture* capture, jlong class_tag)
+{
+	const std::vector<CollectionLayout>& layouts = capture->layouts.layouts;
+	if (class_tag <= 0 || size_t(class_tag) >= layouts.size() || layouts[size_t(class_tag)].kind == kNotCollection)
+	{
+		return nullptr;
+	}
+	return &layouts[size_t(class_tag)];
+}
+
+/* A collection node created by the walk */
+void noteCollection(CollectionCapture* capture, const CollectionLayout* layout, NodeId node, NodeId owner, uint32_t label);
+
+/* The size field of a collection */
+void noteCollectionSize(CollectionCapture* capture, NodeId node, jint size);
+
+/* The backing field of a collection references target, an array of length
+ *   elements or the map of a set */
+void noteCollectionBacking(CollectionCapture* capture, NodeId node, NodeId target, jint length, jlong size);
+
+/* Prints the collections by kind and the owners wasting the most bytes.
+ *   Returns the number of collections found. */
+jint reportCollectionOverhead(const HeapGraph* graph, const CollectionCensus* census, const ClassTable* classes, jint top);
+
+#endif
@@ -0,0 +1,314 @@
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "agent_util.hpp"
+#include "arrayScan.hpp"
+#include "duplicates.hpp"
+
+static const char* contentClassNames[CONTENT_CLASS_COUNT] = {
+	"boolean[]", "byte[]", "char[]", "short[]", "int[]", "long[]", "float[]", "double[]", "java.lang.String"
+};
+
+static const size_t contentElementSizes[CONTENT_CLASS_COUNT] = { 1, 1, 2, 2, 4, 8, 4, 8, 2 };
+
+/* Bytes of a duplicated value kept for printing */
+static const size_t kPreviewBytes = 64;
+
+static jint contentClassOf(jvmtiPrimitiveType element_type)
+{
+	switch (element_type)
+	{
+	case JVMTI_PRIMITIVE_TYPE_BOOLEAN:
+		return CONTENT_BOOLEAN;
+	case JVMTI_PRIMITIVE_TYPE_BYTE:
+		return CONTENT_BYTE;
+	case JVMTI_PRIMITIVE_TYPE_CHAR:
+		return CONTENT_CHAR;
+	case JVMTI_PRIMITIVE_TYPE_SHORT:
+		return CONTENT_SHORT;
+	case JVMTI_PRIMITIVE_TYPE_INT:
+		return CONTENT_INT;
+	case JVMTI_PRIMITIVE_TYPE_LONG:
+		return CONTENT_LONG;
+	case JVMTI_PRIMITIVE_TYPE_FLOAT:
+		return CONTENT_FLOAT;
+	case JVMTI_PRIMITIVE_TYPE_DOUBLE:
+	default:
+		return CONTENT_DOUBLE;
+	}
+}
+
+static void growDuplicateScan(DuplicateScan* scan)
+{
+	std::vector<DuplicateGroup> old;
+	old.swap(scan->slots);
+
+	DuplicateGroup empty = {};
+	scan->slots.assign(old.empty() ? size_t(1) << 16 : old.size() * 2, empty);
+
+	size_t mask = scan->slots.size() - 1;
+	for (auto it = old.begin(); it != old.end(); ++it)
+	{
+		if (it->count != 0)
+		{
+			size_t i = size_t(it->hash) & mask;
+			while (scan->slots[i].count != 0)
+			{
+				i = (i + 1) & mask;
+			}
+			scan->slots[i] = *it;
+		}
+	}
+}
+
+static void addContent(DuplicateScan* scan, jint content, jlong size, const void* elements, jint length)
+{
+	size_t bytes = size_t(length) * contentElementSizes[content];
+	uint64_t hash = hashArrayBytes(elements, bytes, uint64_t(content));
+
+	ContentTotals* totals = &scan->totals[content];
+	totals->count++;
+	totals->bytes += size;
+
+	if ((scan->used + 1) * 10 > scan->slots.size() * 7)
+	{
+		growDuplicateScan(scan);
+	}
+
+	size_t mask = scan->slots.size() - 1;
+	size_t i = size_t(hash) & mask;
+	for (;;)
+	{
+		DuplicateGroup* group = &scan->slots[i];
+		if (group->count == 0)
+		{
+			group->hash = hash;
+			group->size = size;
+			group->length = length;
+			group->count = 1;
+			group->preview = 0;
+			group->content = content;
+			scan->used++;
+			return;
+		}
+		if (group->hash == hash && group->length == length && group->content == content)
+		{
+			group->count++;
+			totals->duplicates++;
+			totals->wasted += group->size;
+			if (group->preview == 0)
+			{
+				/* Only values seen twice pay for a copy */
+				scan->previews.push_back(std::string(static_cast<const char*>(elements), std::min(bytes, kPreviewBytes)));
+				group->preview = jint(scan->previews.size());
+			}
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+void initDuplicateScan(DuplicateScan* scan)
+{
+	scan->slots.clear();
+	scan->used = 0;
+	scan->previews.clear();
+	memset(scan->totals, 0, sizeof(scan->totals));
+	growDuplicateScan(scan);
+}
+
+void addDuplicateArray(DuplicateScan* scan, jlong size, jvmtiPrimitiveType element_type, const void* elements, jint element_count)
+{
+	addContent(scan, contentClassOf(element_type), size, elements, element_count);
+}
+
+void addDuplicateString(DuplicateScan* scan, jlong size, const jchar* value, jint value_length)
+{
+	addContent(scan, CONTENT_STRING, size, value, value_length);
+}
+
+typedef struct DuplicateWalk
+{
+	DuplicateScan* scan;
+	WalkBudget* budget;
+} DuplicateWalk;
+
+/* Called before the value callbacks of the same object */
+static jint JNICALL duplicateObjectCallback(jlong class_tag, jlong size, jlong* tag_ptr, jint length, void* user_data)
+{
+	if (!spendWalkBudget(static_cast<DuplicateWalk*>(user_data)->budget, size))
+	{
+		return JVMTI_VISIT_ABORT;
+	}
+	return 0;
+}
+
+static jint JNICALL duplicateArrayCallback(jlong class_tag, jlong size, jlong* tag_ptr, jint element_count,
+                                           jvmtiPrimitiveType element_type, const void* elements, void* user_data)
+{
+	addDuplicateArray(static_cast<DuplicateWalk*>(user_data)->scan, size, element_type, elements, element_count);
+	return 0;
+}
+
+static jint JNICALL duplicateStringCallback(jlong class_tag, jlong size, jlong* tag_ptr, const jchar* value,
+                                            jint value_length, void* user_data)
+{
+	addDuplicateString(static_cast<DuplicateWalk*>(user_data)->scan, size, value, value_length);
+	return 0;
+}
+
+/* Printable form of the first bytes of a value */
+static std::string formatPreview(const DuplicateGroup* group, const std::string& preview)
+{
+	std::string text;
+	size_t elementSize = contentElementSizes[group->content];
+	size_t shown = preview.size() / elementSize;
+	const char* data = preview.data();
+	char buf[64];
+
+	switch (group->content)
+	{
+	case CONTENT_CHAR:
+	case CONTENT_STRING:
+	case CONTENT_BYTE:
+	case CONTENT_BOOLEAN:
+		text += '"';
+		for (size_t i = 0; i < shown; ++i)
+		{
+			unsigned int c;
+			if (elementSize == 2)
+			{
+				jchar ch;
+				memcpy(&ch, data + i * 2, sizeof(ch));
+				c = ch;
+			}
+			else
+			{
+				c = static_cast<unsigned char>(data[i]);
+			}
+			text += (c >= 0x20 && c < 0x7F) ? char(c) : '.';
+		}
+		text += '"';
+		break;
+	default:
+		text += '[';
+		for (size_t i = 0; i < shown && i < 8; ++i)
+		{
+			const char* element = data + i * elementSize;
+			if (group->content == CONTENT_SHORT)
+			{
+				jshort v;
+				memcpy(&v, element, sizeof(v));
+				snprintf(buf, sizeof(buf), "%d", int(v));
+			}
+			else if (group->content == CONTENT_INT)
+			{
+				jint v;
+				memcpy(&v, element, sizeof(v));
+				snprintf(buf, sizeof(buf), "%d", int(v));
+			}
+			else if (group->content == CONTENT_LONG)
+			{
+				jlong v;
+				memcpy(&v, element, sizeof(v));
+				snprintf(buf, sizeof(buf), "%lld", (long long)v);
+			}
+			else if (group->content == CONTENT_FLOAT)
+			{
+				jfloat v;
+				memcpy(&v, element, sizeof(v));
+				snprintf(buf, sizeof(buf), "%g", double(v));
+			}
+			else
+			{
+				jdouble v;
+				memcpy(&v, element, sizeof(v));
+				snprintf(buf, sizeof(buf), "%g", v);
+			}
+			if (i > 0)
+			{
+				text += ", ";
+			}
+			text += buf;
+		}
+		if (shown > 8)
+		{
+			shown = 8;
+		}
+		text += ']';
+		break;
+	}
+
+	if (size_t(group->length) > shown)
+	{
+		text += "...";
+	}
+	return text;
+}
+
+static bool moreWasted(const DuplicateGroup* a, const DuplicateGroup* b)
+{
+	return (a->count - 1) * a->size > (b->count - 1) * b->size;
+}
+
+jint reportDuplicateArrays(jvmtiEnv* jvmti, jint top, WalkBudget* budget)
+{
+	jvmtiError err;
+	jvmtiHeapCallbacks callbacks;
+	DuplicateScan scan;
+	DuplicateWalk walk = { &scan, budget };
+
+	initDuplicateScan(&scan);
+
+	(void)memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.heap_iteration_callback = &duplicateObjectCallback;
+	callbacks.array_primitive_value_callback = &duplicateArrayCallback;
+	callbacks.string_primitive_value_callback = &duplicateStringCallback;
+
+	err = jvmti->IterateThroughHeap(0, nullptr, &callbacks, &walk);
+	check_jvmti_error(jvmti, err, "iterate through heap");
+	finishWalkBudget(budget);
+
+	return printDuplicates(&scan, top);
+}
+
+jint printDuplicates(const DuplicateScan* scan, jint top)
+{
+	stdout_message("Duplicated values (%s hashing):\n", arrayScanUsesAvx2() ? "AVX2" : "scalar");
+	stdout_message("  %-18s %12s %14s %12s %14s\n", "content", "count", "bytes", "duplicates", "wasted");
+	for (auto c = 0; c < CONTENT_CLASS_COUNT; ++c)
+	{
+		const ContentTotals* totals = &scan->totals[c];
+		if (totals->count > 0)
+		{
+			stdout_message("  %-18s %12lld %14lld %12lld %14lld\n", contentClassNames[c],
+			               (long long)totals->count, (long long)totals->bytes,
+			               (long long)totals->duplicates, (long long)totals->wasted);
+		}
+	}
+
+	std::vector<const DuplicateGroup*> duplicated;
+	for (auto it = scan->slots.begin(); it != scan->slots.end(); ++it)
+	{
+		if (it->count > 1)
+		{
+			duplicated.push_back(&*it);
+		}
+	}
+
+	size_t shown = std::min(duplicated.size(), size_t(top > 0 ? top : 0));
+	std::partial_sort(duplicated.begin(), duplicated.begin() + shown, duplicated.end(), &moreWasted);
+
+	stdout_message("\nTop %d duplicated values:\n", int(shown));
+	for (size_t i = 0; i < shown; ++i)
+	{
+		const DuplicateGroup* group = duplicated[i];
+		stdout_message(" %3d. %s x %d (length %d, %lld bytes each), wasted %lld bytes: %s\n",
+		               int(i + 1), contentClassNames[group->content], group->count, group->length,
+		               (long long)group->size, (long long)((group->count - 1) * group->size),
+		               formatPreview(group, scan->previews[group->preview - 1]).c_str());
+	}
+
+	return jint(duplicated.size());
+}
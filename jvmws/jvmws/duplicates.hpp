@@ -0,0 +1,81 @@
+#pragma once
+
+
+#ifndef DUPLICATES_H
+#define DUPLICATES_H
+
+#include <vector>
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <jni.h>
+#include <ibmjvmti.h>
+
+#include "walkBudget.hpp"
+
+/* Content classes of the report, one per primitive array type plus String */
+enum ContentClass
+{
+	CONTENT_BOOLEAN,
+	CONTENT_BYTE,
+	CONTENT_CHAR,
+	CONTENT_SHORT,
+	CONTENT_INT,
+	CONTENT_LONG,
+	CONTENT_FLOAT,
+	CONTENT_DOUBLE,
+	CONTENT_STRING,
+	CONTENT_CLASS_COUNT
+};
+
+/* One distinct value: arrays of equal content class, length and content
+ *   hash are considered equal. count == 0 marks a free slot.
+ */
+typedef struct DuplicateGroup
+{
+	uint64_t hash;
+	jlong size;
+	jint length;
+	jint count;
+	jint preview;
+	jint content;
+} DuplicateGroup;
+
+typedef struct ContentTotals
+{
+	jlong count;
+	jlong bytes;
+	jlong duplicates;
+	jlong wasted;
+} ContentTotals;
+
+/* Open addressing table, the heap callbacks must not call back into the VM
+ *   and a node based map costs an allocation per array.
+ */
+typedef struct DuplicateScan
+{
+	std::vector<DuplicateGroup> slots;
+	size_t used;
+	std::vector<std::string> previews;
+	ContentTotals totals[CONTENT_CLASS_COUNT];
+} DuplicateScan;
+
+/* Walks the heap once, hashing the contents of every primitive array and
+ *   String, and prints the bytes wasted by duplicates per content class
+ *   followed by the top duplicated values. The walk stops when the budget
+ *   is spent, the values hashed so far are reported.
+ *   Returns the number of distinct values that have duplicates.
+ */
+jint reportDuplicateArrays(jvmtiEnv* jvmti, jint top, WalkBudget* budget);
+
+/* The same for walks shared with other analyses: the values reported by
+ *   the primitive array and String callbacks go to addDuplicate*, the
+ *   report is printed from the filled scan */
+void initDuplicateScan(DuplicateScan* scan);
+void addDuplicateArray(DuplicateScan* scan, jlong size, jvmtiPrimitiveType element_type, const void* elements, jint element_count);
+void addDuplicateString(DuplicateScan* scan, jlong size, const jchar* value, jint value_length);
+jint printDuplicates(const DuplicateScan* scan, jint top);
+
+#endif
@@ -0,0 +1,583 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <algorithm>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "agent_util.hpp"
+#include "analysisTags.hpp"
+#include "emergencySnapshot.hpp"
+
+static const char kUnregisteredName[] = "<unregistered class>";
+
+/* Room kept at the end of the report for the truncation notice */
+static const size_t kReportTail = 64;
+
+static jlong monotonicNanos()
+{
+	return jlong(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+bool reserveEmergencySnapshot(EmergencySnapshot* emergency, const char* path)
+{
+	size_t classBytes = sizeof(EmergencyClass) * kEmergencyClasses;
+	size_t orderBytes = sizeof(uint32_t) * kEmergencyClasses;
+
+	emergency->busy.store(false);
+	emergency->fired.store(false);
+	(void)snprintf(emergency->path, sizeof(emergency->path), "%s", path);
+
+	emergency->arenaSize = classBytes + orderBytes + kEmergencyNameBytes + kEmergencyReportBytes;
+	emergency->arena = static_cast<uint8_t*>(malloc(emergency->arenaSize));
+	if (emergency->arena == nullptr)
+	{
+		stdout_message("WARNING: no memory for emergency snapshots, %lld bytes\n", (long long)emergency->arenaSize);
+		return false;
+	}
+
+	/* Touch every page now rather than when memory is short */
+	memset(emergency->arena, 0, emergency->arenaSize);
+	emergency->classes = reinterpret_cast<EmergencyClass*>(emergency->arena);
+	emergency->order = reinterpret_cast<uint32_t*>(emergency->arena + classBytes);
+	emergency->names = reinterpret_cast<char*>(emergency->arena + classBytes + orderBytes);
+	emergency->report = emergency->names + kEmergencyNameBytes;
+
+	memcpy(emergency->names, kUnregisteredName, sizeof(kUnregisteredName));
+	emergency->nameBytes = sizeof(kUnregisteredName);
+	emergency->classes[0].name = 0;
+	emergency->classCount = 1;
+	return true;
+}
+
+/* Appends to the name pool, false when it is full */
+static bool appendName(EmergencySnapshot* emergency, size_t* length, const char* text, size_t count)
+{
+	if (emergency->nameBytes + *length + count + 1 > kEmergencyNameBytes)
+	{
+		return false;
+	}
+	memcpy(emergency->names + emergency->nameBytes + *length, text, count);
+	*length += count;
+	return true;
+}
+
+/* Adds the Java name of a class signature to the pool,
+ *   "Ljava/lang/String;" -> "java.lang.String", "[[I" -> "int[][]" */
+static bool addClassName(EmergencySnapshot* emergency, const char* signature, uint32_t* offset)
+{
+	const char* primitive = nullptr;
+	size_t length = 0;
+	int dimensions = 0;
+
+	while (*signature == '[')
+	{
+		dimensions++;
+		signature++;
+	}
+
+	switch (*signature)
+	{
+	case 'Z': primitive = "boolean"; break;
+	case 'B': primitive = "byte"; break;
+	case 'C': primitive = "char"; break;
+	case 'S': primitive = "short"; break;
+	case 'I': primitive = "int"; break;
+	case 'J': primitive = "long"; break;
+	case 'F': primitive = "float"; break;
+	case 'D': primitive = "double"; break;
+	default: break;
+	}
+
+	if (primitive != nullptr)
+	{
+		if (!appendName(emergency, &length, primitive, strlen(primitive)))
+		{
+			return false;
+		}
+	}
+	else
+	{
+		for (signature += (*signature == 'L') ? 1 : 0; *signature != 0 && *signature != ';'; ++signature)
+		{
+			char c = (*signature == '/') ? '.' : *signature;
+			if (!appendName(emergency, &length, &c, 1))
+			{
+				return false;
+			}
+		}
+	}
+	for (int i = 0; i < dimensions; ++i)
+	{
+		if (!appendName(emergency, &length, "[]", 2))
+		{
+			return false;
+		}
+	}
+
+	*offset = uint32_t(emergency->nameBytes);
+	emergency->names[emergency->nameBytes + length] = 0;
+	emergency->nameBytes += length + 1;
+	return true;
+}
+
+/* Tags the classes loaded since the last capture with their index in the
+ *   arena class table. Failures leave a class unregistered, its objects
+ *   are then counted under index 0. */
+static void registerClasses(jvmtiEnv* jvmti, jvmtiEnv* analysis, JNIEnv* env, EmergencySnapshot* emergency)
+{
+	jint count = 0;
+	jclass* classes = nullptr;
+
+	if (jvmti->GetLoadedClasses(&count, &classes) != JVMTI_ERROR_NONE)
+	{
+		return;
+	}
+
+	for (jint i = 0; i < count; ++i)
+	{
+		jlong tag = 0;
+		jlong analysisTag = 0;
+
+		jvmti->GetTag(classes[i], &tag);
+		if (tag == 0 && emergency->classCount < kEmergencyClasses)
+		{
+			char* signature = nullptr;
+			uint32_t offset;
+
+			if (jvmti->GetClassSignature(classes[i], &signature, nullptr) == JVMTI_ERROR_NONE)
+			{
+				if (addClassName(emergency, signature, &offset))
+				{
+					tag = jlong(emergency->classCount++);
+					emergency->classes[tag].name = offset;
+					emergency->classes[tag].analysisTag = 0;
+					jvmti->SetTag(classes[i], tag);
+				}
+				deallocate(jvmti, reinterpret_cast<unsigned char*>(signature));
+			}
+		}
+
+		/* The analysis table may have picked the class up since */
+		if (tag > 0 && tag < jlong(emergency->classCount) && emergency->classes[tag].analysisTag == 0)
+		{
+			analysis->GetTag(classes[i], &analysisTag);
+			emergency->classes[tag].analysisTag = isClassTag(analysisTag) ? analysisTag : 0;
+		}
+		env->DeleteLocalRef(classes[i]);
+	}
+	deallocate(jvmti, reinterpret_cast<unsigned char*>(classes));
+}
+
+typedef struct LargerObject
+{
+	bool operator()(const EmergencyObject& a, const EmergencyObject& b) const
+	{
+		return a.size > b.size;
+	}
+} LargerObject;
+
+/* Pass 1: histogram and a min-heap of the largest objects */
+static jint JNICALL countObject(jlong class_tag, jlong size, jlong* tag_ptr, jint length, void* user_data)
+{
+	EmergencySnapshot* emergency = static_cast<EmergencySnapshot*>(user_data);
+	EmergencyClass* klass = &emergency->classes[(class_tag > 0 && class_tag < jlong(emergency->classCount)) ? class_tag : 0];
+	EmergencyObject* heap = emergency->largest;
+
+	klass->instances++;
+	klass->bytes += uint64_t(size);
+
+	if (emergency->largestCount < kEmergencyLargest || size > heap[0].size)
+	{
+		if (emergency->largestCount == kEmergencyLargest)
+		{
+			std::pop_heap(heap, heap + kEmergencyLargest, LargerObject());
+			emergency->largestCount--;
+		}
+		heap[emergency->largestCount].size = size;
+		emergency->largestCount++;
+		std::push_heap(heap, heap + emergency->largestCount, LargerObject());
+	}
+	return JVMTI_VISIT_OBJECTS;
+}
+
+/* Pass 2: marks the objects larger than the smallest size kept in pass 1
+ *   and as many of that size as there were slots left, their tag is minus
+ *   their slot plus one */
+static jint JNICALL markLargest(jlong class_tag, jlong size, jlong* tag_ptr, jint length, void* user_data)
+{
+	EmergencySnapshot* emergency = static_cast<EmergencySnapshot*>(user_data);
+	EmergencyObject* object;
+
+	if (*tag_ptr != 0 || emergency->largestCount == kEmergencyLargest || size < emergency->largestSize)
+	{
+		return JVMTI_VISIT_OBJECTS;
+	}
+	if (size == emergency->largestSize)
+	{
+		if (emergency->largestTies == 0)
+		{
+			return JVMTI_VISIT_OBJECTS;
+		}
+		emergency->largestTies--;
+	}
+	object = &emergency->largest[emergency->largestCount];
+	object->size = size;
+	object->classTag = class_tag;
+	object->length = length;
+	object->held = false;
+	*tag_ptr = -jlong(++emergency->largestCount);
+	return JVMTI_VISIT_OBJECTS;
+}
+
+/* Pass 3: the first reference found to each marked object */
+static jint JNICALL findHolder(jvmtiHeapReferenceKind reference_kind, const jvmtiHeapReferenceInfo* reference_info,
+                               jlong class_tag, jlong referrer_class_tag, jlong size, jlong* tag_ptr,
+                               jlong* referrer_tag_ptr, jint length, void* user_data)
+{
+	EmergencySnapshot* emergency = static_cast<EmergencySnapshot*>(user_data);
+	EmergencyObject* object;
+
+	if (*tag_ptr >= 0 || -*tag_ptr > jlong(emergency->largestCount))
+	{
+		return JVMTI_VISIT_OBJECTS;
+	}
+	object = &emergency->largest[-*tag_ptr - 1];
+	if (object->held)
+	{
+		return JVMTI_VISIT_OBJECTS;
+	}
+
+	object->held = true;
+	object->holderKind = reference_kind;
+	object->holderClassTag = referrer_class_tag;
+	object->holderIndex = -1;
+	switch (reference_kind)
+	{
+	case JVMTI_HEAP_REFERENCE_STATIC_FIELD:
+		/* The referrer is the class object, tagged with its own index */
+		object->holderClassTag = referrer_tag_ptr != nullptr ? *referrer_tag_ptr : 0;
+		object->holderIndex = reference_info->field.index;
+		break;
+	case JVMTI_HEAP_REFERENCE_FIELD:
+		object->holderIndex = reference_info->field.index;
+		break;
+	case JVMTI_HEAP_REFERENCE_ARRAY_ELEMENT:
+		object->holderIndex = reference_info->array.index;
+		break;
+	default:
+		break;
+	}
+	return ++emergency->heldCount == emergency->largestCount ? JVMTI_VISIT_ABORT : JVMTI_VISIT_OBJECTS;
+}
+
+/* Pass 4: clears the marks, class tags stay */
+static jint JNICALL clearMark(jlong class_tag, jlong size, jlong* tag_ptr, jint length, void* user_data)
+{
+	if (*tag_ptr < 0)
+	{
+		*tag_ptr = 0;
+	}
+	return JVMTI_VISIT_OBJECTS;
+}
+
+/* Bounded append to the report, what does not fit is dropped */
+static void reportf(EmergencySnapshot* emergency, const char* format, ...)
+{
+	size_t room = kEmergencyReportBytes - kReportTail - emergency->reportLength;
+	va_list args;
+	int written;
+
+	if (emergency->truncated)
+	{
+		return;
+	}
+	va_start(args, format);
+	written = vsnprintf(emergency->report + emergency->reportLength, room, format, args);
+	va_end(args);
+	if (written < 0 || size_t(written) >= room)
+	{
+		emergency->report[emergency->reportLength] = 0;
+		emergency->truncated = true;
+		return;
+	}
+	emergency->reportLength += size_t(written);
+}
+
+static const char* emergencyClassName(const EmergencySnapshot* emergency, jlong tag)
+{
+	return emergency->names + emergency->classes[(tag > 0 && tag < jlong(emergency->classCount)) ? tag : 0].name;
+}
+
+typedef struct MoreClassBytes
+{
+	const EmergencyClass* classes;
+
+	bool operator()(uint32_t a, uint32_t b) const
+	{
+		return classes[a].bytes > classes[b].bytes;
+	}
+} MoreClassBytes;
+
+typedef struct MoreRetained
+{
+	const DominatorTree* tree;
+
+	bool operator()(NodeId a, NodeId b) const
+	{
+		return tree->retained[a] > tree->retained[b];
+	}
+} MoreRetained;
+
+static void reportHistogram(EmergencySnapshot* emergency)
+{
+	uint32_t used = 0;
+	uint32_t shown;
+	MoreClassBytes more = { emergency->classes };
+
+	for (uint32_t c = 0; c < emergency->classCount; ++c)
+	{
+		if (emergency->classes[c].instances > 0)
+		{
+			emergency->order[used++] = c;
+		}
+	}
+	shown = std::min(used, kEmergencyHistogram);
+	std::partial_sort(emergency->order, emergency->order + shown, emergency->order + used, more);
+
+	reportf(emergency, "\nClasses by bytes, %u of %u:\n", shown, used);
+	for (uint32_t i = 0; i < shown; ++i)
+	{
+		const EmergencyClass* klass = &emergency->classes[emergency->order[i]];
+		reportf(emergency, " %3u. %14llu bytes %12llu instances  %s\n", i + 1, (unsigned long long)klass->bytes,
+		        (unsigned long long)klass->instances, emergency->names + klass->name);
+	}
+}
+
+static void reportLargest(EmergencySnapshot* emergency, const PublishedSnapshot* published)
+{
+	std::sort(emergency->largest, emergency->largest + emergency->largestCount, LargerObject());
+
+	reportf(emergency, "\nLargest objects:\n");
+	for (uint32_t i = 0; i < emergency->largestCount; ++i)
+	{
+		const EmergencyObject* object = &emergency->largest[i];
+
+		reportf(emergency, " %3u. %14lld bytes  %s", i + 1, (long long)object->size,
+		        emergencyClassName(emergency, object->classTag));
+		if (object->length >= 0)
+		{
+			reportf(emergency, ", length %d", int(object->length));
+		}
+		if (!object->held)
+		{
+			reportf(emergency, ", holder not found\n");
+			continue;
+		}
+
+		const char* holder = emergencyClassName(emergency, object->holderClassTag);
+		switch (object->holderKind)
+		{
+		case JVMTI_HEAP_REFERENCE_FIELD:
+		case JVMTI_HEAP_REFERENCE_STATIC_FIELD:
+		{
+			const EmergencyClass* klass = &emergency->classes[(object->holderClassTag > 0 &&
+				object->holderClassTag < jlong(emergency->classCount)) ? object->holderClassTag : 0];
+			const FieldInfo* field = (published != nullptr && klass->analysisTag != 0)
+				? findFieldInfo(published->classes.get(), klass->analysisTag, object->holderIndex) : nullptr;
+			if (field != nullptr)
+			{
+				reportf(emergency, ", held by %s%s.%s\n", object->holderKind == JVMTI_HEAP_REFERENCE_STATIC_FIELD ? "static " : "",
+				        holder, field->name.c_str());
+			}
+			else
+			{
+				reportf(emergency, ", held by %s field #%d\n", holder, int(object->holderIndex));
+			}
+			break;
+		}
+		case JVMTI_HEAP_REFERENCE_ARRAY_ELEMENT:
+			reportf(emergency, ", held by %s[%d]\n", holder, int(object->holderIndex));
+			break;
+		default:
+			reportf(emergency, ", held by %s\n", reference_kind_name(object->holderKind));
+			break;
+		}
+	}
+}
+
+/* Largest retained sizes of the last published snapshot, a min-heap of
+ *   kEmergencyRetainers nodes over one pass */
+static void reportRetainers(EmergencySnapshot* emergency, const PublishedSnapshot* published, jlong now)
+{
+	const HeapGraph* graph = &published->snapshot.graph;
+	MoreRetained more = { &published->snapshot.dominators };
+	NodeId* heap = emergency->retainers;
+	uint32_t count = 0;
+
+	for (NodeId node = kRootNode + 1; node < graphNodeCount(graph); ++node)
+	{
+		if ((graph->flags[node] & kNodeIsVirtual) != 0)
+		{
+			continue;
+		}
+		if (count < kEmergencyRetainers)
+		{
+			heap[count++] = node;
+			std::push_heap(heap, heap + count, more);
+		}
+		else if (more(node, heap[0]))
+		{
+			std::pop_heap(heap, heap + count, more);
+			heap[count - 1] = node;
+			std::push_heap(heap, heap + count, more);
+		}
+	}
+	std::sort_heap(heap, heap + count, more);
+
+	reportf(emergency, "\nTop retainers of snapshot #%llu, published %.1f s before:\n",
+	        (unsigned long long)published->sequence, double(now - published->publishedAt) / 1e9);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		reportf(emergency, " %3u. %14llu bytes retained  %s%s\n", i + 1,
+		        (unsigned long long)published->snapshot.dominators.retained[heap[i]],
+		        (graph->flags[heap[i]] & kNodeIsClass) != 0 ? "class " : "",
+		        classNameOf(published->classes.get(), graph->classIds[heap[i]]));
+	}
+}
+
+static bool writeReport(const char* path, const char* data, size_t length)
+{
+#if defined(_WIN32)
+	HANDLE handle = CreateFileA(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	DWORD written = 0;
+	BOOL ok;
+
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	ok = WriteFile(handle, data, DWORD(length), &written, nullptr);
+	CloseHandle(handle);
+	return ok && written == DWORD(length);
+#else
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	ssize_t written;
+
+	if (fd < 0)
+	{
+		return false;
+	}
+	written = write(fd, data, length);
+	close(fd);
+	return written == ssize_t(length);
+#endif
+}
+
+jlong writeEmergencySnapshot(jvmtiEnv* jvmti, jvmtiEnv* analysis, JNIEnv* env, SnapshotStore* store,
+                             EmergencySnapshot* emergency, const char* reason)
+{
+	jvmtiHeapCallbacks callbacks;
+	PublishedSnapshot* published;
+	jvmtiError err;
+	jlong start = monotonicNanos();
+	uint64_t objects = 0;
+	uint64_t bytes = 0;
+
+	if (emergency->arena == nullptr || emergency->busy.exchange(true))
+	{
+		return -1;
+	}
+
+	for (uint32_t c = 0; c < emergency->classCount; ++c)
+	{
+		emergency->classes[c].instances = 0;
+		emergency->classes[c].bytes = 0;
+	}
+	emergency->largestCount = 0;
+	emergency->heldCount = 0;
+	emergency->reportLength = 0;
+	emergency->truncated = false;
+
+	registerClasses(jvmti, analysis, env, emergency);
+
+	(void)memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.heap_iteration_callback = &countObject;
+	err = jvmti->IterateThroughHeap(0, nullptr, &callbacks, emergency);
+
+	if (err == JVMTI_ERROR_NONE && emergency->largestCount > 0)
+	{
+		/* The marking pass refills the slots with the objects themselves */
+		emergency->largestSize = emergency->largest[0].size;
+		emergency->largestTies = 0;
+		for (uint32_t i = 0; i < emergency->largestCount; ++i)
+		{
+			emergency->largestTies += emergency->largest[i].size == emergency->largestSize ? 1 : 0;
+		}
+		emergency->largestCount = 0;
+		callbacks.heap_iteration_callback = &markLargest;
+		err = jvmti->IterateThroughHeap(0, nullptr, &callbacks, emergency);
+
+		(void)memset(&callbacks, 0, sizeof(callbacks));
+		callbacks.heap_reference_callback = &findHolder;
+		if (emergency->largestCount > 0)
+		{
+			jvmti->FollowReferences(0, nullptr, nullptr, &callbacks, emergency);
+		}
+
+		(void)memset(&callbacks, 0, sizeof(callbacks));
+		callbacks.heap_iteration_callback = &clearMark;
+		jvmti->IterateThroughHeap(JVMTI_HEAP_FILTER_UNTAGGED, nullptr, &callbacks, emergency);
+	}
+
+	for (uint32_t c = 0; c < emergency->classCount; ++c)
+	{
+		objects += emergency->classes[c].instances;
+		bytes += emergency->classes[c].bytes;
+	}
+
+	published = acquireSnapshot(store);
+	jlong now = monotonicNanos();
+	reportf(emergency, "jvmws emergency snapshot: %s\n", reason);
+	reportf(emergency, "Heap walk: %llu objects, %llu bytes, %u classes, %.1f ms\n", (unsigned long long)objects,
+	        (unsigned long long)bytes, emergency->classCount - 1, double(now - start) / 1e6);
+	if (err != JVMTI_ERROR_NONE)
+	{
+		reportf(emergency, "Heap walk failed, JVMTI error %d\n", int(err));
+	}
+	reportHistogram(emergency);
+	reportLargest(emergency, published);
+	if (published != nullptr)
+	{
+		reportRetainers(emergency, published, now);
+	}
+	releaseSnapshot(published);
+
+	if (emergency->truncated)
+	{
+		emergency->reportLength += size_t(snprintf(emergency->report + emergency->reportLength, kReportTail,
+		                                           "\nReport truncated at %u bytes\n", unsigned(emergency->reportLength)));
+	}
+
+	bool written = writeReport(emergency->path, emergency->report, emergency->reportLength);
+	jlong length = jlong(emergency->reportLength);
+	emergency->busy.store(false);
+
+	if (!written)
+	{
+		stdout_message("ERROR: emergency snapshot not written to %s\n", emergency->path);
+		return -1;
+	}
+	stdout_message("Emergency snapshot (%s) of %lld bytes written to %s\n", reason, (long long)length, emergency->path);
+	return length;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+
+#ifndef EMERGENCY_SNAPSHOT_H
+#define EMERGENCY_SNAPSHOT_H
+
+#include <atomic>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <jni.h>
+#include <ibmjvmti.h>
+
+#include "heapGraph.hpp"
+#include "publishedSnapshot.hpp"
+
+/* Compact evidence written when the VM runs out of heap or threads: a
+ *   class histogram, the largest objects with what holds them, and the
+ *   top retainers of the last published snapshot. All memory is reserved
+ *   at startup in one arena; the capture formats into it and writes the
+ *   file with a single bounded write.
+ *
+ *   Classes are tagged in an environment of their own with their index in
+ *   the arena class table, registered the first time a capture sees them.
+ *   Only the buffers JVMTI returns for that are allocated during a capture,
+ *   and they are freed right away.
+ */
+static const uint32_t kEmergencyClasses = 1 << 16;
+static const size_t kEmergencyNameBytes = 4 << 20;
+static const size_t kEmergencyReportBytes = 256 << 10;
+static const uint32_t kEmergencyHistogram = 50;
+static const uint32_t kEmergencyLargest = 20;
+static const uint32_t kEmergencyRetainers = 20;
+
+typedef struct EmergencyClass
+{
+	/* Offset of the Java name in the name pool */
+	uint32_t name;
+
+	/* Tag in the analysis environment, 0 when the class is not in a table */
+	jlong analysisTag;
+
+	uint64_t instances;
+	uint64_t bytes;
+} EmergencyClass;
+
+typedef struct EmergencyObject
+{
+	jlong size;
+	jlong classTag;
+	jint length;
+
+	/* First reference found to the object */
+	bool held;
+	jvmtiHeapReferenceKind holderKind;
+	jlong holderClassTag;
+	jint holderIndex;
+} EmergencyObject;
+
+typedef struct EmergencySnapshot
+{
+	uint8_t* arena;
+	size_t arenaSize;
+
+	/* Index 0 counts objects of classes that could not be registered */
+	EmergencyClass* classes;
+	uint32_t classCount;
+	char* names;
+	size_t nameBytes;
+	uint32_t* order;
+
+	EmergencyObject largest[kEmergencyLargest];
+	uint32_t largestCount;
+
+	/* Smallest size kept, and how many objects of that size were */
+	jlong largestSize;
+	uint32_t largestTies;
+	uint32_t heldCount;
+	NodeId retainers[kEmergencyRetainers];
+
+	char* report;
+	size_t reportLength;
+	bool truncated;
+
+	char path[1024];
+
+	/* Set while a capture runs, and once the first exhaustion is captured */
+	std::atomic<bool> busy;
+	std::atomic<bool> fired;
+} EmergencySnapshot;
+
+/* Reserves and touches the arena, from Agent_OnLoad. False when it cannot
+ *   be allocated, captures are then skipped. */
+bool reserveEmergencySnapshot(EmergencySnapshot* emergency, const char* path);
+
+/* Walks the heap through the emergency environment and writes the report.
+ *   The class tags of the analysis environment lead to the field names in
+ *   the class table of the published snapshot. Returns the bytes written,
+ *   -1 when nothing was written. */
+jlong writeEmergencySnapshot(jvmtiEnv* jvmti, jvmtiEnv* analysis, JNIEnv* env, SnapshotStore* store,
+                             EmergencySnapshot* emergency, const char* reason);
+
+#endif
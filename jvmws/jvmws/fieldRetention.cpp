@@ -0,0 +1,129 @@
+#include <vector>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+
+#include "agent_util.hpp"
+#include "fieldRetention.hpp"
+
+/* Children of a dominator that it does not refer to directly */
+static const uint32_t kIndirectLabel = 0xFFFFFFFFu;
+
+typedef struct FieldRetention
+{
+	std::string name;
+	uint64_t retained;
+	uint64_t objects;
+} FieldRetention;
+
+/* Holder of a child: the class of the dominator and the edge label, array
+ *   indexes are dropped so that all elements count together */
+static uint64_t holderKey(const HeapGraph* graph, NodeId dominator, uint32_t label)
+{
+	if (label != kIndirectLabel && edgeLabelKind(label) != JVMTI_HEAP_REFERENCE_FIELD &&
+		edgeLabelKind(label) != JVMTI_HEAP_REFERENCE_STATIC_FIELD)
+	{
+		label = packEdgeLabel(edgeLabelKind(label), 0);
+	}
+	return (uint64_t(graph->classIds[dominator]) << 32) | label;
+}
+
+static std::string describeHolder(const ClassTable* classes, uint64_t key)
+{
+	jlong class_tag = jlong(key >> 32);
+	uint32_t label = uint32_t(key);
+	uint32_t kind = edgeLabelKind(label);
+
+	if (label == kIndirectLabel)
+	{
+		return std::string(classNameOf(classes, class_tag)) + " (several paths)";
+	}
+	if (class_tag == 0)
+	{
+		return std::string("<") + reference_kind_name(jvmtiHeapReferenceKind(kind)) + ">";
+	}
+	if (kind == JVMTI_HEAP_REFERENCE_FIELD)
+	{
+		return fieldNameOf(classes, class_tag, jint(edgeLabelIndex(label)));
+	}
+	if (kind == JVMTI_HEAP_REFERENCE_STATIC_FIELD)
+	{
+		return fieldNameOf(classes, class_tag, jint(edgeLabelIndex(label))) + " (static)";
+	}
+	if (kind == JVMTI_HEAP_REFERENCE_ARRAY_ELEMENT)
+	{
+		return std::string(classNameOf(classes, class_tag)) + " element";
+	}
+	return std::string(classNameOf(classes, class_tag)) + " (" + reference_kind_name(jvmtiHeapReferenceKind(kind)) + ")";
+}
+
+static bool moreRetained(const FieldRetention& a, const FieldRetention& b)
+{
+	return a.retained > b.retained;
+}
+
+jint reportRetainedByField(const HeapSnapshot* snapshot, const ClassTable* classes, jint top)
+{
+	const HeapGraph* graph = &snapshot->graph;
+	const DominatorTree* tree = &snapshot->dominators;
+	size_t nodes = graphNodeCount(graph);
+	std::vector<bool> charged(nodes, false);
+	std::unordered_map<uint64_t, FieldRetention> holders;
+
+	/* One pass over the edges: an edge p -> c with idom(c) == p names the
+	 *   reference p holds c by */
+	for (NodeId p = 0; p < nodes; ++p)
+	{
+		for (uint64_t e = graph->edgeStarts[p]; e < graph->edgeStarts[p + 1]; ++e)
+		{
+			NodeId c = graph->edgeTargets[e];
+			if (tree->idom[c] == p && !charged[c])
+			{
+				FieldRetention* holder = &holders[holderKey(graph, p, graph->edgeLabels[e])];
+				holder->retained += tree->retained[c];
+				holder->objects++;
+				charged[c] = true;
+			}
+		}
+	}
+	for (NodeId c = 1; c < nodes; ++c)
+	{
+		if (!charged[c] && tree->idom[c] != kNoNode)
+		{
+			FieldRetention* holder = &holders[holderKey(graph, tree->idom[c], kIndirectLabel)];
+			holder->retained += tree->retained[c];
+			holder->objects++;
+		}
+	}
+
+	/* Subclasses share the fields they inherit, merge by name */
+	std::map<std::string, FieldRetention> named;
+	for (auto it = holders.begin(); it != holders.end(); ++it)
+	{
+		std::string name = describeHolder(classes, it->first);
+		FieldRetention* field = &named[name];
+		field->name = name;
+		field->retained += it->second.retained;
+		field->objects += it->second.objects;
+	}
+
+	std::vector<FieldRetention> fields;
+	for (auto it = named.begin(); it != named.end(); ++it)
+	{
+		fields.push_back(it->second);
+	}
+
+	size_t shown = std::min(fields.size(), size_t(top > 0 ? top : 0));
+	std::partial_sort(fields.begin(), fields.begin() + shown, fields.end(), &moreRetained);
+
+	stdout_message("Retained by field: %lld objects, %lld bytes reachable\n",
+	               (long long)(nodes - 1), (long long)tree->retained[kRootNode]);
+	for (size_t i = 0; i < shown; ++i)
+	{
+		stdout_message(" %3d. %-60s retained %14lld bytes, %10lld objects held\n", int(i + 1), fields[i].name.c_str(),
+		               (long long)fields[i].retained, (long long)fields[i].objects);
+	}
+
+	return jint(fields.size());
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+
+#ifndef FIELD_RETENTION_H
+#define FIELD_RETENTION_H
+
+#include <jni.h>
+
+#include "classTable.hpp"
+#include "heapSnapshot.hpp"
+
+/* Prints the fields that retain the most memory. The retained size of
+ *   every object is charged to the reference its immediate dominator holds
+ *   it by, e.g. CacheImpl.map, so a field keeping a large graph alive ranks
+ *   by the whole graph.
+ *   Returns the number of fields and other holders found.
+ */
+jint reportRetainedByField(const HeapSnapshot* snapshot, const ClassTable* classes, jint top);
+
+#endif
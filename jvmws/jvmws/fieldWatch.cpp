@@ -0,0 +1,379 @@
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include "agent_util.hpp"
+#include "heapFilter.hpp"
+#include "fieldWatch.hpp"
+
+void initFieldProfiler(jvmtiEnv* jvmti, FieldProfiler* profiler)
+{
+	jvmtiError err = jvmti->CreateRawMonitor("field watch", &profiler->lock);
+	check_jvmti_error(jvmti, err, "create field watch lock");
+	profiler->threads = nullptr;
+	profiler->session.store(false);
+	profiler->active.store(false);
+	profiler->truncated = false;
+}
+
+/* Hit table of the current thread, created on its first event */
+static ThreadFieldHits* threadHits(jvmtiEnv* jvmti, FieldProfiler* profiler)
+{
+	void* data = nullptr;
+	ThreadFieldHits* hits;
+
+	if (jvmti->GetThreadLocalStorage(nullptr, &data) != JVMTI_ERROR_NONE)
+	{
+		return nullptr;
+	}
+	if (data != nullptr)
+	{
+		return static_cast<ThreadFieldHits*>(data);
+	}
+
+	hits = new ThreadFieldHits();
+	hits->busy.store(false);
+	jvmti->SetThreadLocalStorage(nullptr, hits);
+
+	jvmti->RawMonitorEnter(profiler->lock);
+	hits->next = profiler->threads;
+	profiler->threads = hits;
+	jvmti->RawMonitorExit(profiler->lock);
+	return hits;
+}
+
+static void mergeFieldHits(FieldHitMap* into, const FieldHitMap& from)
+{
+	for (auto it = from.begin(); it != from.end(); ++it)
+	{
+		FieldHitCounts& counts = (*into)[it->first];
+		counts.reads += it->second.reads;
+		counts.writes += it->second.writes;
+	}
+}
+
+void recordFieldHit(jvmtiEnv* jvmti, FieldProfiler* profiler, jmethodID method, jfieldID field, bool write)
+{
+	ThreadFieldHits* hits = threadHits(jvmti, profiler);
+
+	if (hits == nullptr)
+	{
+		return;
+	}
+
+	/* Either the stop sees busy and waits, or this sees active cleared */
+	hits->busy.store(true);
+	if (profiler->active.load())
+	{
+		auto index = profiler->fieldIndex.find(field);
+		if (index != profiler->fieldIndex.end())
+		{
+			FieldHitKey key = { index->second, method };
+			FieldHitCounts& counts = hits->hits[key];
+			if (write)
+			{
+				counts.writes++;
+			}
+			else
+			{
+				counts.reads++;
+			}
+		}
+	}
+	hits->busy.store(false);
+}
+
+static void watchClassFields(jvmtiEnv* jvmti, JNIEnv* env, FieldProfiler* profiler, jclass klass, jlong class_tag)
+{
+	jint count = 0;
+	jfieldID* fields = nullptr;
+
+	if (jvmti->GetClassFields(klass, &count, &fields) != JVMTI_ERROR_NONE)
+	{
+		return;
+	}
+	for (jint i = 0; i < count; ++i)
+	{
+		WatchedField watched;
+		char* name = nullptr;
+		jint modifiers = 0;
+		bool access;
+		bool modification;
+
+		if (profiler->fields.size() >= kFieldWatchMaxFields)
+		{
+			profiler->truncated = true;
+			break;
+		}
+		access = jvmti->SetFieldAccessWatch(klass, fields[i]) == JVMTI_ERROR_NONE;
+		modification = jvmti->SetFieldModificationWatch(klass, fields[i]) == JVMTI_ERROR_NONE;
+		if (!access && !modification)
+		{
+			continue;
+		}
+
+		jvmti->GetFieldName(klass, fields[i], &name, nullptr, nullptr);
+		jvmti->GetFieldModifiers(klass, fields[i], &modifiers);
+		watched.klass = static_cast<jclass>(env->NewGlobalRef(klass));
+		watched.field = fields[i];
+		watched.classTag = class_tag;
+		watched.name = name != nullptr ? name : "?";
+		watched.isStatic = (modifiers & 0x0008) != 0 ? JNI_TRUE : JNI_FALSE;
+		deallocate(jvmti, reinterpret_cast<unsigned char*>(name));
+
+		profiler->fieldIndex[fields[i]] = uint32_t(profiler->fields.size());
+		profiler->fields.push_back(watched);
+	}
+	deallocate(jvmti, reinterpret_cast<unsigned char*>(fields));
+}
+
+void endThreadFieldHits(jvmtiEnv* jvmti, FieldProfiler* profiler)
+{
+	void* data = nullptr;
+
+	if (jvmti->GetThreadLocalStorage(nullptr, &data) != JVMTI_ERROR_NONE || data == nullptr)
+	{
+		return;
+	}
+	ThreadFieldHits* hits = static_cast<ThreadFieldHits*>(data);
+	jvmti->SetThreadLocalStorage(nullptr, nullptr);
+
+	/* No event of this thread can run any more, readers hold the lock */
+	jvmti->RawMonitorEnter(profiler->lock);
+	for (ThreadFieldHits** link = &profiler->threads; *link != nullptr; link = &(*link)->next)
+	{
+		if (*link == hits)
+		{
+			*link = hits->next;
+			break;
+		}
+	}
+	mergeFieldHits(&profiler->ended, hits->hits);
+	jvmti->RawMonitorExit(profiler->lock);
+	delete hits;
+}
+
+jint startFieldWatches(jvmtiEnv* jvmti, jvmtiEnv* analysis, JNIEnv* env, FieldProfiler* profiler,
+                       const ClassTable* classes, const char* pattern)
+{
+	jint count = 0;
+	jclass* loaded = nullptr;
+	jvmtiError err;
+
+	if (profiler->session.exchange(true))
+	{
+		return -1;
+	}
+
+	/* The events of the last window are drained, nobody writes the tables */
+	profiler->fields.clear();
+	profiler->fieldIndex.clear();
+	profiler->truncated = false;
+	jvmti->RawMonitorEnter(profiler->lock);
+	for (ThreadFieldHits* hits = profiler->threads; hits != nullptr; hits = hits->next)
+	{
+		hits->hits.clear();
+	}
+	profiler->ended.clear();
+	jvmti->RawMonitorExit(profiler->lock);
+
+	err = jvmti->GetLoadedClasses(&count, &loaded);
+	check_jvmti_error(jvmti, err, "get loaded classes");
+	for (jint i = 0; i < count; ++i)
+	{
+		jlong class_tag = 0;
+		const ClassInfo* info;
+
+		analysis->GetTag(loaded[i], &class_tag);
+		info = findClassInfo(classes, class_tag);
+		if (info != nullptr && !info->isArray && info->fieldsResolved && globMatch(pattern, info->name.c_str()))
+		{
+			watchClassFields(jvmti, env, profiler, loaded[i], class_tag);
+		}
+		env->DeleteLocalRef(loaded[i]);
+	}
+	deallocate(jvmti, reinterpret_cast<unsigned char*>(loaded));
+
+	if (profiler->fields.empty())
+	{
+		profiler->session.store(false);
+		return 0;
+	}
+
+	profiler->active.store(true);
+	err = jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_FIELD_ACCESS, nullptr);
+	check_jvmti_error(jvmti, err, "set field access notify");
+	err = jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_FIELD_MODIFICATION, nullptr);
+	check_jvmti_error(jvmti, err, "set field modification notify");
+	return jint(profiler->fields.size());
+}
+
+void waitFieldWatches(jvmtiEnv* jvmti, FieldProfiler* profiler, jint seconds)
+{
+	auto deadline = std::chrono::steady_clock::now() +
+		std::chrono::seconds(std::max(1, std::min(seconds, kFieldWatchMaxSeconds)));
+
+	jvmti->RawMonitorEnter(profiler->lock);
+	for (;;)
+	{
+		jlong remaining = jlong(std::chrono::duration_cast<std::chrono::milliseconds>(
+			deadline - std::chrono::steady_clock::now()).count());
+		if (remaining <= 0 || jvmti->RawMonitorWait(profiler->lock, remaining) == JVMTI_ERROR_INTERRUPT)
+		{
+			break;
+		}
+	}
+	jvmti->RawMonitorExit(profiler->lock);
+}
+
+void stopFieldWatches(jvmtiEnv* jvmti, JNIEnv* env, FieldProfiler* profiler)
+{
+	profiler->active.store(false);
+	jvmti->SetEventNotificationMode(JVMTI_DISABLE, JVMTI_EVENT_FIELD_ACCESS, nullptr);
+	jvmti->SetEventNotificationMode(JVMTI_DISABLE, JVMTI_EVENT_FIELD_MODIFICATION, nullptr);
+
+	for (auto it = profiler->fields.begin(); it != profiler->fields.end(); ++it)
+	{
+		jvmti->ClearFieldAccessWatch(it->klass, it->field);
+		jvmti->ClearFieldModificationWatch(it->klass, it->field);
+		env->DeleteGlobalRef(it->klass);
+		it->klass = nullptr;
+	}
+
+	jvmti->RawMonitorEnter(profiler->lock);
+	for (ThreadFieldHits* hits = profiler->threads; hits != nullptr; hits = hits->next)
+	{
+		while (hits->busy.load())
+		{
+			std::this_thread::yield();
+		}
+	}
+	jvmti->RawMonitorExit(profiler->lock);
+}
+
+typedef struct FieldTotals
+{
+	uint32_t field;
+	uint64_t reads;
+	uint64_t writes;
+} FieldTotals;
+
+typedef struct MethodHits
+{
+	jmethodID method;
+	uint64_t reads;
+	uint64_t writes;
+} MethodHits;
+
+static bool moreFieldHits(const FieldTotals& a, const FieldTotals& b)
+{
+	return a.reads + a.writes > b.reads + b.writes;
+}
+
+static bool moreMethodHits(const MethodHits& a, const MethodHits& b)
+{
+	return a.reads + a.writes > b.reads + b.writes;
+}
+
+/* "java.util.HashMap.getNode" */
+static std::string methodLabel(jvmtiEnv* jvmti, jvmtiEnv* analysis, JNIEnv* env, const ClassTable* classes, jmethodID method)
+{
+	jclass klass = nullptr;
+	jlong class_tag = 0;
+	char* name = nullptr;
+	std::string label;
+
+	if (jvmti->GetMethodDeclaringClass(method, &klass) == JVMTI_ERROR_NONE)
+	{
+		analysis->GetTag(klass, &class_tag);
+		env->DeleteLocalRef(klass);
+	}
+	label = classNameOf(classes, class_tag);
+	if (jvmti->GetMethodName(method, &name, nullptr, nullptr) == JVMTI_ERROR_NONE)
+	{
+		label = label + "." + name;
+		deallocate(jvmti, reinterpret_cast<unsigned char*>(name));
+	}
+	return label;
+}
+
+jint reportFieldHits(jvmtiEnv* jvmti, jvmtiEnv* analysis, JNIEnv* env, FieldProfiler* profiler, const ClassTable* classes,
+                     jint top)
+{
+	std::vector<FieldTotals> totals(profiler->fields.size());
+	std::vector<std::vector<MethodHits> > methods(profiler->fields.size());
+	FieldHitMap merged;
+	uint64_t hitCount = 0;
+	size_t untouched = 0;
+
+	/* The tables of live threads are only refilled by the next window */
+	jvmti->RawMonitorEnter(profiler->lock);
+	for (ThreadFieldHits* hits = profiler->threads; hits != nullptr; hits = hits->next)
+	{
+		mergeFieldHits(&merged, hits->hits);
+		FieldHitMap().swap(hits->hits);
+	}
+	mergeFieldHits(&merged, profiler->ended);
+	FieldHitMap().swap(profiler->ended);
+	jvmti->RawMonitorExit(profiler->lock);
+
+	for (size_t f = 0; f < totals.size(); ++f)
+	{
+		totals[f].field = uint32_t(f);
+		totals[f].reads = 0;
+		totals[f].writes = 0;
+	}
+	for (auto it = merged.begin(); it != merged.end(); ++it)
+	{
+		MethodHits hits = { it->first.method, it->second.reads, it->second.writes };
+		totals[it->first.field].reads += hits.reads;
+		totals[it->first.field].writes += hits.writes;
+		methods[it->first.field].push_back(hits);
+		hitCount += hits.reads + hits.writes;
+	}
+
+	stdout_message("Fields watched %d%s, hits %lld\n\n", int(profiler->fields.size()),
+	               profiler->truncated ? " (limit reached, pattern too wide)" : "", (long long)hitCount);
+
+	std::vector<FieldTotals> ranked(totals);
+	std::sort(ranked.begin(), ranked.end(), &moreFieldHits);
+	size_t shown = std::min(ranked.size(), size_t(top > 0 ? top : 0));
+	for (size_t i = 0; i < shown && ranked[i].reads + ranked[i].writes > 0; ++i)
+	{
+		const WatchedField* field = &profiler->fields[ranked[i].field];
+		std::vector<MethodHits>& byMethod = methods[ranked[i].field];
+
+		stdout_message(" %3d. %s.%s%s reads %lld, writes %lld\n", int(i + 1), classNameOf(classes, field->classTag),
+		               field->name.c_str(), field->isStatic ? " (static)" : "", (long long)ranked[i].reads,
+		               (long long)ranked[i].writes);
+		std::sort(byMethod.begin(), byMethod.end(), &moreMethodHits);
+		for (size_t m = 0; m < byMethod.size() && m < 5; ++m)
+		{
+			stdout_message("        %-70s reads %10lld, writes %10lld\n",
+			               methodLabel(jvmti, analysis, env, classes, byMethod[m].method).c_str(),
+			               (long long)byMethod[m].reads, (long long)byMethod[m].writes);
+		}
+	}
+
+	for (size_t f = 0; f < totals.size(); ++f)
+	{
+		if (totals[f].reads + totals[f].writes == 0)
+		{
+			untouched++;
+		}
+	}
+	stdout_message("\nFields never touched: %d\n", int(untouched));
+	for (size_t f = 0, listed = 0; f < totals.size() && listed < size_t(top > 0 ? top : 0); ++f)
+	{
+		if (totals[f].reads + totals[f].writes == 0)
+		{
+			const WatchedField* field = &profiler->fields[f];
+			stdout_message("        %s.%s%s\n", classNameOf(classes, field->classTag), field->name.c_str(),
+			               field->isStatic ? " (static)" : "");
+			listed++;
+		}
+	}
+
+	profiler->session.store(false);
+	return jint(hitCount);
+}
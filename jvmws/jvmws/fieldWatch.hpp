@@ -0,0 +1,127 @@
+#pragma once
+
+
+#ifndef FIELD_WATCH_H
+#define FIELD_WATCH_H
+
+#include <atomic>
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <jni.h>
+#include <ibmjvmti.h>
+
+#include "classTable.hpp"
+
+/* Field hotness over a time window. Access and modification watches are
+ *   set on the declared fields of the classes matching a pattern, and the
+ *   events count hits per field and accessing method in a table of the
+ *   hitting thread, reached through JVMTI thread local storage. When the
+ *   window closes the events are disabled and all watches cleared before
+ *   the tables are read. A thread's table is freed when the thread ends,
+ *   its hits are kept with the profiler until the report.
+ */
+static const jint kFieldWatchMaxSeconds = 600;
+
+/* Watching every field of a large application would slow it to a crawl */
+static const size_t kFieldWatchMaxFields = 4096;
+
+typedef struct WatchedField
+{
+	/* Global reference, deleted when the watch is cleared */
+	jclass klass;
+	jfieldID field;
+	jlong classTag;
+	std::string name;
+	jboolean isStatic;
+} WatchedField;
+
+typedef struct FieldHitKey
+{
+	/* Index into FieldProfiler::fields */
+	uint32_t field;
+	jmethodID method;
+
+	bool operator==(const FieldHitKey& other) const
+	{
+		return field == other.field && method == other.method;
+	}
+} FieldHitKey;
+
+struct FieldHitKeyHash
+{
+	size_t operator()(const FieldHitKey& key) const
+	{
+		return std::hash<const void*>()(static_cast<const void*>(key.method)) * 31 + key.field;
+	}
+};
+
+typedef struct FieldHitCounts
+{
+	uint64_t reads;
+	uint64_t writes;
+} FieldHitCounts;
+
+typedef std::unordered_map<FieldHitKey, FieldHitCounts, FieldHitKeyHash> FieldHitMap;
+
+typedef struct ThreadFieldHits
+{
+	/* Set while an event of the owning thread updates hits */
+	std::atomic<bool> busy;
+	FieldHitMap hits;
+	ThreadFieldHits* next;
+} ThreadFieldHits;
+
+typedef struct FieldProfiler
+{
+	/* Guards the thread list, the window waits on it */
+	jrawMonitorID lock;
+	ThreadFieldHits* threads;
+
+	/* Hits of the threads that ended since the window opened */
+	FieldHitMap ended;
+
+	/* A window is open, hits are counted while active is set */
+	std::atomic<bool> session;
+	std::atomic<bool> active;
+
+	/* Fixed while active */
+	std::vector<WatchedField> fields;
+	std::unordered_map<jfieldID, uint32_t> fieldIndex;
+	bool truncated;
+} FieldProfiler;
+
+void initFieldProfiler(jvmtiEnv* jvmti, FieldProfiler* profiler);
+
+/* From the field access and modification events */
+void recordFieldHit(jvmtiEnv* jvmti, FieldProfiler* profiler, jmethodID method, jfieldID field, bool write);
+
+/* From the thread end event, moves the hits of the ending thread to the
+ *   profiler and frees its table */
+void endThreadFieldHits(jvmtiEnv* jvmti, FieldProfiler* profiler);
+
+/* Watches the fields of the prepared classes whose Java name matches the
+ *   pattern and enables the events. Call with the class table refreshed
+ *   and locked. Returns the number of fields watched, -1 while another
+ *   window is open. */
+jint startFieldWatches(jvmtiEnv* jvmti, jvmtiEnv* analysis, JNIEnv* env, FieldProfiler* profiler,
+                       const ClassTable* classes, const char* pattern);
+
+/* Waits out the window, returns early when the thread is interrupted */
+void waitFieldWatches(jvmtiEnv* jvmti, FieldProfiler* profiler, jint seconds);
+
+/* Disables the events, clears every watch and waits for the events still
+ *   running, the hit tables are quiet afterwards */
+void stopFieldWatches(jvmtiEnv* jvmti, JNIEnv* env, FieldProfiler* profiler);
+
+/* Prints the fields by hits with their top accessing methods, then the
+ *   fields never touched. Ends the session and releases the hits.
+ *   Returns the total hits. */
+jint reportFieldHits(jvmtiEnv* jvmti, jvmtiEnv* analysis, JNIEnv* env, FieldProfiler* profiler, const ClassTable* classes,
+                     jint top);
+
+#endif
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdarg.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "agent_util.hpp"
+#include "graphBrowser.hpp"
+#include "tagRenderer.hpp"
+
+/* Formats straight into the end of out, sized by a first measuring pass */
+static void appendf(std::string* out, const char* format, ...)
+{
+	va_list args;
+	va_list measure;
+	int length;
+	size_t end = out->size();
+
+	va_start(args, format);
+	va_copy(measure, args);
+	length = vsnprintf(nullptr, 0, format, measure);
+	va_end(measure);
+	if (length > 0)
+	{
+		out->resize(end + size_t(length) + 1);
+		vsnprintf(&(*out)[end], size_t(length) + 1, format, args);
+		out->resize(end + size_t(length));
+	}
+	va_end(args);
+}
+
+static jint browseError(std::string* out, const char* message)
+{
+	*out = "{\"error\":\"";
+	out->append(quoted(message));
+	out->append("\"}");
+	return -1;
+}
+
+static char directionCode(BrowseDirection direction)
+{
+	return direction == kBrowseIn ? 'i' : 'o';
+}
+
+static char orderCode(BrowseOrder order)
+{
+	return order == kByShallow ? 's' : 'r';
+}
+
+/* "sequence-node-do-offset", do being the direction and order codes */
+static std::string makeCursor(uint64_t sequence, const BrowseRequest* request, uint64_t offset)
+{
+	char text[96];
+	snprintf(text, sizeof(text), "%llu-%u-%c%c-%llu", (unsigned long long)sequence, request->node,
+	         directionCode(request->direction), orderCode(request->order), (unsigned long long)offset);
+	return text;
+}
+
+static bool parseCursor(const std::string& cursor, uint64_t sequence, const BrowseRequest* request, uint64_t* offset)
+{
+	unsigned long long token_sequence;
+	unsigned long long token_offset;
+	unsigned token_node;
+	char direction;
+	char order;
+
+	if (sscanf(cursor.c_str(), "%llu-%u-%c%c-%llu", &token_sequence, &token_node, &direction, &order, &token_offset) != 5)
+	{
+		return false;
+	}
+	if (token_sequence != sequence || token_node != request->node || direction != directionCode(request->direction) ||
+	    order != orderCode(request->order))
+	{
+		return false;
+	}
+	*offset = token_offset;
+	return true;
+}
+
+typedef struct BrowsedEdge
+{
+	/* Node at the other end and the outgoing edge for the label */
+	NodeId node;
+	NodeId from;
+	uint64_t edge;
+	uint64_t key;
+} BrowsedEdge;
+
+/* Larger first, then in edge order, so every page sees the same order */
+static bool browsedBefore(const BrowsedEdge& a, const BrowsedEdge& b)
+{
+	if (a.key != b.key)
+	{
+		return a.key > b.key;
+	}
+	return a.edge < b.edge;
+}
+
+static uint64_t retainedOf(const HeapSnapshot* snapshot, NodeId node)
+{
+	const std::vector<uint64_t>& retained = snapshot->dominators.retained;
+	return node < retained.size() ? retained[node] : snapshot->graph.sizes[node];
+}
+
+static void appendNode(std::string* out, const PublishedSnapshot* published, NodeId node)
+{
+	const HeapGraph* graph = &published->snapshot.graph;
+
+	appendf(out, "\"id\":%u,\"name\":\"%s\",\"shallow\":%llu,\"retained\":%llu,\"out\":%llu", node,
+	        quoted(describeNode(graph, published->classes.get(), node).c_str()).c_str(),
+	        (unsigned long long)graph->sizes[node], (unsigned long long)retainedOf(&published->snapshot, node),
+	        (unsigned long long)(graph->edgeStarts[node + 1] - graph->edgeStarts[node]));
+}
+
+jint browseEdges(PublishedSnapshot* published, const BrowseRequest* request, std::string* out)
+{
+	const HeapSnapshot* snapshot = &published->snapshot;
+	const HeapGraph* graph = &snapshot->graph;
+	std::vector<BrowsedEdge> candidates;
+	uint64_t offset = 0;
+
+	if (request->node >= graphNodeCount(graph))
+	{
+		return browseError(out, "no such node");
+	}
+	if (!request->cursor.empty() && !parseCursor(request->cursor, published->sequence, request, &offset))
+	{
+		return browseError(out, "stale or foreign cursor");
+	}
+
+	if (request->direction == kBrowseOut)
+	{
+		for (uint64_t e = graph->edgeStarts[request->node]; e < graph->edgeStarts[request->node + 1]; ++e)
+		{
+			BrowsedEdge edge = { graph->edgeTargets[e], request->node, e, 0 };
+			candidates.push_back(edge);
+		}
+	}
+	else
+	{
+		const IncomingEdges* incoming = snapshotIncomingEdges(published);
+		for (uint64_t i = incoming->starts[request->node]; i < incoming->starts[request->node + 1]; ++i)
+		{
+			BrowsedEdge edge = { incoming->sources[i], incoming->sources[i], incoming->edges[i], 0 };
+			candidates.push_back(edge);
+		}
+	}
+	for (auto it = candidates.begin(); it != candidates.end(); ++it)
+	{
+		it->key = request->order == kByShallow ? graph->sizes[it->node] : retainedOf(snapshot, it->node);
+	}
+
+	uint64_t total = candidates.size();
+	uint64_t first = std::min(offset, total);
+	uint32_t limit = request->limit > 0 ? std::min(request->limit, kBrowseMaxPage) : kBrowseDefaultPage;
+	uint64_t last = std::min(first + limit, total);
+	std::partial_sort(candidates.begin(), candidates.begin() + ptrdiff_t(last), candidates.end(), &browsedBefore);
+
+	out->clear();
+	appendf(out, "{\"snapshot\":%llu,\"node\":{", (unsigned long long)published->sequence);
+	appendNode(out, published, request->node);
+	appendf(out, "},\"direction\":\"%s\",\"order\":\"%s\",\"total\":%llu,\"offset\":%llu,\"edges\":[",
+	        request->direction == kBrowseIn ? "in" : "out", request->order == kByShallow ? "shallow" : "retained",
+	        (unsigned long long)total, (unsigned long long)first);
+	for (uint64_t i = first; i < last; ++i)
+	{
+		const BrowsedEdge& edge = candidates[size_t(i)];
+		appendf(out, "%s{\"ref\":\"%s\",", i > first ? "," : "",
+		        quoted(describeEdge(graph, published->classes.get(), edge.from, graph->edgeLabels[edge.edge]).c_str()).c_str());
+		appendNode(out, published, edge.node);
+		out->append("}");
+	}
+	out->append("],\"cursor\":");
+	if (last < total)
+	{
+		out->append("\"" + makeCursor(published->sequence, request, last) + "\"}");
+	}
+	else
+	{
+		out->append("null}");
+	}
+	return jint(last - first);
+}
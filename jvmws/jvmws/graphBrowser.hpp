@@ -0,0 +1,58 @@
+#pragma once
+
+
+#ifndef GRAPH_BROWSER_H
+#define GRAPH_BROWSER_H
+
+#include <string>
+
+#include <stdint.h>
+
+#include <jni.h>
+#include <ibmjvmti.h>
+
+#include "heapGraph.hpp"
+#include "publishedSnapshot.hpp"
+
+/* Paged browsing of the published snapshot graph, one node at a time.
+ *   A page lists the outgoing or incoming edges of a node sorted by the
+ *   retained or shallow size of the other end, and a token to continue
+ *   from. Only the requested node is looked at, the page of k edges at
+ *   offset o of a node with d edges costs O(d log(o + k)), so a click costs
+ *   the same on any heap. The referrer index is built on the first request
+ *   for incoming edges of a snapshot.
+ */
+enum BrowseDirection
+{
+	kBrowseOut,
+	kBrowseIn
+};
+
+enum BrowseOrder
+{
+	kByRetained,
+	kByShallow
+};
+
+/* A limit of 0 asks for the default page */
+static const uint32_t kBrowseDefaultPage = 50;
+static const uint32_t kBrowseMaxPage = 1000;
+
+typedef struct BrowseRequest
+{
+	NodeId node;
+	BrowseDirection direction;
+	BrowseOrder order;
+	uint32_t limit;
+
+	/* Token of the previous page, empty for the first page */
+	std::string cursor;
+} BrowseRequest;
+
+/* Writes the page as a JSON object to out. The token binds the snapshot,
+ *   node, direction and order, it is refused for any other request and
+ *   after the next publication. Returns the edges on the page, or -1 when
+ *   out holds an error object instead. */
+jint browseEdges(PublishedSnapshot* published, const BrowseRequest* request, std::string* out);
+
+#endif
@@ -0,0 +1,631 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <unordered_set>
+#include <algorithm>
+
+#include "agent_util.hpp"
+#include "analysisTags.hpp"
+#include "heapFilter.hpp"
+
+/* Field clauses per filter, one bit each in the scan state */
+static const size_t kMaxFieldClauses = 16;
+
+/* Scratch tag of objects reached through a listed reference kind */
+static const jlong kFilterMark = -1;
+
+bool globMatch(const char* pattern, const char* text)
+{
+	const char* star = nullptr;
+	const char* resume = nullptr;
+
+	while (*text != 0)
+	{
+		if (*pattern == '*')
+		{
+			star = pattern++;
+			resume = text;
+		}
+		else if (*pattern == *text)
+		{
+			pattern++;
+			text++;
+		}
+		else if (star != nullptr)
+		{
+			pattern = star + 1;
+			text = ++resume;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	while (*pattern == '*')
+	{
+		pattern++;
+	}
+	return *pattern == 0;
+}
+
+static bool parseCompare(const std::string& text, uint8_t* compare)
+{
+	static const struct { const char* text; FilterCompare compare; } operators[] = {
+		{ "=", kCompareEq }, { "==", kCompareEq }, { "!=", kCompareNe }, { "<", kCompareLt },
+		{ "<=", kCompareLe }, { ">", kCompareGt }, { ">=", kCompareGe }
+	};
+
+	for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); ++i)
+	{
+		if (text == operators[i].text)
+		{
+			*compare = uint8_t(operators[i].compare);
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Decimal or floating point number with an optional k, m or g suffix */
+static bool parseNumber(const std::string& text, jlong* value, double* real)
+{
+	char* end;
+	double scale = 1;
+
+	*real = strtod(text.c_str(), &end);
+	if (end == text.c_str())
+	{
+		return false;
+	}
+	switch (tolower(*end))
+	{
+	case 'k': scale = 1024.0; end++; break;
+	case 'm': scale = 1024.0 * 1024.0; end++; break;
+	case 'g': scale = 1024.0 * 1024.0 * 1024.0; end++; break;
+	default: break;
+	}
+	if (*end != 0)
+	{
+		return false;
+	}
+
+	*real *= scale;
+	*value = jlong(*real);
+	if (scale == 1 && strchr(text.c_str(), '.') == nullptr && strchr(text.c_str(), 'e') == nullptr)
+	{
+		*value = strtoll(text.c_str(), nullptr, 10);
+	}
+	return true;
+}
+
+/* "stack_local" or "stack local" -> JVMTI_HEAP_REFERENCE_STACK_LOCAL */
+static bool parseReferenceKinds(const std::string& text, uint64_t* kinds)
+{
+	size_t start = 0;
+
+	while (start <= text.size())
+	{
+		size_t end = text.find_first_of(",|", start);
+		std::string name = text.substr(start, end == std::string::npos ? std::string::npos : end - start);
+		std::replace(name.begin(), name.end(), '_', ' ');
+
+		bool known = false;
+		for (jint kind = JVMTI_HEAP_REFERENCE_CLASS; kind <= JVMTI_HEAP_REFERENCE_OTHER; ++kind)
+		{
+			if (name == reference_kind_name(jvmtiHeapReferenceKind(kind)) && (name != "other" || kind == JVMTI_HEAP_REFERENCE_OTHER))
+			{
+				*kinds |= uint64_t(1) << kind;
+				known = true;
+			}
+		}
+		if (!known)
+		{
+			return false;
+		}
+		if (end == std::string::npos)
+		{
+			break;
+		}
+		start = end + 1;
+	}
+	return true;
+}
+
+/* Callback index of a primitive instance field per class tag, the most
+ *   derived declaration wins */
+static std::vector<jint> resolveFieldSlots(const ClassTable* classes, const std::string& name)
+{
+	std::vector<jint> slots(classes->classes.size() + 1, -1);
+
+	for (size_t c = 0; c < classes->classes.size(); ++c)
+	{
+		const ClassInfo* info = &classes->classes[c];
+		for (size_t i = 0; i < info->fields.size(); ++i)
+		{
+			const FieldInfo* field = &info->fields[i];
+			if (!field->isStatic && field->type != 'L' && field->type != '[' && field->name == name)
+			{
+				slots[c + 1] = info->interfaceFieldCount + jint(i);
+			}
+		}
+	}
+	return slots;
+}
+
+bool compileHeapFilter(const char* expression, const ClassTable* classes, HeapFilter* filter, std::string* error)
+{
+	std::string text(expression);
+	size_t position = 0;
+
+	filter->code.clear();
+	filter->classSets.clear();
+	filter->fieldSlots.clear();
+	filter->text.clear();
+	filter->referenceKinds = 0;
+	filter->fieldCount = 0;
+
+	while (true)
+	{
+		position = text.find_first_not_of(" \t", position);
+		if (position == std::string::npos)
+		{
+			break;
+		}
+		size_t end = text.find_first_of(" \t", position);
+		std::string clause = text.substr(position, end == std::string::npos ? std::string::npos : end - position);
+		position = end == std::string::npos ? text.size() : end;
+
+		if (clause == "and" || clause == "&&")
+		{
+			continue;
+		}
+
+		size_t op = clause.find_first_of("=!<>");
+		size_t value = clause.find_first_not_of("=!<>", op);
+		if (op == std::string::npos || op == 0 || value == std::string::npos)
+		{
+			*error = "expected NAME OP VALUE: " + clause;
+			return false;
+		}
+
+		std::string key = clause.substr(0, op);
+		std::string argument = clause.substr(value);
+		FilterInsn insn = {};
+		if (!parseCompare(clause.substr(op, value - op), &insn.compare))
+		{
+			*error = "unknown operator in " + clause;
+			return false;
+		}
+
+		if (key == "class")
+		{
+			if (insn.compare != kCompareEq && insn.compare != kCompareNe)
+			{
+				*error = "class takes = or != only: " + clause;
+				return false;
+			}
+			std::vector<uint8_t> matches(classes->classes.size() + 1, 0);
+			for (size_t c = 0; c < classes->classes.size(); ++c)
+			{
+				matches[c + 1] = globMatch(argument.c_str(), classes->classes[c].name.c_str()) ? 1 : 0;
+			}
+			insn.opcode = kFilterClass;
+			insn.table = uint32_t(filter->classSets.size());
+			filter->classSets.push_back(matches);
+		}
+		else if (key == "ref")
+		{
+			/* Kinds of two clauses would have to be met by different
+			 *   references to the same object, the walk marks objects
+			 *   by one reference at a time */
+			if (filter->referenceKinds != 0)
+			{
+				*error = "only one ref clause, list the kinds in it: " + clause;
+				return false;
+			}
+			if (insn.compare != kCompareEq || !parseReferenceKinds(argument, &filter->referenceKinds))
+			{
+				*error = "expected ref=KIND,KIND...: " + clause;
+				return false;
+			}
+			insn.opcode = kFilterReference;
+		}
+		else if (key == "size" || key == "length" || key.compare(0, 6, "field.") == 0)
+		{
+			if (!parseNumber(argument, &insn.value, &insn.real))
+			{
+				*error = "not a number in " + clause;
+				return false;
+			}
+			if (key == "size")
+			{
+				insn.opcode = kFilterSize;
+			}
+			else if (key == "length")
+			{
+				insn.opcode = kFilterLength;
+			}
+			else
+			{
+				if (filter->fieldCount == kMaxFieldClauses)
+				{
+					*error = "too many field clauses";
+					return false;
+				}
+				insn.opcode = kFilterField;
+				insn.table = uint32_t(filter->fieldSlots.size());
+				filter->fieldSlots.push_back(resolveFieldSlots(classes, key.substr(6)));
+				filter->fieldCount++;
+			}
+		}
+		else
+		{
+			*error = "unknown clause " + clause;
+			return false;
+		}
+
+		filter->code.push_back(insn);
+		filter->text.push_back(clause);
+	}
+	return true;
+}
+
+static bool compareInteger(uint8_t compare, jlong a, jlong b)
+{
+	switch (compare)
+	{
+	case kCompareEq: return a == b;
+	case kCompareNe: return a != b;
+	case kCompareLt: return a < b;
+	case kCompareLe: return a <= b;
+	case kCompareGt: return a > b;
+	default: return a >= b;
+	}
+}
+
+static bool compareReal(uint8_t compare, double a, double b)
+{
+	switch (compare)
+	{
+	case kCompareEq: return a == b;
+	case kCompareNe: return a != b;
+	case kCompareLt: return a < b;
+	case kCompareLe: return a <= b;
+	case kCompareGt: return a > b;
+	default: return a >= b;
+	}
+}
+
+bool matchesShape(const HeapFilter* filter, jlong class_tag, jlong size, jint length)
+{
+	for (auto insn = filter->code.begin(); insn != filter->code.end(); ++insn)
+	{
+		switch (insn->opcode)
+		{
+		case kFilterClass:
+		{
+			const std::vector<uint8_t>& matches = filter->classSets[insn->table];
+			bool member = class_tag > 0 && size_t(class_tag) < matches.size() && matches[size_t(class_tag)] != 0;
+			if (member != (insn->compare == kCompareEq))
+			{
+				return false;
+			}
+			break;
+		}
+		case kFilterSize:
+			if (!compareInteger(insn->compare, size, insn->value))
+			{
+				return false;
+			}
+			break;
+		case kFilterLength:
+			if (length < 0 || !compareInteger(insn->compare, length, insn->value))
+			{
+				return false;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return true;
+}
+
+typedef struct FilterSample
+{
+	jlong classTag;
+	jlong size;
+	jint length;
+	jvalue values[kMaxFieldClauses];
+	jvmtiPrimitiveType types[kMaxFieldClauses];
+} FilterSample;
+
+typedef struct FilterTotals
+{
+	jlong classTag;
+	jlong objects;
+	jlong bytes;
+} FilterTotals;
+
+typedef struct FilterScan
+{
+	const HeapFilter* filter;
+	size_t samplesWanted;
+
+	/* Object whose primitive fields are being reported */
+	bool current;
+	uint32_t fieldsMatched;
+	FilterSample object;
+
+	std::unordered_set<jlong> markedTags;
+	jlong scratchKeys;
+	WalkBudget* budget;
+	std::vector<FilterTotals> totals;
+	std::vector<FilterSample> samples;
+	jlong matched;
+	jlong bytes;
+} FilterScan;
+
+static void finishObject(FilterScan* scan)
+{
+	if (!scan->current)
+	{
+		return;
+	}
+	scan->current = false;
+	if (scan->fieldsMatched != (uint32_t(1) << scan->filter->fieldCount) - 1)
+	{
+		return;
+	}
+
+	size_t class_tag = size_t(scan->object.classTag > 0 ? scan->object.classTag : 0);
+	if (class_tag >= scan->totals.size())
+	{
+		scan->totals.resize(class_tag + 1);
+	}
+	scan->totals[class_tag].classTag = jlong(class_tag);
+	scan->totals[class_tag].objects++;
+	scan->totals[class_tag].bytes += scan->object.size;
+	scan->matched++;
+	scan->bytes += scan->object.size;
+	if (scan->samples.size() < scan->samplesWanted)
+	{
+		scan->samples.push_back(scan->object);
+	}
+}
+
+/* First walk for ref clauses: marks the objects reached through a listed
+ *   reference kind that also pass the shape clauses. A bare age stamp is
+ *   swapped for a scratch key first, it does not tell objects apart */
+static jint JNICALL filterReferenceCallback(jvmtiHeapReferenceKind reference_kind, const jvmtiHeapReferenceInfo* reference_info,
+                                            jlong class_tag, jlong referrer_class_tag, jlong size, jlong* tag_ptr,
+                                            jlong* referrer_tag_ptr, jint length, void* user_data)
+{
+	auto scan = static_cast<FilterScan*>(user_data);
+
+	if (!spendWalkBudget(scan->budget, size))
+	{
+		return JVMTI_VISIT_ABORT;
+	}
+	if ((scan->filter->referenceKinds & (uint64_t(1) << reference_kind)) != 0 &&
+		*tag_ptr != kFilterMark && matchesShape(scan->filter, class_tag, size, length))
+	{
+		if (*tag_ptr == 0)
+		{
+			*tag_ptr = kFilterMark;
+		}
+		else
+		{
+			if (isBareAgeStamp(*tag_ptr))
+			{
+				*tag_ptr = makeScratchTag(*tag_ptr, ++scan->scratchKeys);
+			}
+			scan->markedTags.insert(*tag_ptr);
+		}
+	}
+	return JVMTI_VISIT_OBJECTS;
+}
+
+/* Called before the primitive fields of the same object */
+static jint JNICALL filterIterationCallback(jlong class_tag, jlong size, jlong* tag_ptr, jint length, void* user_data)
+{
+	auto scan = static_cast<FilterScan*>(user_data);
+
+	finishObject(scan);
+
+	if (scan->filter->referenceKinds != 0)
+	{
+		jlong tag = *tag_ptr;
+		if (tag == kFilterMark)
+		{
+			*tag_ptr = 0;
+		}
+		else
+		{
+			if (isScratchTag(tag))
+			{
+				*tag_ptr = tag & kAgeMask;
+			}
+			if (scan->markedTags.find(tag) == scan->markedTags.end())
+			{
+				return 0;
+			}
+		}
+	}
+	else if (!spendWalkBudget(scan->budget, size))
+	{
+		return JVMTI_VISIT_ABORT;
+	}
+	else if (!matchesShape(scan->filter, class_tag, size, length))
+	{
+		return 0;
+	}
+
+	scan->current = true;
+	scan->fieldsMatched = 0;
+	scan->object.classTag = class_tag;
+	scan->object.size = size;
+	scan->object.length = length;
+	return 0;
+}
+
+static jint JNICALL filterFieldCallback(jvmtiHeapReferenceKind kind, const jvmtiHeapReferenceInfo* info, jlong object_class_tag,
+                                        jlong* object_tag_ptr, jvalue value, jvmtiPrimitiveType value_type, void* user_data)
+{
+	auto scan = static_cast<FilterScan*>(user_data);
+	const HeapFilter* filter = scan->filter;
+	size_t field = 0;
+
+	if (!scan->current || kind != JVMTI_HEAP_REFERENCE_FIELD)
+	{
+		return 0;
+	}
+
+	for (auto insn = filter->code.begin(); insn != filter->code.end(); ++insn)
+	{
+		if (insn->opcode != kFilterField)
+		{
+			continue;
+		}
+
+		const std::vector<jint>& slots = filter->fieldSlots[insn->table];
+		if (object_class_tag > 0 && size_t(object_class_tag) < slots.size() && slots[size_t(object_class_tag)] == info->field.index)
+		{
+			bool match;
+			if (value_type == JVMTI_PRIMITIVE_TYPE_FLOAT)
+			{
+				match = compareReal(insn->compare, value.f, insn->real);
+			}
+			else if (value_type == JVMTI_PRIMITIVE_TYPE_DOUBLE)
+			{
+				match = compareReal(insn->compare, value.d, insn->real);
+			}
+			else
+			{
+				jlong number;
+				switch (value_type)
+				{
+				case JVMTI_PRIMITIVE_TYPE_BOOLEAN: number = value.z; break;
+				case JVMTI_PRIMITIVE_TYPE_BYTE: number = value.b; break;
+				case JVMTI_PRIMITIVE_TYPE_CHAR: number = value.c; break;
+				case JVMTI_PRIMITIVE_TYPE_SHORT: number = value.s; break;
+				case JVMTI_PRIMITIVE_TYPE_INT: number = value.i; break;
+				default: number = value.j; break;
+				}
+				match = compareInteger(insn->compare, number, insn->value);
+			}
+			if (match)
+			{
+				scan->fieldsMatched |= uint32_t(1) << field;
+			}
+			scan->object.values[field] = value;
+			scan->object.types[field] = value_type;
+		}
+		field++;
+	}
+	return 0;
+}
+
+static std::string formatValue(jvalue value, jvmtiPrimitiveType type)
+{
+	char buffer[64];
+
+	switch (type)
+	{
+	case JVMTI_PRIMITIVE_TYPE_FLOAT: snprintf(buffer, sizeof(buffer), "%g", double(value.f)); break;
+	case JVMTI_PRIMITIVE_TYPE_DOUBLE: snprintf(buffer, sizeof(buffer), "%g", value.d); break;
+	case JVMTI_PRIMITIVE_TYPE_BOOLEAN: snprintf(buffer, sizeof(buffer), "%s", value.z ? "true" : "false"); break;
+	case JVMTI_PRIMITIVE_TYPE_BYTE: snprintf(buffer, sizeof(buffer), "%d", int(value.b)); break;
+	case JVMTI_PRIMITIVE_TYPE_CHAR: snprintf(buffer, sizeof(buffer), "%d", int(value.c)); break;
+	case JVMTI_PRIMITIVE_TYPE_SHORT: snprintf(buffer, sizeof(buffer), "%d", int(value.s)); break;
+	case JVMTI_PRIMITIVE_TYPE_INT: snprintf(buffer, sizeof(buffer), "%d", int(value.i)); break;
+	default: snprintf(buffer, sizeof(buffer), "%lld", (long long)value.j); break;
+	}
+	return buffer;
+}
+
+static bool moreBytes(const FilterTotals& a, const FilterTotals& b)
+{
+	return a.bytes > b.bytes;
+}
+
+jint reportFilteredObjects(jvmtiEnv* jvmti, const HeapFilter* filter, const ClassTable* classes, jint top, WalkBudget* budget)
+{
+	jvmtiError err;
+	jvmtiHeapCallbacks callbacks;
+	FilterScan scan;
+
+	scan.filter = filter;
+	scan.samplesWanted = size_t(top > 0 ? top : 0);
+	scan.current = false;
+	scan.fieldsMatched = 0;
+	scan.scratchKeys = 0;
+	scan.budget = budget;
+	scan.matched = 0;
+	scan.bytes = 0;
+
+	if (filter->referenceKinds != 0)
+	{
+		(void)memset(&callbacks, 0, sizeof(callbacks));
+		callbacks.heap_reference_callback = &filterReferenceCallback;
+		countWalkReferences(budget);
+		err = jvmti->FollowReferences(0, nullptr, nullptr, &callbacks, &scan);
+		check_jvmti_error(jvmti, err, "follow references");
+	}
+
+	(void)memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.heap_iteration_callback = &filterIterationCallback;
+	if (filter->fieldCount > 0)
+	{
+		callbacks.primitive_field_callback = &filterFieldCallback;
+	}
+	err = jvmti->IterateThroughHeap(filter->referenceKinds != 0 ? JVMTI_HEAP_FILTER_UNTAGGED : 0, nullptr, &callbacks, &scan);
+	check_jvmti_error(jvmti, err, "iterate through heap");
+	finishWalkBudget(budget);
+	finishObject(&scan);
+
+	std::vector<FilterTotals> totals;
+	for (auto it = scan.totals.begin(); it != scan.totals.end(); ++it)
+	{
+		if (it->objects > 0)
+		{
+			totals.push_back(*it);
+		}
+	}
+	size_t shown = std::min(totals.size(), size_t(top > 0 ? top : 0));
+	std::partial_sort(totals.begin(), totals.begin() + shown, totals.end(), &moreBytes);
+
+	stdout_message("Matching objects: %lld, %lld bytes\n", (long long)scan.matched, (long long)scan.bytes);
+	for (size_t i = 0; i < shown; ++i)
+	{
+		stdout_message(" %3d. %-60s objects %10lld, bytes %14lld\n", int(i + 1), classNameOf(classes, totals[i].classTag),
+		               (long long)totals[i].objects, (long long)totals[i].bytes);
+	}
+
+	if (!scan.samples.empty())
+	{
+		stdout_message("\nSamples:\n");
+	}
+	for (auto it = scan.samples.begin(); it != scan.samples.end(); ++it)
+	{
+		std::string fields;
+		size_t field = 0;
+		for (size_t i = 0; i < filter->code.size(); ++i)
+		{
+			if (filter->code[i].opcode == kFilterField)
+			{
+				fields += ' ' + filter->text[i].substr(6, filter->text[i].find_first_of("=!<>") - 6) + '=' +
+				          formatValue(it->values[field], it->types[field]);
+				field++;
+			}
+		}
+		if (it->length >= 0)
+		{
+			fields += " length=" + std::to_string((long long)it->length);
+		}
+		stdout_message("  %s, %lld bytes%s\n", classNameOf(classes, it->classTag), (long long)it->size, fields.c_str());
+	}
+
+	return jint(scan.matched);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+
+#ifndef HEAP_FILTER_H
+#define HEAP_FILTER_H
+
+#include <vector>
+#include <string>
+
+#include <jni.h>
+#include <ibmjvmti.h>
+
+#include "classTable.hpp"
+#include "walkBudget.hpp"
+
+/* '*' matches any run of characters, for the Java class name patterns */
+bool globMatch(const char* pattern, const char* text);
+
+/* Object filters, e.g.
+ *     class=com.example.*Session field.lastAccess<1700000000000
+ *     class=byte[] length>=1m ref=stack_local,jni_local
+ *   Clauses are separated by blanks or "and" and must all hold:
+ *     class=PATTERN, class!=PATTERN   Java class name, '*' matches anything
+ *     size OP N                       shallow size in bytes
+ *     length OP N                     array length, never true for objects
+ *     field.NAME OP N                 primitive instance field
+ *     ref=KIND,KIND...                reached through one of these
+ *                                     references, e.g. field, stack_local;
+ *                                     at most one ref clause per filter
+ *   OP is one of = == != < <= > >=, N may end in k, m or g.
+ *
+ *   A filter is compiled once against the class table into a flat list of
+ *   instructions. Class patterns and field names are resolved per class
+ *   tag then, so the heap callbacks only compare numbers.
+ */
+enum FilterOpcode
+{
+	kFilterClass,
+	kFilterSize,
+	kFilterLength,
+	kFilterField,
+	kFilterReference
+};
+
+enum FilterCompare
+{
+	kCompareEq,
+	kCompareNe,
+	kCompareLt,
+	kCompareLe,
+	kCompareGt,
+	kCompareGe
+};
+
+typedef struct FilterInsn
+{
+	uint8_t opcode;
+	uint8_t compare;
+
+	/* Class set or field slot table of the instruction */
+	uint32_t table;
+	jlong value;
+	double real;
+} FilterInsn;
+
+typedef struct HeapFilter
+{
+	std::vector<FilterInsn> code;
+
+	/* Per class tag: whether the class matches, or the callback index of
+	 *   the field, -1 when the class has no such primitive field */
+	std::vector<std::vector<uint8_t> > classSets;
+	std::vector<std::vector<jint> > fieldSlots;
+
+	/* Reference kinds of the ref clauses, bit per jvmtiHeapReferenceKind */
+	uint64_t referenceKinds;
+	size_t fieldCount;
+
+	/* Clause names for reports, by instruction */
+	std::vector<std::string> text;
+} HeapFilter;
+
+/* Returns false and describes the problem in error when the expression
+ *   does not parse */
+bool compileHeapFilter(const char* expression, const ClassTable* classes, HeapFilter* filter, std::string* error);
+
+/* Class, size and length clauses, the ones known before the fields. A
+ *   filter without field or ref clauses is decided by them alone. */
+bool matchesShape(const HeapFilter* filter, jlong class_tag, jlong size, jint length);
+
+inline bool isShapeFilter(const HeapFilter* filter)
+{
+	return filter->fieldCount == 0 && filter->referenceKinds == 0;
+}
+
+/* Finds the objects matching the filter and prints them by class with a
+ *   few samples. One IterateThroughHeap walk, ref clauses take a
+ *   FollowReferences walk before it. The budget bounds the first walk, the
+ *   iteration after a FollowReferences walk clears its marks and always
+ *   runs to the end. Returns the number of matches.
+ */
+jint reportFilteredObjects(jvmtiEnv* jvmti, const HeapFilter* filter, const ClassTable* classes, jint top, WalkBudget* budget);
+
+#endif
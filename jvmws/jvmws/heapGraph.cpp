@@ -0,0 +1,318 @@
+#include <utility>
+#include <algorithm>
+
+#include "heapGraph.hpp"
+
+void buildGraphEdges(HeapGraph* graph, std::vector<HeapEdge>& edges)
+{
+	size_t nodes = graphNodeCount(graph);
+
+	/* Counting sort by source node, edges keep their reporting order */
+	graph->edgeStarts.assign(nodes + 1, 0);
+	for (auto it = edges.begin(); it != edges.end(); ++it)
+	{
+		graph->edgeStarts[it->from + 1]++;
+	}
+	for (size_t n = 0; n < nodes; ++n)
+	{
+		graph->edgeStarts[n + 1] += graph->edgeStarts[n];
+	}
+
+	std::vector<uint64_t> next(graph->edgeStarts.begin(), graph->edgeStarts.end() - 1);
+	graph->edgeTargets.resize(edges.size());
+	graph->edgeLabels.resize(edges.size());
+	for (auto it = edges.begin(); it != edges.end(); ++it)
+	{
+		uint64_t e = next[it->from]++;
+		graph->edgeTargets[e] = it->to;
+		graph->edgeLabels[e] = it->label;
+	}
+
+	std::vector<HeapEdge>().swap(edges);
+}
+
+void buildIncomingEdges(const HeapGraph* graph, IncomingEdges* incoming)
+{
+	size_t nodes = graphNodeCount(graph);
+	size_t edges = graph->edgeTargets.size();
+
+	incoming->starts.assign(nodes + 1, 0);
+	for (size_t e = 0; e < edges; ++e)
+	{
+		incoming->starts[graph->edgeTargets[e] + 1]++;
+	}
+	for (size_t n = 0; n < nodes; ++n)
+	{
+		incoming->starts[n + 1] += incoming->starts[n];
+	}
+
+	std::vector<uint64_t> next(incoming->starts.begin(), incoming->starts.end() - 1);
+	incoming->sources.resize(edges);
+	incoming->edges.resize(edges);
+	for (NodeId from = 0; from < nodes; ++from)
+	{
+		for (uint64_t e = graph->edgeStarts[from]; e < graph->edgeStarts[from + 1]; ++e)
+		{
+			uint64_t slot = next[graph->edgeTargets[e]]++;
+			incoming->sources[slot] = from;
+			incoming->edges[slot] = e;
+		}
+	}
+}
+
+/* Path compression of the Lengauer-Tarjan forest, iterative so that long
+ *   reference chains cannot overflow the native stack.
+ */
+static void compress(uint32_t v, std::vector<uint32_t>& ancestor, std::vector<uint32_t>& label,
+                     const std::vector<uint32_t>& semi, std::vector<uint32_t>& path)
+{
+	path.clear();
+	while (ancestor[ancestor[v]] != kNoNode)
+	{
+		path.push_back(v);
+		v = ancestor[v];
+	}
+	while (!path.empty())
+	{
+		uint32_t x = path.back();
+		path.pop_back();
+		uint32_t a = ancestor[x];
+		if (semi[label[a]] < semi[label[x]])
+		{
+			label[x] = label[a];
+		}
+		ancestor[x] = ancestor[a];
+	}
+}
+
+static uint32_t eval(uint32_t v, std::vector<uint32_t>& ancestor, std::vector<uint32_t>& label,
+                     const std::vector<uint32_t>& semi, std::vector<uint32_t>& path)
+{
+	if (ancestor[v] == kNoNode)
+	{
+		return v;
+	}
+	compress(v, ancestor, label, semi, path);
+	return label[v];
+}
+
+void computeDominators(const HeapGraph* graph, DominatorTree* tree)
+{
+	size_t nodes = graphNodeCount(graph);
+
+	tree->idom.assign(nodes, kNoNode);
+	tree->retained.assign(graph->sizes.begin(), graph->sizes.end());
+	if (nodes == 0)
+	{
+		return;
+	}
+
+	/* Depth first numbering from the root, all arrays below are indexed by
+	 *   DFS number except dfnum itself */
+	std::vector<uint32_t> dfnum(nodes, kNoNode);
+	std::vector<NodeId> vertex;
+	std::vector<uint32_t> parent;
+	std::vector<std::pair<NodeId, uint64_t> > stack;
+
+	vertex.reserve(nodes);
+	parent.reserve(nodes);
+	dfnum[kRootNode] = 0;
+	vertex.push_back(kRootNode);
+	parent.push_back(kNoNode);
+	stack.push_back(std::make_pair(kRootNode, graph->edgeStarts[kRootNode]));
+	while (!stack.empty())
+	{
+		NodeId n = stack.back().first;
+		uint64_t e = stack.back().second;
+		if (e == graph->edgeStarts[n + 1])
+		{
+			stack.pop_back();
+			continue;
+		}
+		stack.back().second++;
+
+		NodeId m = graph->edgeTargets[e];
+		if (dfnum[m] == kNoNode)
+		{
+			dfnum[m] = uint32_t(vertex.size());
+			vertex.push_back(m);
+			parent.push_back(dfnum[n]);
+			stack.push_back(std::make_pair(m, graph->edgeStarts[m]));
+		}
+	}
+	std::vector<std::pair<NodeId, uint64_t> >().swap(stack);
+
+	uint32_t reached = uint32_t(vertex.size());
+
+	/* Predecessors of the reached nodes, by DFS number */
+	std::vector<uint64_t> predStarts(reached + 1, 0);
+	for (uint32_t i = 0; i < reached; ++i)
+	{
+		NodeId n = vertex[i];
+		for (uint64_t e = graph->edgeStarts[n]; e < graph->edgeStarts[n + 1]; ++e)
+		{
+			predStarts[dfnum[graph->edgeTargets[e]] + 1]++;
+		}
+	}
+	for (uint32_t i = 0; i < reached; ++i)
+	{
+		predStarts[i + 1] += predStarts[i];
+	}
+	std::vector<uint32_t> preds(predStarts[reached]);
+	{
+		std::vector<uint64_t> next(predStarts.begin(), predStarts.end() - 1);
+		for (uint32_t i = 0; i < reached; ++i)
+		{
+			NodeId n = vertex[i];
+			for (uint64_t e = graph->edgeStarts[n]; e < graph->edgeStarts[n + 1]; ++e)
+			{
+				preds[next[dfnum[graph->edgeTargets[e]]]++] = i;
+			}
+		}
+	}
+
+	std::vector<uint32_t> semi(reached);
+	std::vector<uint32_t> idom(reached, kNoNode);
+	std::vector<uint32_t> ancestor(reached, kNoNode);
+	std::vector<uint32_t> label(reached);
+	std::vector<uint32_t> bucketHead(reached, kNoNode);
+	std::vector<uint32_t> bucketNext(reached, kNoNode);
+	std::vector<uint32_t> path;
+
+	for (uint32_t i = 0; i < reached; ++i)
+	{
+		semi[i] = i;
+		label[i] = i;
+	}
+
+	for (uint32_t w = reached - 1; w > 0; --w)
+	{
+		for (uint64_t p = predStarts[w]; p < predStarts[w + 1]; ++p)
+		{
+			uint32_t u = eval(preds[p], ancestor, label, semi, path);
+			if (semi[u] < semi[w])
+			{
+				semi[w] = semi[u];
+			}
+		}
+		bucketNext[w] = bucketHead[semi[w]];
+		bucketHead[semi[w]] = w;
+
+		uint32_t pw = parent[w];
+		ancestor[w] = pw;
+
+		for (uint32_t v = bucketHead[pw]; v != kNoNode; v = bucketNext[v])
+		{
+			uint32_t u = eval(v, ancestor, label, semi, path);
+			idom[v] = semi[u] < semi[v] ? u : pw;
+		}
+		bucketHead[pw] = kNoNode;
+	}
+
+	for (uint32_t w = 1; w < reached; ++w)
+	{
+		if (idom[w] != semi[w])
+		{
+			idom[w] = idom[idom[w]];
+		}
+	}
+
+	/* Dominators precede what they dominate in DFS order */
+	for (uint32_t w = reached - 1; w > 0; --w)
+	{
+		tree->idom[vertex[w]] = vertex[idom[w]];
+		tree->retained[vertex[idom[w]]] += tree->retained[vertex[w]];
+	}
+}
+
+void computeShortestPaths(const HeapGraph* graph, ShortestPaths* paths)
+{
+	size_t nodes = graphNodeCount(graph);
+	std::vector<NodeId> queue;
+
+	paths->parent.assign(nodes, kNoNode);
+	paths->parentEdge.assign(nodes, 0);
+	if (nodes == 0)
+	{
+		return;
+	}
+
+	std::vector<bool> seen(nodes, false);
+	seen[kRootNode] = true;
+	queue.reserve(nodes);
+	queue.push_back(kRootNode);
+	for (size_t head = 0; head < queue.size(); ++head)
+	{
+		NodeId n = queue[head];
+		for (uint64_t e = graph->edgeStarts[n]; e < graph->edgeStarts[n + 1]; ++e)
+		{
+			NodeId m = graph->edgeTargets[e];
+			if (!seen[m])
+			{
+				seen[m] = true;
+				paths->parent[m] = n;
+				paths->parentEdge[m] = e;
+				queue.push_back(m);
+			}
+		}
+	}
+}
+
+std::vector<NodeId> pathFromRoot(const ShortestPaths* paths, NodeId node)
+{
+	std::vector<NodeId> path;
+
+	if (node != kRootNode && paths->parent[node] == kNoNode)
+	{
+		return path;
+	}
+	for (NodeId n = node; n != kRootNode; n = paths->parent[n])
+	{
+		path.push_back(n);
+	}
+	std::reverse(path.begin(), path.end());
+	return path;
+}
+
+static bool moreShallow(const ClassHistogramEntry& a, const ClassHistogramEntry& b)
+{
+	return a.shallow > b.shallow;
+}
+
+void computeClassHistogram(const HeapGraph* graph, const DominatorTree* tree, std::vector<ClassHistogramEntry>* histogram)
+{
+	size_t nodes = graphNodeCount(graph);
+	std::vector<ClassHistogramEntry> entries;
+
+	for (size_t n = 1; n < nodes; ++n)
+	{
+		if ((graph->flags[n] & (kNodeIsClass | kNodeIsVirtual)) != 0)
+		{
+			continue;
+		}
+
+		uint32_t class_id = graph->classIds[n];
+		if (class_id >= entries.size())
+		{
+			entries.resize(size_t(class_id) + 1);
+		}
+		ClassHistogramEntry* entry = &entries[class_id];
+		entry->instances++;
+		entry->shallow += graph->sizes[n];
+		if (tree != nullptr && tree->retained[n] > entry->maxRetained)
+		{
+			entry->maxRetained = tree->retained[n];
+		}
+	}
+
+	histogram->clear();
+	for (size_t c = 0; c < entries.size(); ++c)
+	{
+		if (entries[c].instances > 0)
+		{
+			entries[c].classId = uint32_t(c);
+			histogram->push_back(entries[c]);
+		}
+	}
+	std::sort(histogram->begin(), histogram->end(), &moreShallow);
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+
+#ifndef HEAP_GRAPH_H
+#define HEAP_GRAPH_H
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Object graph of a heap snapshot. It holds plain numbers only, no JVMTI
+ *   types, so the algorithms below do not depend on a running VM.
+ */
+typedef uint32_t NodeId;
+
+static const NodeId kNoNode = 0xFFFFFFFFu;
+
+/* Node 0 is a virtual root, its edges lead to the GC roots */
+static const NodeId kRootNode = 0;
+
+/* Node flags. Thread and frame nodes are virtual nodes for the thread
+ *   roots, they stand for no object and have size 0. */
+static const uint8_t kNodeIsClass = 0x01;
+static const uint8_t kNodeIsThread = 0x02;
+static const uint8_t kNodeIsFrame = 0x04;
+static const uint8_t kNodeIsVirtual = kNodeIsThread | kNodeIsFrame;
+
+/* Edge labels pack the JVMTI reference kind with the field or array index */
+inline uint32_t packEdgeLabel(uint32_t kind, uint32_t index)
+{
+	return (kind << 24) | (index > 0xFFFFFFu ? 0xFFFFFFu : index);
+}
+
+inline uint32_t edgeLabelKind(uint32_t label)
+{
+	return label >> 24;
+}
+
+inline uint32_t edgeLabelIndex(uint32_t label)
+{
+	return label & 0xFFFFFFu;
+}
+
+typedef struct HeapEdge
+{
+	NodeId from;
+	NodeId to;
+	uint32_t label;
+} HeapEdge;
+
+typedef struct HeapGraph
+{
+	/* Node columns. The class id is the class tag of the object's class,
+	 *   or of the class itself for nodes flagged kNodeIsClass */
+	std::vector<uint32_t> classIds;
+	std::vector<uint64_t> sizes;
+	std::vector<uint8_t> flags;
+
+	/* Outgoing edges of node n are edgeStarts[n] .. edgeStarts[n + 1] */
+	std::vector<uint64_t> edgeStarts;
+	std::vector<NodeId> edgeTargets;
+	std::vector<uint32_t> edgeLabels;
+} HeapGraph;
+
+/* Edges by target node, built on demand for browsing referrers. The
+ *   incoming edges of node n are starts[n] .. starts[n + 1], each with its
+ *   source node and the index of the outgoing edge for the label. */
+typedef struct IncomingEdges
+{
+	std::vector<uint64_t> starts;
+	std::vector<NodeId> sources;
+	std::vector<uint64_t> edges;
+} IncomingEdges;
+
+typedef struct DominatorTree
+{
+	/* Immediate dominator, kNoNode for the root and unreachable nodes */
+	std::vector<NodeId> idom;
+
+	/* Shallow size of the node plus the sizes of all nodes it dominates */
+	std::vector<uint64_t> retained;
+} DominatorTree;
+
+typedef struct ShortestPaths
+{
+	/* Previous node on a shortest path from the root, kNoNode for the root
+	 *   and unreachable nodes, and the outgoing edge index leading here */
+	std::vector<NodeId> parent;
+	std::vector<uint64_t> parentEdge;
+} ShortestPaths;
+
+typedef struct ClassHistogramEntry
+{
+	uint32_t classId;
+	uint64_t instances;
+	uint64_t shallow;
+
+	/* Largest retained size of a single instance */
+	uint64_t maxRetained;
+} ClassHistogramEntry;
+
+inline size_t graphNodeCount(const HeapGraph* graph)
+{
+	return graph->classIds.size();
+}
+
+/* Sorts the collected edges into the outgoing edge arrays. The node
+ *   columns must be complete; edges is emptied.
+ */
+void buildGraphEdges(HeapGraph* graph, std::vector<HeapEdge>& edges);
+
+/* Counting sort of the outgoing edges by target node */
+void buildIncomingEdges(const HeapGraph* graph, IncomingEdges* incoming);
+
+/* Lengauer-Tarjan dominators from the virtual root, with retained sizes */
+void computeDominators(const HeapGraph* graph, DominatorTree* tree);
+
+/* Breadth first search from the virtual root */
+void computeShortestPaths(const HeapGraph* graph, ShortestPaths* paths);
+
+/* Nodes from the first GC root down to node, empty if unreachable */
+std::vector<NodeId> pathFromRoot(const ShortestPaths* paths, NodeId node);
+
+/* Instances and shallow bytes per class id, class objects and virtual
+ *   nodes left out. tree may be nullptr. Sorted by shallow bytes. */
+void computeClassHistogram(const HeapGraph* graph, const DominatorTree* tree, std::vector<ClassHistogramEntry>* histogram);
+
+#endif
@@ -0,0 +1,115 @@
+#include <algorithm>
+
+#include "agent_util.hpp"
+#include "heapPipeline.hpp"
+
+typedef HeapPipeline<SizeAccountingStage, ClassHistogramStage, LargestStage, DuplicateStage> Dashboard;
+typedef HeapPipeline<ShapeFilterStage, SizeAccountingStage, ClassHistogramStage, LargestStage, DuplicateStage> FilteredDashboard;
+
+static void printSizeAccounting(const SizeAccountingStage* sizes)
+{
+	stdout_message("  %-20s %12s %16s\n", "", "objects", "bytes");
+	stdout_message("  %-20s %12lld %16lld\n", "instances", (long long)sizes->instances, (long long)sizes->instanceBytes);
+	stdout_message("  %-20s %12lld %16lld\n", "reference arrays", (long long)sizes->objectArrays,
+	               (long long)sizes->objectArrayBytes);
+	stdout_message("  %-20s %12lld %16lld\n", "primitive arrays", (long long)sizes->primitiveArrays,
+	               (long long)sizes->primitiveArrayBytes);
+	stdout_message("  %-20s %12lld %16lld\n", "  of them empty", (long long)sizes->emptyArrays,
+	               (long long)sizes->emptyArrayBytes);
+}
+
+typedef struct RankedClass
+{
+	size_t classTag;
+	ClassCount count;
+} RankedClass;
+
+static bool moreClassBytes(const RankedClass& a, const RankedClass& b)
+{
+	return a.count.bytes > b.count.bytes;
+}
+
+static void printClassHistogram(const ClassHistogramStage* histogram, const ClassTable* classes, jint top)
+{
+	std::vector<RankedClass> ranked;
+
+	for (size_t c = 0; c < histogram->counts.size(); ++c)
+	{
+		if (histogram->counts[c].instances > 0)
+		{
+			RankedClass entry = { c, histogram->counts[c] };
+			ranked.push_back(entry);
+		}
+	}
+	size_t shown = std::min(ranked.size(), size_t(top > 0 ? top : 0));
+	std::partial_sort(ranked.begin(), ranked.begin() + shown, ranked.end(), &moreClassBytes);
+
+	stdout_message("Classes with instances: %d\n", int(ranked.size()));
+	for (size_t i = 0; i < shown; ++i)
+	{
+		stdout_message(" %3d. %-60s instances %10lld, bytes %14lld\n", int(i + 1),
+		               classNameOf(classes, jlong(ranked[i].classTag)), (long long)ranked[i].count.instances,
+		               (long long)ranked[i].count.bytes);
+	}
+}
+
+static void printLargest(const LargeObject* heap, uint32_t count, const ClassTable* classes, jint top)
+{
+	LargeObject sorted[kLargestObjects];
+	uint32_t shown = std::min(sortLargestObjects(heap, count, sorted), uint32_t(top > 0 ? top : 0));
+
+	for (uint32_t i = 0; i < shown; ++i)
+	{
+		std::string length = sorted[i].length >= 0 ? ", length " + std::to_string((long long)sorted[i].length) : "";
+		stdout_message(" %3d. %-60s %14lld bytes%s\n", int(i + 1), classNameOf(classes, sorted[i].classId),
+		               (long long)sorted[i].size, length.c_str());
+	}
+}
+
+template <typename Pipeline>
+static void runDashboard(jvmtiEnv* jvmti, Pipeline* pipeline, WalkBudget* budget)
+{
+	jvmtiError err = runHeapPipeline(jvmti, pipeline, budget);
+	check_jvmti_error(jvmti, err, "iterate through heap");
+}
+
+jint reportHeapDashboard(jvmtiEnv* jvmti, const HeapFilter* filter, const ClassTable* classes, jint top, WalkBudget* budget)
+{
+	ShapeFilterStage shape;
+	SizeAccountingStage sizes = {};
+	ClassHistogramStage histogram;
+	LargestStage largest;
+	DuplicateStage duplicates;
+	ClassCount none = { 0, 0 };
+
+	shape.filter = filter;
+	sizes.classes = classes;
+	histogram.counts.assign(classes->classes.size() + 1, none);
+	clearLargestObjects(&largest.largest);
+	largest.ordinal = 0;
+	initDuplicateScan(&duplicates.scan);
+
+	if (filter != nullptr)
+	{
+		FilteredDashboard pipeline(&shape, &sizes, &histogram, &largest, &duplicates);
+		runDashboard(jvmti, &pipeline, budget);
+	}
+	else
+	{
+		Dashboard pipeline(&sizes, &histogram, &largest, &duplicates);
+		runDashboard(jvmti, &pipeline, budget);
+	}
+
+	stdout_message("Shallow sizes:\n");
+	printSizeAccounting(&sizes);
+	stdout_message("\n");
+	printClassHistogram(&histogram, classes, top);
+	stdout_message("\nLargest instances:\n");
+	printLargest(largest.largest.objects, largest.largest.objectCount, classes, top);
+	stdout_message("\nLargest arrays:\n");
+	printLargest(largest.largest.arrays, largest.largest.arrayCount, classes, top);
+	stdout_message("\n");
+	printDuplicates(&duplicates.scan, top);
+
+	return jint(sizes.instances + sizes.objectArrays + sizes.primitiveArrays);
+}
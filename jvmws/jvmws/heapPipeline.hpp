@@ -0,0 +1,286 @@
+#pragma once
+
+
+#ifndef HEAP_PIPELINE_H
+#define HEAP_PIPELINE_H
+
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+#include <jni.h>
+#include <ibmjvmti.h>
+
+#include "classTable.hpp"
+#include "heapFilter.hpp"
+#include "duplicates.hpp"
+#include "largestObjects.hpp"
+#include "walkBudget.hpp"
+
+/* Several analyses fed by one IterateThroughHeap walk. A pipeline is a
+ *   list of stage types fixed at compile time, the walk callbacks are
+ *   instantiated for it and call every stage hook directly, so the empty
+ *   hooks of a stage compile to nothing. The primitive array and String
+ *   callbacks are only registered when a stage wants them.
+ *
+ *   Stages see the objects in pipeline order. A stage whose object hook
+ *   returns false hides the object, with its array or String contents,
+ *   from the stages after it, so filters go first.
+ */
+struct PipelineStage
+{
+	static const bool kArrays = false;
+	static const bool kStrings = false;
+
+	bool object(jlong class_tag, jlong size, jint length)
+	{
+		return true;
+	}
+
+	void primitiveArray(jlong size, jvmtiPrimitiveType element_type, const void* elements, jint element_count)
+	{
+	}
+
+	void string(jlong size, const jchar* value, jint value_length)
+	{
+	}
+};
+
+template <typename... Stages>
+struct HeapPipeline;
+
+template <>
+struct HeapPipeline<>
+{
+	static const bool kArrays = false;
+	static const bool kStrings = false;
+
+	bool object(jlong class_tag, jlong size, jint length)
+	{
+		return true;
+	}
+
+	void primitiveArray(jlong size, jvmtiPrimitiveType element_type, const void* elements, jint element_count)
+	{
+	}
+
+	void string(jlong size, const jchar* value, jint value_length)
+	{
+	}
+};
+
+/* Holds the stages by pointer, the caller owns them and reads the results */
+template <typename Stage, typename... Rest>
+struct HeapPipeline<Stage, Rest...>
+{
+	static const bool kArrays = Stage::kArrays || HeapPipeline<Rest...>::kArrays;
+	static const bool kStrings = Stage::kStrings || HeapPipeline<Rest...>::kStrings;
+
+	Stage* stage;
+	HeapPipeline<Rest...> rest;
+
+	/* The current object passed this stage */
+	bool passed;
+
+	HeapPipeline(Stage* first, Rest*... others) : stage(first), rest(others...), passed(false)
+	{
+	}
+
+	bool object(jlong class_tag, jlong size, jint length)
+	{
+		passed = stage->object(class_tag, size, length);
+		return passed && rest.object(class_tag, size, length);
+	}
+
+	void primitiveArray(jlong size, jvmtiPrimitiveType element_type, const void* elements, jint element_count)
+	{
+		stage->primitiveArray(size, element_type, elements, element_count);
+		if (passed)
+		{
+			rest.primitiveArray(size, element_type, elements, element_count);
+		}
+	}
+
+	void string(jlong size, const jchar* value, jint value_length)
+	{
+		stage->string(size, value, value_length);
+		if (passed)
+		{
+			rest.string(size, value, value_length);
+		}
+	}
+};
+
+/* The walk state handed to the callbacks */
+template <typename Pipeline>
+struct PipelineWalk
+{
+	Pipeline* pipeline;
+	WalkBudget* budget;
+};
+
+template <typename Pipeline>
+jint JNICALL pipelineObjectCallback(jlong class_tag, jlong size, jlong* tag_ptr, jint length, void* user_data)
+{
+	PipelineWalk<Pipeline>* walk = static_cast<PipelineWalk<Pipeline>*>(user_data);
+
+	if (!spendWalkBudget(walk->budget, size))
+	{
+		return JVMTI_VISIT_ABORT;
+	}
+	walk->pipeline->object(class_tag, size, length);
+	return 0;
+}
+
+template <typename Pipeline>
+jint JNICALL pipelineArrayCallback(jlong class_tag, jlong size, jlong* tag_ptr, jint element_count,
+                                   jvmtiPrimitiveType element_type, const void* elements, void* user_data)
+{
+	static_cast<PipelineWalk<Pipeline>*>(user_data)->pipeline->primitiveArray(size, element_type, elements, element_count);
+	return 0;
+}
+
+template <typename Pipeline>
+jint JNICALL pipelineStringCallback(jlong class_tag, jlong size, jlong* tag_ptr, const jchar* value,
+                                    jint value_length, void* user_data)
+{
+	static_cast<PipelineWalk<Pipeline>*>(user_data)->pipeline->string(size, value, value_length);
+	return 0;
+}
+
+/* Walks the heap once through the pipeline, until the budget is spent */
+template <typename Pipeline>
+jvmtiError runHeapPipeline(jvmtiEnv* jvmti, Pipeline* pipeline, WalkBudget* budget)
+{
+	PipelineWalk<Pipeline> walk = { pipeline, budget };
+	jvmtiHeapCallbacks callbacks;
+	jvmtiError err;
+
+	(void)memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.heap_iteration_callback = &pipelineObjectCallback<Pipeline>;
+	if (Pipeline::kArrays)
+	{
+		callbacks.array_primitive_value_callback = &pipelineArrayCallback<Pipeline>;
+	}
+	if (Pipeline::kStrings)
+	{
+		callbacks.string_primitive_value_callback = &pipelineStringCallback<Pipeline>;
+	}
+	err = jvmti->IterateThroughHeap(0, nullptr, &callbacks, &walk);
+	finishWalkBudget(budget);
+	return err;
+}
+
+/* Passes the objects matching the class, size and length clauses */
+struct ShapeFilterStage : PipelineStage
+{
+	const HeapFilter* filter;
+
+	bool object(jlong class_tag, jlong size, jint length)
+	{
+		return matchesShape(filter, class_tag, size, length);
+	}
+};
+
+/* Shallow bytes of instances, reference arrays and primitive arrays */
+struct SizeAccountingStage : PipelineStage
+{
+	const ClassTable* classes;
+	uint64_t instances;
+	uint64_t instanceBytes;
+	uint64_t objectArrays;
+	uint64_t objectArrayBytes;
+	uint64_t primitiveArrays;
+	uint64_t primitiveArrayBytes;
+	uint64_t emptyArrays;
+	uint64_t emptyArrayBytes;
+
+	bool object(jlong class_tag, jlong size, jint length)
+	{
+		if (length < 0)
+		{
+			instances++;
+			instanceBytes += uint64_t(size);
+			return true;
+		}
+		const ClassInfo* info = findClassInfo(classes, class_tag);
+		if (info != nullptr && info->primitiveArrayType != 0)
+		{
+			primitiveArrays++;
+			primitiveArrayBytes += uint64_t(size);
+		}
+		else
+		{
+			objectArrays++;
+			objectArrayBytes += uint64_t(size);
+		}
+		if (length == 0)
+		{
+			emptyArrays++;
+			emptyArrayBytes += uint64_t(size);
+		}
+		return true;
+	}
+};
+
+typedef struct ClassCount
+{
+	uint64_t instances;
+	uint64_t bytes;
+} ClassCount;
+
+/* Instances and shallow bytes per class tag, index 0 for unknown classes */
+struct ClassHistogramStage : PipelineStage
+{
+	std::vector<ClassCount> counts;
+
+	bool object(jlong class_tag, jlong size, jint length)
+	{
+		size_t slot = class_tag > 0 && size_t(class_tag) < counts.size() ? size_t(class_tag) : 0;
+		counts[slot].instances++;
+		counts[slot].bytes += uint64_t(size);
+		return true;
+	}
+};
+
+/* Largest instances and arrays, numbered in walk order */
+struct LargestStage : PipelineStage
+{
+	LargestObjects largest;
+	NodeId ordinal;
+
+	bool object(jlong class_tag, jlong size, jint length)
+	{
+		offerLargeObject(&largest, ordinal++, 0, uint32_t(class_tag), uint64_t(size), length);
+		return true;
+	}
+};
+
+/* Duplicated primitive array and String values */
+struct DuplicateStage : PipelineStage
+{
+	static const bool kArrays = true;
+	static const bool kStrings = true;
+
+	DuplicateScan scan;
+
+	void primitiveArray(jlong size, jvmtiPrimitiveType element_type, const void* elements, jint element_count)
+	{
+		addDuplicateArray(&scan, size, element_type, elements, element_count);
+	}
+
+	void string(jlong size, const jchar* value, jint value_length)
+	{
+		addDuplicateString(&scan, size, value, value_length);
+	}
+};
+
+/* Size accounting, class histogram, largest objects and duplicates of the
+ *   objects passing filter, nullptr for all, in one walk. The filter must
+ *   be a shape filter. The walk stops when the budget is spent, the budget
+ *   is left for the caller to report. Returns the number of objects that
+ *   passed. */
+jint reportHeapDashboard(jvmtiEnv* jvmti, const HeapFilter* filter, const ClassTable* classes, jint top, WalkBudget* budget);
+
+#endif
@@ -0,0 +1,314 @@
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+#include "agent_util.hpp"
+#include "analysisTags.hpp"
+#include "heapSnapshot.hpp"
+
+static jlong snapshotGeneration;
+
+typedef struct SnapshotCapture
+{
+	HeapGraph* graph;
+	jlong generation;
+	std::vector<HeapEdge> edges;
+	LargestObjects* largest;
+	CollectionCapture collections;
+
+	/* Node of each class object, by class tag */
+	std::vector<NodeId> classNodes;
+
+	/* Thread roots by thread id, frame roots by thread id and depth */
+	std::vector<ThreadRoot>* threads;
+	std::vector<FrameRoot>* frames;
+	std::unordered_map<jlong, uint32_t> threadIndex;
+	std::map<std::pair<jlong, jint>, NodeId> frameIndex;
+} SnapshotCapture;
+
+static NodeId addNode(HeapGraph* graph, jlong class_id, jlong size, uint8_t flags)
+{
+	graph->classIds.push_back(uint32_t(class_id));
+	graph->sizes.push_back(uint64_t(size));
+	graph->flags.push_back(flags);
+	return NodeId(graph->classIds.size() - 1);
+}
+
+/* Node of an object, created and tagged on first sight. Class objects keep
+ *   their class tag and are found through classNodes instead.
+ */
+static NodeId snapshotNode(SnapshotCapture* capture, jlong* tag_ptr, jlong class_tag, jlong size)
+{
+	jlong tag = *tag_ptr;
+
+	if (isClassTag(tag))
+	{
+		if (size_t(tag) >= capture->classNodes.size())
+		{
+			capture->classNodes.resize(size_t(tag) + 1, kNoNode);
+		}
+		NodeId node = capture->classNodes[size_t(tag)];
+		if (node == kNoNode)
+		{
+			node = addNode(capture->graph, tag, size, kNodeIsClass);
+			capture->classNodes[size_t(tag)] = node;
+		}
+		else if (capture->graph->sizes[node] == 0)
+		{
+			capture->graph->sizes[node] = uint64_t(size);
+		}
+		return node;
+	}
+
+	NodeId node = nodeOfTag(capture->graph, capture->generation, tag);
+	if (node != kNoNode)
+	{
+		return node;
+	}
+
+	node = addNode(capture->graph, class_tag, size, 0);
+	*tag_ptr = makeNodeTag(capture->generation, node) | ageBitsOf(tag);
+	return node;
+}
+
+/* Virtual node of the frame a stack or JNI local root lives in, the
+ *   thread node and the edges root -> thread -> frame are created with it.
+ */
+static NodeId frameNode(SnapshotCapture* capture, jlong thread_tag, jlong thread_id, jint depth,
+                        jmethodID method, jlocation location)
+{
+	auto frame = capture->frameIndex.find(std::make_pair(thread_id, depth));
+	if (frame != capture->frameIndex.end())
+	{
+		return frame->second;
+	}
+
+	auto thread = capture->threadIndex.find(thread_id);
+	if (thread == capture->threadIndex.end())
+	{
+		ThreadRoot root;
+		root.node = addNode(capture->graph, 0, 0, kNodeIsThread);
+		root.threadId = thread_id;
+		root.threadObject = nodeOfTag(capture->graph, capture->generation, thread_tag);
+		capture->threads->push_back(root);
+		thread = capture->threadIndex.insert(std::make_pair(thread_id, uint32_t(capture->threads->size() - 1))).first;
+
+		HeapEdge edge = { kRootNode, root.node, packEdgeLabel(JVMTI_HEAP_REFERENCE_THREAD, 0) };
+		capture->edges.push_back(edge);
+	}
+
+	FrameRoot root;
+	root.node = addNode(capture->graph, 0, 0, kNodeIsFrame);
+	root.thread = thread->second;
+	root.depth = depth;
+	root.method = method;
+	root.location = location;
+	capture->frames->push_back(root);
+	capture->frameIndex[std::make_pair(thread_id, depth)] = root.node;
+
+	HeapEdge edge = { (*capture->threads)[thread->second].node, root.node, packEdgeLabel(JVMTI_HEAP_REFERENCE_STACK_LOCAL, uint32_t(depth)) };
+	capture->edges.push_back(edge);
+	return root.node;
+}
+
+static jint JNICALL snapshotReferenceCallback(jvmtiHeapReferenceKind reference_kind, const jvmtiHeapReferenceInfo* reference_info,
+                                              jlong class_tag, jlong referrer_class_tag, jlong size, jlong* tag_ptr,
+                                              jlong* referrer_tag_ptr, jint length, void* user_data)
+{
+	auto capture = static_cast<SnapshotCapture*>(user_data);
+	HeapEdge edge;
+	uint32_t index = 0;
+	NodeId first;
+
+	if (graphNodeCount(capture->graph) >= kNoNode - 1)
+	{
+		return JVMTI_VISIT_ABORT;
+	}
+
+	switch (reference_kind)
+	{
+	case JVMTI_HEAP_REFERENCE_FIELD:
+	case JVMTI_HEAP_REFERENCE_STATIC_FIELD:
+		index = uint32_t(reference_info->field.index);
+		break;
+	case JVMTI_HEAP_REFERENCE_ARRAY_ELEMENT:
+		index = uint32_t(reference_info->array.index);
+		break;
+	case JVMTI_HEAP_REFERENCE_CONSTANT_POOL:
+		index = uint32_t(reference_info->constant_pool.index);
+		break;
+	default:
+		break;
+	}
+
+	if (referrer_tag_ptr != nullptr)
+	{
+		edge.from = snapshotNode(capture, referrer_tag_ptr, referrer_class_tag, 0);
+	}
+	else if (reference_kind == JVMTI_HEAP_REFERENCE_STACK_LOCAL)
+	{
+		const jvmtiHeapReferenceInfoStackLocal* local = &reference_info->stack_local;
+		edge.from = frameNode(capture, local->thread_tag, local->thread_id, local->depth, local->method, local->location);
+		index = uint32_t(local->slot);
+	}
+	else if (reference_kind == JVMTI_HEAP_REFERENCE_JNI_LOCAL)
+	{
+		const jvmtiHeapReferenceInfoJniLocal* local = &reference_info->jni_local;
+		edge.from = frameNode(capture, local->thread_tag, local->thread_id, local->depth, local->method, -1);
+	}
+	else
+	{
+		edge.from = kRootNode;
+	}
+	first = NodeId(graphNodeCount(capture->graph));
+	edge.to = snapshotNode(capture, tag_ptr, class_tag, size);
+	edge.label = packEdgeLabel(uint32_t(reference_kind), index);
+	if (edge.to >= first && capture->graph->flags[edge.to] == 0)
+	{
+		offerLargeObject(capture->largest, edge.to, *tag_ptr, uint32_t(class_tag), uint64_t(size), length);
+
+		const CollectionLayout* layout = collectionLayoutOf(&capture->collections, class_tag);
+		if (layout != nullptr)
+		{
+			noteCollection(&capture->collections, layout, edge.to, edge.from, edge.label);
+		}
+	}
+	if (reference_kind == JVMTI_HEAP_REFERENCE_FIELD)
+	{
+		const CollectionLayout* layout = collectionLayoutOf(&capture->collections, referrer_class_tag);
+		if (layout != nullptr && layout->backingField == jint(index))
+		{
+			noteCollectionBacking(&capture->collections, edge.from, edge.to, length, size);
+		}
+	}
+	capture->edges.push_back(edge);
+
+	return JVMTI_VISIT_OBJECTS;
+}
+
+/* Reads the size field of collections */
+static jint JNICALL snapshotFieldCallback(jvmtiHeapReferenceKind kind, const jvmtiHeapReferenceInfo* info, jlong object_class_tag,
+                                          jlong* object_tag_ptr, jvalue value, jvmtiPrimitiveType value_type, void* user_data)
+{
+	auto capture = static_cast<SnapshotCapture*>(user_data);
+	const CollectionLayout* layout = collectionLayoutOf(&capture->collections, object_class_tag);
+	NodeId node;
+
+	if (layout != nullptr && layout->sizeField == info->field.index && value_type == JVMTI_PRIMITIVE_TYPE_INT)
+	{
+		node = nodeOfTag(capture->graph, capture->generation, *object_tag_ptr);
+		if (node != kNoNode)
+		{
+			noteCollectionSize(&capture->collections, node, value.i);
+		}
+	}
+	return 0;
+}
+
+void captureHeapSnapshot(jvmtiEnv* jvmti, const ClassTable* classes, HeapSnapshot* snapshot)
+{
+	jvmtiError err;
+	jvmtiHeapCallbacks callbacks;
+	SnapshotCapture capture;
+
+	snapshotGeneration = (snapshotGeneration + 1) & kNodeGenerationMask;
+	snapshot->generation = snapshotGeneration;
+	snapshot->graph = HeapGraph();
+	snapshot->threads.clear();
+	snapshot->frames.clear();
+	clearLargestObjects(&snapshot->largest);
+
+	capture.graph = &snapshot->graph;
+	capture.generation = snapshot->generation;
+	capture.threads = &snapshot->threads;
+	capture.frames = &snapshot->frames;
+	capture.largest = &snapshot->largest;
+	initCollectionCapture(&capture.collections, classes, &snapshot->collections);
+	addNode(capture.graph, 0, 0, 0);
+
+	(void)memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.heap_reference_callback = &snapshotReferenceCallback;
+	callbacks.primitive_field_callback = &snapshotFieldCallback;
+
+	err = jvmti->FollowReferences(0, nullptr, nullptr, &callbacks, &capture);
+	check_jvmti_error(jvmti, err, "follow references");
+
+	/* Thread objects are reported as roots of their own before their
+	 *   locals, move them below the thread nodes */
+	std::unordered_map<NodeId, NodeId> threadObjects;
+	for (auto it = snapshot->threads.begin(); it != snapshot->threads.end(); ++it)
+	{
+		if (it->threadObject != kNoNode)
+		{
+			threadObjects[it->threadObject] = it->node;
+		}
+	}
+	for (auto it = capture.edges.begin(); it != capture.edges.end(); ++it)
+	{
+		if (it->from == kRootNode && edgeLabelKind(it->label) == JVMTI_HEAP_REFERENCE_THREAD)
+		{
+			auto thread = threadObjects.find(it->to);
+			if (thread != threadObjects.end())
+			{
+				it->from = thread->second;
+			}
+		}
+	}
+
+	buildGraphEdges(&snapshot->graph, capture.edges);
+	computeDominators(&snapshot->graph, &snapshot->dominators);
+}
+
+std::string describeObject(const ClassTable* classes, NodeId node, uint32_t class_id, uint8_t flags)
+{
+	if (node == kRootNode)
+	{
+		return "<roots>";
+	}
+	if ((flags & kNodeIsThread) != 0)
+	{
+		return "<thread>";
+	}
+	if ((flags & kNodeIsFrame) != 0)
+	{
+		return "<frame>";
+	}
+
+	std::string name = classNameOf(classes, class_id);
+	if ((flags & kNodeIsClass) != 0)
+	{
+		return "class " + name;
+	}
+	return name;
+}
+
+std::string describeReference(const ClassTable* classes, NodeId from, uint32_t from_class_id, uint8_t from_flags, uint32_t label)
+{
+	uint32_t kind = edgeLabelKind(label);
+	jint index = jint(edgeLabelIndex(label));
+
+	if (from == kRootNode || (from_flags & kNodeIsVirtual) != 0)
+	{
+		return std::string("<") + reference_kind_name(jvmtiHeapReferenceKind(kind)) + ">";
+	}
+	switch (kind)
+	{
+	case JVMTI_HEAP_REFERENCE_FIELD:
+	case JVMTI_HEAP_REFERENCE_STATIC_FIELD:
+		return fieldNameOf(classes, from_class_id, index);
+	case JVMTI_HEAP_REFERENCE_ARRAY_ELEMENT:
+		return "[" + std::to_string((long long)index) + "]";
+	default:
+		return reference_kind_name(jvmtiHeapReferenceKind(kind));
+	}
+}
+
+std::string describeNode(const HeapGraph* graph, const ClassTable* classes, NodeId node)
+{
+	return describeObject(classes, node, graph->classIds[node], graph->flags[node]);
+}
+
+std::string describeEdge(const HeapGraph* graph, const ClassTable* classes, NodeId from, uint32_t label)
+{
+	return describeReference(classes, from, graph->classIds[from], graph->flags[from], label);
+}
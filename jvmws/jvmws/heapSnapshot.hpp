@@ -0,0 +1,91 @@
+#pragma once
+
+
+#ifndef HEAP_SNAPSHOT_H
+#define HEAP_SNAPSHOT_H
+
+#include <jni.h>
+#include <ibmjvmti.h>
+
+#include <string>
+
+#include "heapGraph.hpp"
+#include "classTable.hpp"
+#include "largestObjects.hpp"
+#include "collectionOverhead.hpp"
+#include "analysisTags.hpp"
+
+/* A thread with stack or JNI local roots. Its node hangs below the root
+ *   and holds the thread object and one node per frame with roots, so
+ *   the dominator tree attributes what only the thread keeps alive. */
+typedef struct ThreadRoot
+{
+	NodeId node;
+	jlong threadId;
+
+	/* Node of the java.lang.Thread object, kNoNode when not known */
+	NodeId threadObject;
+} ThreadRoot;
+
+typedef struct FrameRoot
+{
+	NodeId node;
+
+	/* Index into HeapSnapshot::threads */
+	uint32_t thread;
+	jint depth;
+	jmethodID method;
+
+	/* Bytecode index, -1 for JNI local references */
+	jlocation location;
+} FrameRoot;
+
+/* Reachable object graph taken with one FollowReferences walk */
+typedef struct HeapSnapshot
+{
+	HeapGraph graph;
+	DominatorTree dominators;
+	std::vector<ThreadRoot> threads;
+	std::vector<FrameRoot> frames;
+
+	/* Collected while the walk creates the nodes */
+	LargestObjects largest;
+	CollectionCensus collections;
+
+	/* Generation of the node tags set by the walk */
+	jlong generation;
+} HeapSnapshot;
+
+/* Node of an object from its analysis tag, kNoNode unless it is a node tag
+ *   of the generation with an index inside the graph. A tag left by the
+ *   snapshot 4096 generations back can still name the wrong node, never
+ *   one outside the graph. */
+inline NodeId nodeOfTag(const HeapGraph* graph, jlong generation, jlong tag)
+{
+	if (!isNodeTagOf(tag, generation) || uint64_t(nodeTagIndex(tag)) >= uint64_t(graphNodeCount(graph)))
+	{
+		return kNoNode;
+	}
+	return NodeId(nodeTagIndex(tag));
+}
+
+/* Tags every reachable object with its node and builds the graph and its
+ *   dominator tree. The classes must have been tagged through the same
+ *   environment beforehand, objects of classes loaded since then get class
+ *   id 0. The collection layouts come from classes.
+ */
+void captureHeapSnapshot(jvmtiEnv* jvmti, const ClassTable* classes, HeapSnapshot* snapshot);
+
+/* "java.util.HashMap", or "class java.util.HashMap" for class objects,
+ *   "<thread>" and "<frame>" for the virtual thread root nodes */
+std::string describeNode(const HeapGraph* graph, const ClassTable* classes, NodeId node);
+
+/* The reference an edge stands for: a field name, "[index]" for array
+ *   elements, the root or reference kind otherwise */
+std::string describeEdge(const HeapGraph* graph, const ClassTable* classes, NodeId from, uint32_t label);
+
+/* The same from the node columns alone, for files decoded block by block */
+std::string describeObject(const ClassTable* classes, NodeId node, uint32_t class_id, uint8_t flags);
+std::string describeReference(const ClassTable* classes, NodeId from, uint32_t from_class_id, uint8_t from_flags, uint32_t label);
+
+#endif
@@ -0,0 +1,61 @@
+#include <algorithm>
+
+#include "largestObjects.hpp"
+
+/* Heap order of the lists: the object to drop first compares greatest.
+ *   Of two objects of the same size the later node goes first. */
+struct KeepsLarger
+{
+	bool operator()(const LargeObject& a, const LargeObject& b) const
+	{
+		if (a.size != b.size)
+		{
+			return a.size > b.size;
+		}
+		return a.node < b.node;
+	}
+};
+
+void clearLargestObjects(LargestObjects* largest)
+{
+	largest->objectCount = 0;
+	largest->arrayCount = 0;
+}
+
+static void offerTo(LargeObject* heap, uint32_t* count, const LargeObject& object)
+{
+	KeepsLarger order;
+
+	if (*count < kLargestObjects)
+	{
+		heap[(*count)++] = object;
+		std::push_heap(heap, heap + *count, order);
+	}
+	else if (order(object, heap[0]))
+	{
+		std::pop_heap(heap, heap + *count, order);
+		heap[*count - 1] = object;
+		std::push_heap(heap, heap + *count, order);
+	}
+}
+
+void offerLargeObject(LargestObjects* largest, NodeId node, jlong tag, uint32_t class_id, uint64_t size, jint length)
+{
+	LargeObject object = { node, tag, class_id, size, length };
+
+	if (length >= 0)
+	{
+		offerTo(largest->arrays, &largest->arrayCount, object);
+	}
+	else
+	{
+		offerTo(largest->objects, &largest->objectCount, object);
+	}
+}
+
+uint32_t sortLargestObjects(const LargeObject* heap, uint32_t count, LargeObject* sorted)
+{
+	std::copy(heap, heap + count, sorted);
+	std::sort(sorted, sorted + count, KeepsLarger());
+	return count;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+
+#ifndef LARGEST_OBJECTS_H
+#define LARGEST_OBJECTS_H
+
+#include <stdint.h>
+
+#include <jni.h>
+
+#include "heapGraph.hpp"
+
+/* The largest instances and the largest arrays seen by a heap walk. Each
+ *   list is a fixed min-heap with the smallest kept object on top, so an
+ *   object costs one comparison unless it displaces that one, O(log K)
+ *   then, and nothing is allocated during the walk.
+ */
+static const uint32_t kLargestObjects = 100;
+
+typedef struct LargeObject
+{
+	/* Node in the snapshot, its node tag stays on the object until the
+	 *   next capture */
+	NodeId node;
+
+	/* That tag as set on the object, with its age stamp; 0 for walks that
+	 *   tag nothing */
+	jlong tag;
+	uint32_t classId;
+	uint64_t size;
+
+	/* Array length, -1 for instances */
+	jint length;
+} LargeObject;
+
+typedef struct LargestObjects
+{
+	LargeObject objects[kLargestObjects];
+	uint32_t objectCount;
+	LargeObject arrays[kLargestObjects];
+	uint32_t arrayCount;
+} LargestObjects;
+
+void clearLargestObjects(LargestObjects* largest);
+
+void offerLargeObject(LargestObjects* largest, NodeId node, jlong tag, uint32_t class_id, uint64_t size, jint length);
+
+/* Copies a list out largest first, ties in node order. Returns the count. */
+uint32_t sortLargestObjects(const LargeObject* heap, uint32_t count, LargeObject* sorted);
+
+#endif
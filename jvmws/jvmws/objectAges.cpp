@@ -0,0 +1,214 @@
+#include <string.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "agent_util.hpp"
+#include "analysisTags.hpp"
+#include "objectAges.hpp"
+
+void initAgeTracker(AgeTracker* ages, bool available)
+{
+	ages->epoch.store(0);
+	ages->stamped.store(0);
+	ages->interval = 0;
+	ages->available = available;
+}
+
+void ageTrackerGcFinish(AgeTracker* ages)
+{
+	ages->epoch.fetch_add(1);
+}
+
+/* A new object carries no tag yet, the stamp is its whole tag */
+void stampSampledObject(jvmtiEnv* analysis, AgeTracker* ages, jobject object)
+{
+	if (analysis->SetTag(object, makeAgeStamp(ages->epoch.load())) == JVMTI_ERROR_NONE)
+	{
+		ages->stamped.fetch_add(1);
+	}
+}
+
+bool setAgeSampling(jvmtiEnv* jvmti, AgeTracker* ages, jint interval)
+{
+	jvmtiError err;
+
+	if (!ages->available)
+	{
+		return false;
+	}
+#ifdef JVMWS_SAMPLED_ALLOC
+	if (interval > 0)
+	{
+		err = jvmti->SetHeapSamplingInterval(interval);
+		check_jvmti_error(jvmti, err, "set heap sampling interval");
+	}
+	err = jvmti->SetEventNotificationMode(interval > 0 ? JVMTI_ENABLE : JVMTI_DISABLE, JVMTI_EVENT_SAMPLED_OBJECT_ALLOC, nullptr);
+	check_jvmti_error(jvmti, err, "set sampled object alloc notify");
+	ages->interval = interval > 0 ? interval : 0;
+	return true;
+#else
+	(void)jvmti;
+	(void)interval;
+	(void)err;
+	return false;
+#endif
+}
+
+uint32_t ageBucketOf(jlong age)
+{
+	uint32_t bucket = kAgeExactBuckets;
+
+	if (age < jlong(kAgeExactBuckets))
+	{
+		return uint32_t(age);
+	}
+	for (jlong limit = jlong(kAgeExactBuckets) * 2; age >= limit && bucket < kAgeBuckets - 1; limit *= 2)
+	{
+		bucket++;
+	}
+	return bucket;
+}
+
+static std::string ageBucketLabel(uint32_t bucket)
+{
+	if (bucket < kAgeExactBuckets)
+	{
+		return std::to_string((long long)bucket);
+	}
+	jlong low = jlong(kAgeExactBuckets) << (bucket - kAgeExactBuckets);
+	if (bucket == kAgeBuckets - 1)
+	{
+		return std::to_string((long long)low) + "+";
+	}
+	return std::to_string((long long)low) + "-" + std::to_string((long long)(low * 2 - 1));
+}
+
+typedef struct AgeScan
+{
+	uint32_t epoch;
+
+	/* By class tag then bucket */
+	std::vector<uint64_t> bytes;
+	std::vector<uint64_t> objects;
+	size_t classSlots;
+
+	WalkBudget* budget;
+} AgeScan;
+
+static jint JNICALL ageCallback(jlong class_tag, jlong size, jlong* tag_ptr, jint length, void* user_data)
+{
+	auto scan = static_cast<AgeScan*>(user_data);
+	jlong age = ageOfTag(*tag_ptr, scan->epoch);
+	size_t klass = isClassTag(class_tag) && size_t(class_tag) < scan->classSlots ? size_t(class_tag) : 0;
+
+	if (!spendWalkBudget(scan->budget, size))
+	{
+		return JVMTI_VISIT_ABORT;
+	}
+	if (age >= 0)
+	{
+		size_t slot = klass * kAgeBuckets + ageBucketOf(age);
+		scan->bytes[slot] += uint64_t(size);
+		scan->objects[slot]++;
+	}
+	return JVMTI_VISIT_OBJECTS;
+}
+
+typedef struct ClassAgeBytes
+{
+	size_t klass;
+	uint64_t bytes;
+	uint64_t objects;
+} ClassAgeBytes;
+
+static bool moreAgeBytes(const ClassAgeBytes& a, const ClassAgeBytes& b)
+{
+	return a.bytes > b.bytes;
+}
+
+jint reportObjectAges(jvmtiEnv* analysis, AgeTracker* ages, const ClassTable* classes, jint top, WalkBudget* budget)
+{
+	jvmtiHeapCallbacks callbacks;
+	jvmtiError err;
+	AgeScan scan;
+	uint64_t totalBytes[kAgeBuckets] = { 0 };
+	uint64_t totalObjects[kAgeBuckets] = { 0 };
+	uint64_t live = 0;
+	std::vector<ClassAgeBytes> ranked;
+
+	if (!ages->available)
+	{
+		stdout_message("Allocation sampling is not available in this VM\n");
+		return -1;
+	}
+
+	scan.epoch = ages->epoch.load();
+	scan.classSlots = classes->classes.size() + 1;
+	scan.bytes.assign(scan.classSlots * kAgeBuckets, 0);
+	scan.objects.assign(scan.classSlots * kAgeBuckets, 0);
+	scan.budget = budget;
+
+	/* Untagged objects are filtered out, only the stamped ones cost a call */
+	(void)memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.heap_iteration_callback = &ageCallback;
+	err = analysis->IterateThroughHeap(JVMTI_HEAP_FILTER_UNTAGGED, nullptr, &callbacks, &scan);
+	check_jvmti_error(analysis, err, "iterate through heap");
+	finishWalkBudget(budget);
+
+	for (size_t c = 0; c < scan.classSlots; ++c)
+	{
+		ClassAgeBytes entry = { c, 0, 0 };
+		for (uint32_t b = 0; b < kAgeBuckets; ++b)
+		{
+			entry.bytes += scan.bytes[c * kAgeBuckets + b];
+			entry.objects += scan.objects[c * kAgeBuckets + b];
+			totalBytes[b] += scan.bytes[c * kAgeBuckets + b];
+			totalObjects[b] += scan.objects[c * kAgeBuckets + b];
+		}
+		if (entry.objects > 0)
+		{
+			ranked.push_back(entry);
+			live += entry.objects;
+		}
+	}
+
+	stdout_message("Epoch %u, sampling %s, %lld allocations stamped, %lld still live\n", scan.epoch,
+	               ages->interval > 0 ? ("every " + std::to_string((long long)ages->interval) + " bytes").c_str() : "off",
+	               (long long)ages->stamped.load(), (long long)live);
+	stdout_message("Ages wrap after %d collections\n\n", int(kAgeEpochs));
+
+	stdout_message("Sampled objects by collections survived:\n");
+	stdout_message("    age        objects            bytes\n");
+	for (uint32_t b = 0; b < kAgeBuckets; ++b)
+	{
+		if (totalObjects[b] > 0)
+		{
+			stdout_message("  %7s %12lld %16lld\n", ageBucketLabel(b).c_str(), (long long)totalObjects[b],
+			               (long long)totalBytes[b]);
+		}
+	}
+
+	std::sort(ranked.begin(), ranked.end(), &moreAgeBytes);
+	size_t shown = std::min(ranked.size(), size_t(top > 0 ? top : 0));
+	stdout_message("\nClasses by sampled bytes:\n");
+	for (size_t i = 0; i < shown; ++i)
+	{
+		size_t c = ranked[i].klass;
+		std::string buckets;
+
+		for (uint32_t b = 0; b < kAgeBuckets; ++b)
+		{
+			uint64_t bytes = scan.bytes[c * kAgeBuckets + b];
+			if (bytes > 0)
+			{
+				buckets += " " + ageBucketLabel(b) + ":" + std::to_string((long long)bytes);
+			}
+		}
+		stdout_message(" %3d. %-50s objects %8lld, bytes %12lld, by age%s\n", int(i + 1),
+		               c == 0 ? "<unknown>" : classNameOf(classes, jlong(c)), (long long)ranked[i].objects,
+		               (long long)ranked[i].bytes, buckets.c_str());
+	}
+	return jint(live);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+
+#ifndef OBJECT_AGES_H
+#define OBJECT_AGES_H
+
+#include <atomic>
+
+#include <stdint.h>
+
+#include <jni.h>
+#include <ibmjvmti.h>
+
+#include "classTable.hpp"
+#include "walkBudget.hpp"
+
+/* SetHeapSamplingInterval and the SampledObjectAlloc event are only in the
+ *   jvmti.h of JDK 11 and later, whose version constants are enumerators
+ *   the preprocessor cannot test. Define JVMWS_SAMPLED_ALLOC when building
+ *   against those headers, without it age sampling is compiled out and
+ *   every VM is treated as unable to sample.
+ */
+/* Object ages from sampled allocations. SampledObjectAlloc events stamp
+ *   the allocated object with the current GC epoch in the age bits of its
+ *   analysis tag, GarbageCollectionFinish advances the epoch. Nothing is
+ *   allocated per object, so sampling can stay on. A report walks the
+ *   stamped objects and buckets their bytes per class by the number of
+ *   collections survived.
+ */
+static const uint32_t kAgeBuckets = 20;
+
+/* Ages 0..15 have a bucket each, the rest double: 16-31 .. 128+ */
+static const uint32_t kAgeExactBuckets = 16;
+
+typedef struct AgeTracker
+{
+	/* Collections finished since the agent loaded */
+	std::atomic<uint32_t> epoch;
+	std::atomic<uint64_t> stamped;
+
+	/* Mean bytes between samples, 0 while sampling is off */
+	jint interval;
+
+	/* Whether the VM grants can_generate_sampled_object_alloc_events */
+	bool available;
+} AgeTracker;
+
+void initAgeTracker(AgeTracker* ages, bool available);
+
+/* From the GC finish and sampled allocation events */
+void ageTrackerGcFinish(AgeTracker* ages);
+void stampSampledObject(jvmtiEnv* analysis, AgeTracker* ages, jobject object);
+
+/* Starts sampling every interval bytes on average, stops it for 0.
+ *   Returns false when the VM cannot sample allocations. */
+bool setAgeSampling(jvmtiEnv* jvmti, AgeTracker* ages, jint interval);
+
+uint32_t ageBucketOf(jlong age);
+
+/* Prints the survivor curve over all classes and the age histograms of
+ *   the classes with the most sampled bytes, of the objects walked before
+ *   the budget is spent. Returns the number of live stamped objects. */
+jint reportObjectAges(jvmtiEnv* analysis, AgeTracker* ages, const ClassTable* classes, jint top, WalkBudget* budget);
+
+#endif
@@ -0,0 +1,86 @@
+#include <chrono>
+#include <thread>
+
+#include "agent_util.hpp"
+#include "publishedSnapshot.hpp"
+
+void initSnapshotStore(SnapshotStore* store)
+{
+	store->current.store(nullptr);
+	store->epoch.store(0);
+	store->pinning[0].store(0);
+	store->pinning[1].store(0);
+	store->sequence = 0;
+}
+
+PublishedSnapshot* acquireSnapshot(SnapshotStore* store)
+{
+	PublishedSnapshot* published;
+	uint32_t parity = store->epoch.load() & 1;
+
+	/* The pointer may be swapped right after the load, the pin keeps the
+	 *   publisher from dropping its reference before ours is counted */
+	store->pinning[parity].fetch_add(1);
+	published = store->current.load();
+	if (published != nullptr)
+	{
+		published->references.fetch_add(1);
+	}
+	store->pinning[parity].fetch_sub(1);
+	return published;
+}
+
+void releaseSnapshot(PublishedSnapshot* published)
+{
+	if (published != nullptr && published->references.fetch_sub(1) == 1)
+	{
+		delete published;
+	}
+}
+
+/* Swaps in the next snapshot and drops the reference held by the previous
+ *   publication once no reader can be about to take one */
+static void replaceSnapshot(SnapshotStore* store, PublishedSnapshot* next)
+{
+	PublishedSnapshot* previous = store->current.exchange(next);
+	uint32_t parity;
+
+	if (previous != nullptr)
+	{
+		/* A reader that loaded previous pinned before the exchange, on
+		 *   either counter. Each is drained once after flipping the epoch
+		 *   away from it, new readers pin the other one meanwhile. */
+		for (int phase = 0; phase < 2; ++phase)
+		{
+			parity = store->epoch.fetch_add(1) & 1;
+			while (store->pinning[parity].load() != 0)
+			{
+				std::this_thread::yield();
+			}
+		}
+		releaseSnapshot(previous);
+	}
+}
+
+PublishedSnapshot* publishSnapshot(SnapshotStore* store, PublishedSnapshot* published)
+{
+	published->sequence = ++store->sequence;
+	published->publishedAt = jlong(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+
+	/* One reference for the publication, one for the caller */
+	published->references.store(2);
+	replaceSnapshot(store, published);
+	return published;
+}
+
+const IncomingEdges* snapshotIncomingEdges(PublishedSnapshot* published)
+{
+	std::call_once(published->incomingOnce, &buildIncomingEdges, &published->snapshot.graph, &published->incoming);
+	return &published->incoming;
+}
+
+void clearSnapshotStore(SnapshotStore* store)
+{
+	replaceSnapshot(store, nullptr);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+
+#ifndef PUBLISHED_SNAPSHOT_H
+#define PUBLISHED_SNAPSHOT_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include <stdint.h>
+
+#include "classTable.hpp"
+#include "heapSnapshot.hpp"
+
+/* Snapshots shared with any number of reader threads, RCU style. A
+ *   snapshot is immutable once published and holds the class table it was
+ *   taken with; snapshots taken while no class changed share one copy.
+ *   Readers pin the current one with a reference count and never wait.
+ *   Publishing swaps the pointer, waits for the readers that are between
+ *   loading it and counting their reference, then drops the reference of
+ *   the publication; the last reader frees it. Readers pin one of two
+ *   counters by the parity of the epoch, the publisher flips it before
+ *   draining each, so a stream of new readers cannot keep it waiting.
+ */
+typedef struct PublishedSnapshot
+{
+	HeapSnapshot snapshot;
+	std::shared_ptr<const ClassTable> classes;
+
+	/* Publication number, 1 for the first */
+	uint64_t sequence;
+
+	/* Steady clock nanoseconds when it was published */
+	jlong publishedAt;
+
+	std::atomic<uint32_t> references;
+
+	/* Referrer index, built by the first reader that asks for it */
+	std::once_flag incomingOnce;
+	IncomingEdges incoming;
+} PublishedSnapshot;
+
+typedef struct SnapshotStore
+{
+	std::atomic<PublishedSnapshot*> current;
+
+	/* Readers inside acquireSnapshot, by epoch parity */
+	std::atomic<uint32_t> epoch;
+	std::atomic<uint32_t> pinning[2];
+	uint64_t sequence;
+} SnapshotStore;
+
+void initSnapshotStore(SnapshotStore* store);
+
+/* The current snapshot with a reference for the caller, nullptr before the
+ *   first publication. Lock free. */
+PublishedSnapshot* acquireSnapshot(SnapshotStore* store);
+void releaseSnapshot(PublishedSnapshot* published);
+
+/* Makes the snapshot current and returns it with a reference for the
+ *   caller. Publishers must not run concurrently. */
+PublishedSnapshot* publishSnapshot(SnapshotStore* store, PublishedSnapshot* published);
+
+/* Incoming edges of the snapshot graph, built once on first use */
+const IncomingEdges* snapshotIncomingEdges(PublishedSnapshot* published);
+
+/* Unpublishes the current snapshot, readers keep theirs */
+void clearSnapshotStore(SnapshotStore* store);
+
+#endif
@@ -0,0 +1,1127 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <unordered_map>
+#include <algorithm>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "agent_util.hpp"
+#include "snapshotFile.hpp"
+
+static const char kHeaderMagic[8] = { 'J', 'V', 'M', 'W', 'S', 'N', 'A', 'P' };
+static const char kTrailerMagic[8] = { 'J', 'V', 'M', 'W', 'S', 'E', 'N', 'D' };
+static const size_t kHeaderSize = 16;
+static const size_t kBlockHeaderSize = 12;
+static const size_t kTrailerSize = 24;
+
+/* Strings and classes per block */
+static const uint32_t kTableBlockItems = 4096;
+
+/* CRC-32C, reflected, table driven */
+typedef struct Crc32cTable
+{
+	uint32_t entries[256];
+
+	Crc32cTable()
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t c = i;
+			for (auto k = 0; k < 8; ++k)
+			{
+				c = (c & 1) != 0 ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+			}
+			entries[i] = c;
+		}
+	}
+} Crc32cTable;
+
+static uint32_t crc32c(const uint8_t* data, size_t length)
+{
+	static const Crc32cTable table;
+
+	uint32_t crc = 0xFFFFFFFFu;
+	for (size_t i = 0; i < length; ++i)
+	{
+		crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc ^ 0xFFFFFFFFu;
+}
+
+static void putVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back(uint8_t(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(uint8_t(value));
+}
+
+/* Small magnitudes of either sign to small varints */
+static uint64_t zigzag(int64_t value)
+{
+	return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+	return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+static void putSigned(std::vector<uint8_t>& out, int64_t value)
+{
+	putVarint(out, zigzag(value));
+}
+
+static void putFixed(std::vector<uint8_t>& out, uint64_t value, int bytes)
+{
+	for (auto i = 0; i < bytes; ++i)
+	{
+		out.push_back(uint8_t(value >> (8 * i)));
+	}
+}
+
+static uint64_t getFixed(const uint8_t* p, int bytes)
+{
+	uint64_t value = 0;
+	for (auto i = 0; i < bytes; ++i)
+	{
+		value |= uint64_t(p[i]) << (8 * i);
+	}
+	return value;
+}
+
+/* Bounds checked varint reader, ok turns false on truncated data */
+typedef struct BlockReader
+{
+	const uint8_t* p;
+	const uint8_t* end;
+	bool ok;
+} BlockReader;
+
+static uint64_t getVarint(BlockReader* in)
+{
+	uint64_t value = 0;
+
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (in->p >= in->end)
+		{
+			in->ok = false;
+			return 0;
+		}
+		uint8_t b = *in->p++;
+		value |= uint64_t(b & 0x7F) << shift;
+		if ((b & 0x80) == 0)
+		{
+			return value;
+		}
+	}
+	in->ok = false;
+	return 0;
+}
+
+static int64_t getSigned(BlockReader* in)
+{
+	return unzigzag(getVarint(in));
+}
+
+static uint8_t getByte(BlockReader* in)
+{
+	if (in->p >= in->end)
+	{
+		in->ok = false;
+		return 0;
+	}
+	return *in->p++;
+}
+
+static std::string getString(BlockReader* in)
+{
+	uint64_t length = getVarint(in);
+	if (!in->ok || length > uint64_t(in->end - in->p))
+	{
+		in->ok = false;
+		return std::string();
+	}
+	std::string text(reinterpret_cast<const char*>(in->p), size_t(length));
+	in->p += length;
+	return text;
+}
+
+/* Writing */
+
+struct RetainedOrder
+{
+	const DominatorTree* tree;
+
+	bool operator()(NodeId a, NodeId b) const
+	{
+		return tree->retained[a] > tree->retained[b];
+	}
+};
+
+typedef struct SnapshotWriter
+{
+	FILE* out;
+	uint64_t offset;
+	bool ok;
+	std::vector<SnapshotSection> sections;
+	std::vector<uint8_t> block;
+} SnapshotWriter;
+
+static void writeBytes(SnapshotWriter* writer, const void* data, size_t length)
+{
+	if (writer->ok && fwrite(data, 1, length, writer->out) != length)
+	{
+		writer->ok = false;
+	}
+	writer->offset += length;
+}
+
+static void beginSection(SnapshotWriter* writer, uint32_t type, uint64_t items)
+{
+	SnapshotSection section;
+	section.type = type;
+	section.items = items;
+	writer->sections.push_back(section);
+}
+
+/* Appends writer->block as the next block of the current section */
+static void flushBlock(SnapshotWriter* writer, uint32_t items)
+{
+	std::vector<uint8_t> header;
+
+	putFixed(header, items, 4);
+	putFixed(header, writer->block.size(), 4);
+	putFixed(header, crc32c(writer->block.data(), writer->block.size()), 4);
+
+	writer->sections.back().blocks.push_back(writer->offset);
+	writeBytes(writer, header.data(), header.size());
+	writeBytes(writer, writer->block.data(), writer->block.size());
+	writer->block.clear();
+}
+
+static uint32_t internString(std::unordered_map<std::string, uint32_t>& ids, std::vector<const std::string*>& strings,
+                             const std::string& text)
+{
+	auto it = ids.find(text);
+	if (it != ids.end())
+	{
+		return it->second;
+	}
+	uint32_t id = uint32_t(strings.size());
+	it = ids.insert(std::make_pair(text, id)).first;
+	strings.push_back(&it->first);
+	return id;
+}
+
+static void writeTables(SnapshotWriter* writer, const ClassTable* classes)
+{
+	std::unordered_map<std::string, uint32_t> ids;
+	std::vector<const std::string*> strings;
+
+	for (auto c = classes->classes.begin(); c != classes->classes.end(); ++c)
+	{
+		internString(ids, strings, c->signature);
+		internString(ids, strings, c->name);
+		for (auto f = c->fields.begin(); f != c->fields.end(); ++f)
+		{
+			internString(ids, strings, f->name);
+		}
+	}
+
+	beginSection(writer, kSectionStrings, strings.size());
+	for (size_t i = 0; i < strings.size(); ++i)
+	{
+		putVarint(writer->block, strings[i]->size());
+		writer->block.insert(writer->block.end(), strings[i]->begin(), strings[i]->end());
+		if ((i + 1) % kTableBlockItems == 0 || i + 1 == strings.size())
+		{
+			flushBlock(writer, uint32_t(i % kTableBlockItems + 1));
+		}
+	}
+
+	beginSection(writer, kSectionClasses, classes->classes.size());
+	for (size_t i = 0; i < classes->classes.size(); ++i)
+	{
+		const ClassInfo* info = &classes->classes[i];
+
+		putVarint(writer->block, ids[info->signature]);
+		putVarint(writer->block, ids[info->name]);
+		writer->block.push_back(uint8_t((info->isArray ? 1 : 0) | (info->isInterface ? 2 : 0) | (info->fieldsResolved ? 4 : 0)));
+		writer->block.push_back(uint8_t(info->primitiveArrayType));
+		putVarint(writer->block, uint64_t(info->interfaceFieldCount));
+		putVarint(writer->block, uint64_t(info->declaredFieldCount));
+		putVarint(writer->block, info->interfaces.size());
+		for (auto it = info->interfaces.begin(); it != info->interfaces.end(); ++it)
+		{
+			putVarint(writer->block, uint64_t(*it));
+		}
+		putVarint(writer->block, info->fields.size());
+		for (auto f = info->fields.begin(); f != info->fields.end(); ++f)
+		{
+			putVarint(writer->block, ids[f->name]);
+			putVarint(writer->block, uint64_t(f->declaringClassTag));
+			writer->block.push_back(uint8_t(f->type));
+			writer->block.push_back(uint8_t(f->isStatic ? 1 : 0));
+		}
+		if ((i + 1) % kTableBlockItems == 0 || i + 1 == classes->classes.size())
+		{
+			flushBlock(writer, uint32_t(i % kTableBlockItems + 1));
+		}
+	}
+}
+
+static void writeGraph(SnapshotWriter* writer, const HeapSnapshot* snapshot)
+{
+	const HeapGraph* graph = &snapshot->graph;
+	const DominatorTree* tree = &snapshot->dominators;
+	size_t nodes = graphNodeCount(graph);
+	std::vector<std::pair<NodeId, uint32_t> > sorted;
+
+	beginSection(writer, kSectionNodes, nodes);
+	for (size_t first = 0; first < nodes; first += kSnapshotBlockNodes)
+	{
+		size_t last = std::min(nodes, first + kSnapshotBlockNodes);
+		for (size_t n = first; n < last; ++n)
+		{
+			putVarint(writer->block, graph->classIds[n]);
+		}
+		for (size_t n = first; n < last; ++n)
+		{
+			putVarint(writer->block, graph->sizes[n]);
+		}
+		writer->block.insert(writer->block.end(), graph->flags.begin() + first, graph->flags.begin() + last);
+		flushBlock(writer, uint32_t(last - first));
+	}
+
+	beginSection(writer, kSectionEdges, graph->edgeTargets.size());
+	for (size_t first = 0; first < nodes; first += kSnapshotBlockNodes)
+	{
+		size_t last = std::min(nodes, first + kSnapshotBlockNodes);
+		for (size_t n = first; n < last; ++n)
+		{
+			sorted.clear();
+			for (uint64_t e = graph->edgeStarts[n]; e < graph->edgeStarts[n + 1]; ++e)
+			{
+				sorted.push_back(std::make_pair(graph->edgeTargets[e], graph->edgeLabels[e]));
+			}
+			std::sort(sorted.begin(), sorted.end());
+
+			putVarint(writer->block, sorted.size());
+			for (size_t i = 0; i < sorted.size(); ++i)
+			{
+				if (i == 0)
+				{
+					putSigned(writer->block, int64_t(sorted[i].first) - int64_t(n));
+				}
+				else
+				{
+					putVarint(writer->block, sorted[i].first - sorted[i - 1].first);
+				}
+				putVarint(writer->block, sorted[i].second);
+			}
+		}
+		flushBlock(writer, uint32_t(last - first));
+	}
+
+	if (tree->idom.size() == nodes)
+	{
+		beginSection(writer, kSectionDominators, nodes);
+		for (size_t first = 0; first < nodes; first += kSnapshotBlockNodes)
+		{
+			size_t last = std::min(nodes, first + kSnapshotBlockNodes);
+			for (size_t n = first; n < last; ++n)
+			{
+				/* 0 for no dominator, else the zigzag distance back plus one,
+				 *   thread and frame nodes come after what they dominate */
+				putVarint(writer->block, tree->idom[n] == kNoNode ? 0 : zigzag(int64_t(n) - int64_t(tree->idom[n])) + 1);
+			}
+			for (size_t n = first; n < last; ++n)
+			{
+				putVarint(writer->block, tree->retained[n]);
+			}
+			flushBlock(writer, uint32_t(last - first));
+		}
+	}
+}
+
+static void writeIndexes(SnapshotWriter* writer, const HeapSnapshot* snapshot)
+{
+	const HeapGraph* graph = &snapshot->graph;
+	const DominatorTree* tree = &snapshot->dominators;
+	size_t nodes = graphNodeCount(graph);
+	ShortestPaths paths;
+
+	computeShortestPaths(graph, &paths);
+	beginSection(writer, kSectionParents, nodes);
+	for (size_t first = 0; first < nodes; first += kSnapshotBlockNodes)
+	{
+		size_t last = std::min(nodes, first + kSnapshotBlockNodes);
+		for (size_t n = first; n < last; ++n)
+		{
+			NodeId parent = paths.parent[n];
+			if (parent == kNoNode)
+			{
+				putVarint(writer->block, 0);
+				continue;
+			}
+			/* Zigzag distance plus one, 0 stands for no parent */
+			putVarint(writer->block, zigzag(int64_t(n) - int64_t(parent)) + 1);
+			putVarint(writer->block, graph->edgeLabels[paths.parentEdge[n]]);
+		}
+		flushBlock(writer, uint32_t(last - first));
+	}
+	std::vector<NodeId>().swap(paths.parent);
+	std::vector<uint64_t>().swap(paths.parentEdge);
+
+	/* Instances by class id, a counting sort keeps them in node order */
+	std::vector<uint64_t> classStarts;
+	for (size_t n = 1; n < nodes; ++n)
+	{
+		if ((graph->flags[n] & (kNodeIsClass | kNodeIsVirtual)) == 0)
+		{
+			if (graph->classIds[n] + size_t(2) > classStarts.size())
+			{
+				classStarts.resize(graph->classIds[n] + size_t(2), 0);
+			}
+			classStarts[graph->classIds[n] + 1]++;
+		}
+	}
+	for (size_t c = 1; c < classStarts.size(); ++c)
+	{
+		classStarts[c] += classStarts[c - 1];
+	}
+	std::vector<NodeId> instances(classStarts.empty() ? 0 : size_t(classStarts.back()));
+	{
+		std::vector<uint64_t> next(classStarts);
+		for (size_t n = 1; n < nodes; ++n)
+		{
+			if ((graph->flags[n] & (kNodeIsClass | kNodeIsVirtual)) == 0)
+			{
+				instances[size_t(next[graph->classIds[n]]++)] = NodeId(n);
+			}
+		}
+	}
+	beginSection(writer, kSectionClassIndex, instances.size());
+	for (size_t c = 0; c + 1 < classStarts.size(); ++c)
+	{
+		NodeId previous = 0;
+		for (uint64_t i = classStarts[c]; i < classStarts[c + 1]; ++i)
+		{
+			putVarint(writer->block, instances[size_t(i)] - previous);
+			previous = instances[size_t(i)];
+		}
+		flushBlock(writer, uint32_t(classStarts[c + 1] - classStarts[c]));
+	}
+	std::vector<NodeId>().swap(instances);
+
+	if (tree->retained.size() == nodes)
+	{
+		std::vector<NodeId> largest;
+		for (size_t n = 1; n < nodes; ++n)
+		{
+			if ((graph->flags[n] & kNodeIsVirtual) == 0)
+			{
+				largest.push_back(NodeId(n));
+			}
+		}
+		size_t kept = std::min(largest.size(), size_t(kRetainedIndexNodes));
+		RetainedOrder order = { tree };
+		std::partial_sort(largest.begin(), largest.begin() + kept, largest.end(), order);
+
+		beginSection(writer, kSectionRetainedIndex, kept);
+		for (size_t i = 0; i < kept; ++i)
+		{
+			putVarint(writer->block, largest[i]);
+		}
+		flushBlock(writer, uint32_t(kept));
+	}
+}
+
+static void writeThreads(SnapshotWriter* writer, const HeapSnapshot* snapshot)
+{
+	beginSection(writer, kSectionThreads, snapshot->threads.size());
+
+	putVarint(writer->block, snapshot->threads.size());
+	for (auto it = snapshot->threads.begin(); it != snapshot->threads.end(); ++it)
+	{
+		putVarint(writer->block, it->node);
+		putSigned(writer->block, it->threadId);
+		putVarint(writer->block, uint64_t(it->threadObject) + 1);
+	}
+	putVarint(writer->block, snapshot->frames.size());
+	for (auto it = snapshot->frames.begin(); it != snapshot->frames.end(); ++it)
+	{
+		putVarint(writer->block, it->node);
+		putVarint(writer->block, it->thread);
+		putSigned(writer->block, it->depth);
+		putSigned(writer->block, it->location);
+	}
+	flushBlock(writer, uint32_t(snapshot->threads.size()));
+}
+
+static void writeDirectory(SnapshotWriter* writer)
+{
+	std::vector<uint8_t> directory;
+	std::vector<uint8_t> trailer;
+	uint64_t offset = writer->offset;
+
+	putVarint(directory, writer->sections.size());
+	for (auto it = writer->sections.begin(); it != writer->sections.end(); ++it)
+	{
+		putVarint(directory, it->type);
+		putVarint(directory, it->items);
+		putVarint(directory, it->blocks.size());
+		uint64_t previous = 0;
+		for (auto b = it->blocks.begin(); b != it->blocks.end(); ++b)
+		{
+			putVarint(directory, *b - previous);
+			previous = *b;
+		}
+	}
+
+	putFixed(trailer, offset, 8);
+	putFixed(trailer, directory.size(), 4);
+	putFixed(trailer, crc32c(directory.data(), directory.size()), 4);
+	trailer.insert(trailer.end(), kTrailerMagic, kTrailerMagic + sizeof(kTrailerMagic));
+
+	writeBytes(writer, directory.data(), directory.size());
+	writeBytes(writer, trailer.data(), trailer.size());
+}
+
+bool writeSnapshotFile(const char* path, const HeapSnapshot* snapshot, const ClassTable* classes)
+{
+	SnapshotWriter writer;
+	std::vector<uint8_t> header;
+
+	writer.offset = 0;
+	writer.ok = true;
+#if defined(_MSC_VER)
+	if (fopen_s(&writer.out, path, "wb") != 0)
+	{
+		writer.out = nullptr;
+	}
+#else
+	writer.out = fopen(path, "wb");
+#endif
+	if (writer.out == nullptr)
+	{
+		stdout_message("ERROR: cannot create snapshot file %s\n", path);
+		return false;
+	}
+	setvbuf(writer.out, nullptr, _IOFBF, 1 << 20);
+
+	header.insert(header.end(), kHeaderMagic, kHeaderMagic + sizeof(kHeaderMagic));
+	putFixed(header, kSnapshotFileVersion, 4);
+	putFixed(header, 0, 4);
+	writeBytes(&writer, header.data(), header.size());
+
+	writeTables(&writer, classes);
+	writeGraph(&writer, snapshot);
+	writeThreads(&writer, snapshot);
+	writeIndexes(&writer, snapshot);
+	writeDirectory(&writer);
+
+	if (fclose(writer.out) != 0)
+	{
+		writer.ok = false;
+	}
+	if (!writer.ok)
+	{
+		stdout_message("ERROR: cannot write snapshot file %s\n", path);
+	}
+	return writer.ok;
+}
+
+/* Reading */
+
+static bool fail(SnapshotFile* file, const char* reason)
+{
+	file->error = reason;
+	return false;
+}
+
+static bool mapFile(const char* path, SnapshotFile* file)
+{
+#if defined(_WIN32)
+	HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	LARGE_INTEGER size;
+
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return fail(file, "cannot open file");
+	}
+	if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(handle);
+		return fail(file, "cannot read file size");
+	}
+	HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		CloseHandle(handle);
+		return fail(file, "cannot map file");
+	}
+	file->data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (file->data == nullptr)
+	{
+		CloseHandle(mapping);
+		CloseHandle(handle);
+		return fail(file, "cannot map file");
+	}
+	file->size = size_t(size.QuadPart);
+	file->file = handle;
+	file->mapping = mapping;
+#else
+	struct stat info;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+	{
+		return fail(file, "cannot open file");
+	}
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return fail(file, "cannot read file size");
+	}
+	void* data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		return fail(file, "cannot map file");
+	}
+	file->data = static_cast<const uint8_t*>(data);
+	file->size = size_t(info.st_size);
+#endif
+	return true;
+}
+
+void closeSnapshotFile(SnapshotFile* file)
+{
+	if (file->data != nullptr)
+	{
+#if defined(_WIN32)
+		UnmapViewOfFile(file->data);
+		CloseHandle(static_cast<HANDLE>(file->mapping));
+		CloseHandle(static_cast<HANDLE>(file->file));
+#else
+		munmap(const_cast<uint8_t*>(file->data), file->size);
+#endif
+	}
+	file->data = nullptr;
+	file->size = 0;
+	file->file = nullptr;
+	file->mapping = nullptr;
+	file->sections.clear();
+}
+
+bool openSnapshotFile(const char* path, SnapshotFile* file)
+{
+	file->data = nullptr;
+	file->size = 0;
+	file->file = nullptr;
+	file->mapping = nullptr;
+	file->sections.clear();
+	file->error.clear();
+
+	if (!mapFile(path, file))
+	{
+		return false;
+	}
+	if (file->size < kHeaderSize + kTrailerSize || memcmp(file->data, kHeaderMagic, sizeof(kHeaderMagic)) != 0 ||
+		memcmp(file->data + file->size - sizeof(kTrailerMagic), kTrailerMagic, sizeof(kTrailerMagic)) != 0)
+	{
+		closeSnapshotFile(file);
+		return fail(file, "not a snapshot file");
+	}
+	file->version = uint32_t(getFixed(file->data + 8, 4));
+	if (file->version != kSnapshotFileVersion)
+	{
+		closeSnapshotFile(file);
+		return fail(file, "unsupported snapshot file version");
+	}
+
+	const uint8_t* trailer = file->data + file->size - kTrailerSize;
+	uint64_t offset = getFixed(trailer, 8);
+	uint64_t length = getFixed(trailer + 8, 4);
+	if (offset + length != file->size - kTrailerSize ||
+		crc32c(file->data + offset, size_t(length)) != uint32_t(getFixed(trailer + 12, 4)))
+	{
+		closeSnapshotFile(file);
+		return fail(file, "corrupt snapshot directory");
+	}
+
+	BlockReader in = { file->data + offset, file->data + offset + length, true };
+	uint64_t count = getVarint(&in);
+	for (uint64_t s = 0; s < count && in.ok; ++s)
+	{
+		SnapshotSection section;
+		section.type = uint32_t(getVarint(&in));
+		section.items = getVarint(&in);
+		uint64_t blocks = getVarint(&in);
+		uint64_t previous = 0;
+		for (uint64_t b = 0; b < blocks && in.ok; ++b)
+		{
+			previous += getVarint(&in);
+			section.blocks.push_back(previous);
+		}
+		file->sections.push_back(section);
+	}
+	if (!in.ok)
+	{
+		closeSnapshotFile(file);
+		return fail(file, "corrupt snapshot directory");
+	}
+	return true;
+}
+
+static const SnapshotSection* findSection(const SnapshotFile* file, uint32_t type)
+{
+	for (auto it = file->sections.begin(); it != file->sections.end(); ++it)
+	{
+		if (it->type == type)
+		{
+			return &*it;
+		}
+	}
+	return nullptr;
+}
+
+uint64_t snapshotNodeCount(const SnapshotFile* file)
+{
+	const SnapshotSection* section = findSection(file, kSectionNodes);
+	return section != nullptr ? section->items : 0;
+}
+
+/* Checks a block and positions a reader on its data */
+static bool openBlock(SnapshotFile* file, uint32_t type, uint32_t block, BlockReader* in, uint32_t* items)
+{
+	const SnapshotSection* section = findSection(file, type);
+
+	if (section == nullptr || block >= section->blocks.size())
+	{
+		return fail(file, "no such snapshot block");
+	}
+
+	uint64_t offset = section->blocks[block];
+	if (offset + kBlockHeaderSize > file->size)
+	{
+		return fail(file, "corrupt snapshot block");
+	}
+	const uint8_t* header = file->data + offset;
+	uint64_t length = getFixed(header + 4, 4);
+	if (offset + kBlockHeaderSize + length > file->size ||
+		crc32c(header + kBlockHeaderSize, size_t(length)) != uint32_t(getFixed(header + 8, 4)))
+	{
+		return fail(file, "corrupt snapshot block");
+	}
+
+	*items = uint32_t(getFixed(header, 4));
+	in->p = header + kBlockHeaderSize;
+	in->end = in->p + length;
+	in->ok = true;
+	return true;
+}
+
+static bool closeBlock(SnapshotFile* file, const BlockReader* in)
+{
+	return in->ok ? true : fail(file, "truncated snapshot block");
+}
+
+bool readSnapshotNodes(SnapshotFile* file, uint32_t block, SnapshotNodes* nodes)
+{
+	BlockReader in;
+	uint32_t count;
+
+	if (!openBlock(file, kSectionNodes, block, &in, &count))
+	{
+		return false;
+	}
+
+	nodes->first = block * kSnapshotBlockNodes;
+	nodes->classIds.resize(count);
+	nodes->sizes.resize(count);
+	nodes->flags.resize(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		nodes->classIds[i] = uint32_t(getVarint(&in));
+	}
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		nodes->sizes[i] = getVarint(&in);
+	}
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		nodes->flags[i] = getByte(&in);
+	}
+	return closeBlock(file, &in);
+}
+
+bool readSnapshotEdges(SnapshotFile* file, uint32_t block, SnapshotEdges* edges)
+{
+	BlockReader in;
+	uint32_t count;
+
+	if (!openBlock(file, kSectionEdges, block, &in, &count))
+	{
+		return false;
+	}
+
+	edges->first = block * kSnapshotBlockNodes;
+	edges->edgeStarts.assign(1, 0);
+	edges->edgeTargets.clear();
+	edges->edgeLabels.clear();
+	for (uint32_t i = 0; i < count && in.ok; ++i)
+	{
+		int64_t node = int64_t(edges->first) + i;
+		uint64_t degree = getVarint(&in);
+		NodeId target = 0;
+
+		for (uint64_t e = 0; e < degree && in.ok; ++e)
+		{
+			target = e == 0 ? NodeId(node + getSigned(&in)) : NodeId(target + getVarint(&in));
+			edges->edgeTargets.push_back(target);
+			edges->edgeLabels.push_back(uint32_t(getVarint(&in)));
+		}
+		edges->edgeStarts.push_back(edges->edgeTargets.size());
+	}
+	return closeBlock(file, &in);
+}
+
+bool readSnapshotDominators(SnapshotFile* file, uint32_t block, SnapshotDominators* dominators)
+{
+	BlockReader in;
+	uint32_t count;
+
+	if (!openBlock(file, kSectionDominators, block, &in, &count))
+	{
+		return false;
+	}
+
+	dominators->first = block * kSnapshotBlockNodes;
+	dominators->idom.resize(count);
+	dominators->retained.resize(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint64_t back = getVarint(&in);
+		dominators->idom[i] = back == 0 ? kNoNode : NodeId(int64_t(dominators->first + i) - unzigzag(back - 1));
+	}
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		dominators->retained[i] = getVarint(&in);
+	}
+	return closeBlock(file, &in);
+}
+
+bool readSnapshotParents(SnapshotFile* file, uint32_t block, SnapshotParents* parents)
+{
+	BlockReader in;
+	uint32_t count;
+
+	if (!openBlock(file, kSectionParents, block, &in, &count))
+	{
+		return false;
+	}
+
+	parents->first = block * kSnapshotBlockNodes;
+	parents->parent.assign(count, kNoNode);
+	parents->label.assign(count, 0);
+	for (uint32_t i = 0; i < count && in.ok; ++i)
+	{
+		uint64_t back = getVarint(&in);
+		if (back != 0)
+		{
+			parents->parent[i] = NodeId(int64_t(parents->first + i) - unzigzag(back - 1));
+			parents->label[i] = uint32_t(getVarint(&in));
+		}
+	}
+	return closeBlock(file, &in);
+}
+
+bool readSnapshotInstances(SnapshotFile* file, uint32_t class_id, std::vector<NodeId>* nodes)
+{
+	const SnapshotSection* section = findSection(file, kSectionClassIndex);
+	BlockReader in;
+	uint32_t count;
+
+	nodes->clear();
+	if (section == nullptr)
+	{
+		return fail(file, "no instance index");
+	}
+	if (class_id >= section->blocks.size())
+	{
+		return true;
+	}
+	if (!openBlock(file, kSectionClassIndex, class_id, &in, &count))
+	{
+		return false;
+	}
+
+	NodeId node = 0;
+	nodes->reserve(count);
+	for (uint32_t i = 0; i < count && in.ok; ++i)
+	{
+		node += NodeId(getVarint(&in));
+		nodes->push_back(node);
+	}
+	return closeBlock(file, &in);
+}
+
+bool readSnapshotTopRetained(SnapshotFile* file, std::vector<NodeId>* nodes)
+{
+	BlockReader in;
+	uint32_t count;
+
+	nodes->clear();
+	if (!openBlock(file, kSectionRetainedIndex, 0, &in, &count))
+	{
+		return false;
+	}
+	nodes->reserve(count);
+	for (uint32_t i = 0; i < count && in.ok; ++i)
+	{
+		nodes->push_back(NodeId(getVarint(&in)));
+	}
+	return closeBlock(file, &in);
+}
+
+static bool loadStrings(SnapshotFile* file, std::vector<std::string>* strings)
+{
+	const SnapshotSection* section = findSection(file, kSectionStrings);
+
+	strings->clear();
+	if (section == nullptr)
+	{
+		return fail(file, "no string table");
+	}
+	for (uint32_t b = 0; b < section->blocks.size(); ++b)
+	{
+		BlockReader in;
+		uint32_t count;
+
+		if (!openBlock(file, kSectionStrings, b, &in, &count))
+		{
+			return false;
+		}
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			strings->push_back(getString(&in));
+		}
+		if (!closeBlock(file, &in))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static const std::string& stringAt(const std::vector<std::string>& strings, uint64_t id, BlockReader* in)
+{
+	static const std::string empty;
+
+	if (id >= strings.size())
+	{
+		in->ok = false;
+		return empty;
+	}
+	return strings[size_t(id)];
+}
+
+bool loadSnapshotClasses(SnapshotFile* file, ClassTable* classes)
+{
+	std::vector<std::string> strings;
+	const SnapshotSection* section = findSection(file, kSectionClasses);
+
+	classes->classes.clear();
+	if (!loadStrings(file, &strings))
+	{
+		return false;
+	}
+	if (section == nullptr)
+	{
+		return fail(file, "no class table");
+	}
+
+	for (uint32_t b = 0; b < section->blocks.size(); ++b)
+	{
+		BlockReader in;
+		uint32_t count;
+
+		if (!openBlock(file, kSectionClasses, b, &in, &count))
+		{
+			return false;
+		}
+		for (uint32_t i = 0; i < count && in.ok; ++i)
+		{
+			ClassInfo info;
+
+			info.signature = stringAt(strings, getVarint(&in), &in);
+			info.name = stringAt(strings, getVarint(&in), &in);
+			uint8_t flags = getByte(&in);
+			info.isArray = (flags & 1) != 0;
+			info.isInterface = (flags & 2) != 0;
+			info.fieldsResolved = (flags & 4) != 0;
+			info.primitiveArrayType = char(getByte(&in));
+			info.interfaceFieldCount = jint(getVarint(&in));
+			info.declaredFieldCount = jint(getVarint(&in));
+
+			uint64_t interfaces = getVarint(&in);
+			for (uint64_t k = 0; k < interfaces && in.ok; ++k)
+			{
+				info.interfaces.push_back(jlong(getVarint(&in)));
+			}
+			uint64_t fields = getVarint(&in);
+			for (uint64_t k = 0; k < fields && in.ok; ++k)
+			{
+				FieldInfo field;
+				field.name = stringAt(strings, getVarint(&in), &in);
+				field.declaringClassTag = jlong(getVarint(&in));
+				field.type = char(getByte(&in));
+				field.isStatic = getByte(&in) != 0;
+				info.fields.push_back(field);
+			}
+			classes->classes.push_back(info);
+		}
+		if (!closeBlock(file, &in))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool loadSnapshotGraph(SnapshotFile* file, HeapGraph* graph, DominatorTree* dominators)
+{
+	const SnapshotSection* nodeSection = findSection(file, kSectionNodes);
+	const SnapshotSection* edgeSection = findSection(file, kSectionEdges);
+	const SnapshotSection* dominatorSection = findSection(file, kSectionDominators);
+	SnapshotNodes nodes;
+	SnapshotEdges edges;
+	SnapshotDominators tree;
+
+	*graph = HeapGraph();
+	if (nodeSection == nullptr || edgeSection == nullptr || nodeSection->blocks.size() != edgeSection->blocks.size())
+	{
+		return fail(file, "no object graph");
+	}
+
+	graph->classIds.reserve(size_t(nodeSection->items));
+	graph->sizes.reserve(size_t(nodeSection->items));
+	graph->flags.reserve(size_t(nodeSection->items));
+	graph->edgeStarts.reserve(size_t(nodeSection->items) + 1);
+	graph->edgeTargets.reserve(size_t(edgeSection->items));
+	graph->edgeLabels.reserve(size_t(edgeSection->items));
+	graph->edgeStarts.push_back(0);
+
+	for (uint32_t b = 0; b < nodeSection->blocks.size(); ++b)
+	{
+		if (!readSnapshotNodes(file, b, &nodes) || !readSnapshotEdges(file, b, &edges) ||
+			edges.edgeStarts.size() != nodes.classIds.size() + 1)
+		{
+			return file->error.empty() ? fail(file, "inconsistent snapshot blocks") : false;
+		}
+
+		graph->classIds.insert(graph->classIds.end(), nodes.classIds.begin(), nodes.classIds.end());
+		graph->sizes.insert(graph->sizes.end(), nodes.sizes.begin(), nodes.sizes.end());
+		graph->flags.insert(graph->flags.end(), nodes.flags.begin(), nodes.flags.end());
+
+		uint64_t base = graph->edgeTargets.size();
+		for (size_t i = 1; i < edges.edgeStarts.size(); ++i)
+		{
+			graph->edgeStarts.push_back(base + edges.edgeStarts[i]);
+		}
+		graph->edgeTargets.insert(graph->edgeTargets.end(), edges.edgeTargets.begin(), edges.edgeTargets.end());
+		graph->edgeLabels.insert(graph->edgeLabels.end(), edges.edgeLabels.begin(), edges.edgeLabels.end());
+	}
+
+	size_t count = graphNodeCount(graph);
+	for (auto it = graph->edgeTargets.begin(); it != graph->edgeTargets.end(); ++it)
+	{
+		if (*it >= count)
+		{
+			return fail(file, "edge to a missing node");
+		}
+	}
+
+	if (dominators == nullptr)
+	{
+		return true;
+	}
+	if (dominatorSection == nullptr)
+	{
+		computeDominators(graph, dominators);
+		return true;
+	}
+
+	dominators->idom.clear();
+	dominators->retained.clear();
+	dominators->idom.reserve(count);
+	dominators->retained.reserve(count);
+	for (uint32_t b = 0; b < dominatorSection->blocks.size(); ++b)
+	{
+		if (!readSnapshotDominators(file, b, &tree))
+		{
+			return false;
+		}
+		dominators->idom.insert(dominators->idom.end(), tree.idom.begin(), tree.idom.end());
+		dominators->retained.insert(dominators->retained.end(), tree.retained.begin(), tree.retained.end());
+	}
+	if (dominators->idom.size() != count)
+	{
+		return fail(file, "inconsistent dominator section");
+	}
+	return true;
+}
+
+bool loadSnapshotThreads(SnapshotFile* file, std::vector<ThreadRoot>* threads, std::vector<FrameRoot>* frames)
+{
+	BlockReader in;
+	uint32_t count;
+
+	threads->clear();
+	frames->clear();
+	if (findSection(file, kSectionThreads) == nullptr)
+	{
+		return true;
+	}
+	if (!openBlock(file, kSectionThreads, 0, &in, &count))
+	{
+		return false;
+	}
+
+	uint64_t threadCount = getVarint(&in);
+	for (uint64_t i = 0; i < threadCount && in.ok; ++i)
+	{
+		ThreadRoot root;
+		root.node = NodeId(getVarint(&in));
+		root.threadId = getSigned(&in);
+		root.threadObject = NodeId(getVarint(&in) - 1);
+		threads->push_back(root);
+	}
+	uint64_t frameCount = getVarint(&in);
+	for (uint64_t i = 0; i < frameCount && in.ok; ++i)
+	{
+		FrameRoot root;
+		root.node = NodeId(getVarint(&in));
+		root.thread = uint32_t(getVarint(&in));
+		root.depth = jint(getSigned(&in));
+		root.method = nullptr;
+		root.location = getSigned(&in);
+		frames->push_back(root);
+	}
+	return closeBlock(file, &in);
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+
+#ifndef SNAPSHOT_FILE_H
+#define SNAPSHOT_FILE_H
+
+#include <vector>
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "heapGraph.hpp"
+#include "classTable.hpp"
+#include "heapSnapshot.hpp"
+
+/* Snapshot files keep a heap snapshot for analysis after the VM is gone.
+ *
+ *   header     "JVMWSNAP", version, reserved
+ *   sections   strings, classes, nodes, edges, dominators, threads, and
+ *              the indexes: parents, instances by class, top retainers;
+ *              each a run of blocks: item count, encoded length, CRC-32C,
+ *              data
+ *   directory  per section its type, item count and block offsets
+ *   trailer    directory offset, length and CRC-32C, "JVMWSEND"
+ *
+ *   Node, edge, dominator and parent blocks cover the same
+ *   kSnapshotBlockNodes nodes each, the instance index has one block per
+ *   class id, so the data of one node is found without decoding the
+ *   rest of the file. Numbers are LEB128 varints, signed ones zigzag
+ *   encoded. Outgoing edges are sorted by target, the first relative to
+ *   the node, the rest to the previous target. Dominators and parents are
+ *   signed distances back from the node plus one, 0 for none. The writer only appends, the reader maps the file
+ *   and decodes and checks a block when it is asked for.
+ */
+static const uint32_t kSnapshotFileVersion = 2;
+static const uint32_t kSnapshotBlockNodes = 1 << 16;
+
+enum SnapshotSectionType
+{
+	kSectionStrings = 1,
+	kSectionClasses = 2,
+	kSectionNodes = 3,
+	kSectionEdges = 4,
+	kSectionDominators = 5,
+	kSectionThreads = 6,
+	kSectionParents = 7,
+	kSectionClassIndex = 8,
+	kSectionRetainedIndex = 9
+};
+
+/* Largest objects kept in the retained index */
+static const uint32_t kRetainedIndexNodes = 1 << 16;
+
+typedef struct SnapshotSection
+{
+	uint32_t type;
+	uint64_t items;
+	std::vector<uint64_t> blocks;
+} SnapshotSection;
+
+typedef struct SnapshotFile
+{
+	const uint8_t* data;
+	size_t size;
+	uint32_t version;
+	std::vector<SnapshotSection> sections;
+
+	/* Platform handles of the mapping */
+	void* file;
+	void* mapping;
+
+	/* Why the last call failed */
+	std::string error;
+} SnapshotFile;
+
+/* Columns of the nodes first .. first + count - 1 */
+typedef struct SnapshotNodes
+{
+	NodeId first;
+	std::vector<uint32_t> classIds;
+	std::vector<uint64_t> sizes;
+	std::vector<uint8_t> flags;
+} SnapshotNodes;
+
+/* Outgoing edges of the nodes of a block, edgeStarts relative to the block */
+typedef struct SnapshotEdges
+{
+	NodeId first;
+	std::vector<uint64_t> edgeStarts;
+	std::vector<NodeId> edgeTargets;
+	std::vector<uint32_t> edgeLabels;
+} SnapshotEdges;
+
+typedef struct SnapshotDominators
+{
+	NodeId first;
+	std::vector<NodeId> idom;
+	std::vector<uint64_t> retained;
+} SnapshotDominators;
+
+/* Previous node and edge label on a shortest path from the GC roots */
+typedef struct SnapshotParents
+{
+	NodeId first;
+	std::vector<NodeId> parent;
+	std::vector<uint32_t> label;
+} SnapshotParents;
+
+/* Writes the snapshot with its dominator tree and the class table it was
+ *   taken with. Returns false and prints the reason on I/O errors. */
+bool writeSnapshotFile(const char* path, const HeapSnapshot* snapshot, const ClassTable* classes);
+
+/* Maps a snapshot file and reads its directory, nothing is decoded yet */
+bool openSnapshotFile(const char* path, SnapshotFile* file);
+void closeSnapshotFile(SnapshotFile* file);
+
+uint64_t snapshotNodeCount(const SnapshotFile* file);
+
+inline uint32_t snapshotBlockOf(NodeId node)
+{
+	return node / kSnapshotBlockNodes;
+}
+
+/* Decode and check one block, false when it is corrupt or out of range */
+bool readSnapshotNodes(SnapshotFile* file, uint32_t block, SnapshotNodes* nodes);
+bool readSnapshotEdges(SnapshotFile* file, uint32_t block, SnapshotEdges* edges);
+bool readSnapshotDominators(SnapshotFile* file, uint32_t block, SnapshotDominators* dominators);
+bool readSnapshotParents(SnapshotFile* file, uint32_t block, SnapshotParents* parents);
+
+/* Instances of a class id in node order, from the instance index */
+bool readSnapshotInstances(SnapshotFile* file, uint32_t class_id, std::vector<NodeId>* nodes);
+
+/* Up to kRetainedIndexNodes objects, largest retained size first */
+bool readSnapshotTopRetained(SnapshotFile* file, std::vector<NodeId>* nodes);
+
+/* Decode whole sections. A file without a dominator section gets the
+ *   dominator tree computed. */
+bool loadSnapshotClasses(SnapshotFile* file, ClassTable* classes);
+bool loadSnapshotGraph(SnapshotFile* file, HeapGraph* graph, DominatorTree* dominators);
+bool loadSnapshotThreads(SnapshotFile* file, std::vector<ThreadRoot>* threads, std::vector<FrameRoot>* frames);
+
+#endif
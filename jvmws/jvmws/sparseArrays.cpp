@@ -0,0 +1,293 @@
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+
+#include "agent_util.hpp"
+#include "analysisTags.hpp"
+#include "arrayScan.hpp"
+#include "sparseArrays.hpp"
+
+/* Where an array was referenced from: the class of the referrer and the
+ *   field index, or the root kind for arrays held directly by a root.
+ */
+typedef struct ArrayOwner
+{
+	jlong classTag;
+	jint kind;
+	jint index;
+
+	bool operator==(const ArrayOwner& other) const
+	{
+		return classTag == other.classTag && kind == other.kind && index == other.index;
+	}
+} ArrayOwner;
+
+struct ArrayOwnerHash
+{
+	size_t operator()(const ArrayOwner& owner) const
+	{
+		uint64_t h = uint64_t(owner.classTag) * 0x9E3779B185EBCA87ULL;
+		h ^= (uint64_t(uint32_t(owner.kind)) << 32 | uint32_t(owner.index)) * 0xC2B2AE3D27D4EB4FULL;
+		return size_t(h ^ (h >> 29));
+	}
+};
+
+typedef struct OwnerTotals
+{
+	ArrayOwner owner;
+	jlong arrayClassTag;
+	jlong arrays;
+	jlong bytes;
+	jlong elementBytes;
+	jlong zeroBytes;
+	jlong trailingZeroBytes;
+	jlong zeroFilledArrays;
+} OwnerTotals;
+
+/* Entry 0 collects arrays whose first reference was not seen */
+typedef struct SparseScan
+{
+	const ClassTable* classes;
+	std::vector<OwnerTotals> owners;
+	std::unordered_map<ArrayOwner, size_t, ArrayOwnerHash> ownerIndex;
+
+	/* Owners of arrays that already carry a tag of their own */
+	std::unordered_map<jlong, size_t> taggedOwners;
+	jlong scratchKeys;
+
+	WalkBudget* budget;
+} SparseScan;
+
+static size_t findOwner(SparseScan* scan, const ArrayOwner& owner)
+{
+	auto it = scan->ownerIndex.find(owner);
+	if (it != scan->ownerIndex.end())
+	{
+		return it->second;
+	}
+
+	OwnerTotals totals = {};
+	totals.owner = owner;
+	scan->owners.push_back(totals);
+	scan->ownerIndex[owner] = scan->owners.size() - 1;
+	return scan->owners.size() - 1;
+}
+
+/* Untagged primitive arrays are parked on their first reference with a
+ *   tag below kSparseTagBase holding the index of their owner. The array
+ *   callback reads it back and leaves kSparseTagBase, so later references
+ *   to an array already scanned do not park it again, and a pass after the
+ *   walk clears the tags. The range stays clear of the marks of the other
+ *   walks. Tagged arrays keep their tag and are looked up by it instead.
+ */
+static const jlong kSparseTagBase = -(jlong(1) << 48);
+static const jlong kSparseTagSpan = jlong(1) << 40;
+
+inline bool isSparseTag(jlong tag)
+{
+	return tag <= kSparseTagBase && tag > kSparseTagBase - kSparseTagSpan;
+}
+
+static jint JNICALL sparseReferenceCallback(jvmtiHeapReferenceKind reference_kind, const jvmtiHeapReferenceInfo* reference_info,
+                                            jlong class_tag, jlong referrer_class_tag, jlong size, jlong* tag_ptr,
+                                            jlong* referrer_tag_ptr, jint length, void* user_data)
+{
+	auto scan = static_cast<SparseScan*>(user_data);
+
+	if (!spendWalkBudget(scan->budget, size))
+	{
+		return JVMTI_VISIT_ABORT;
+	}
+	if (*tag_ptr >= 0 && length >= 0)
+	{
+		const ClassInfo* info = findClassInfo(scan->classes, class_tag);
+		if (info != nullptr && info->primitiveArrayType != 0)
+		{
+			ArrayOwner owner;
+			owner.classTag = referrer_class_tag;
+			owner.kind = reference_kind;
+			owner.index = -1;
+
+			if (reference_kind == JVMTI_HEAP_REFERENCE_FIELD)
+			{
+				owner.index = reference_info->field.index;
+			}
+			else if (reference_kind == JVMTI_HEAP_REFERENCE_STATIC_FIELD)
+			{
+				/* The referrer is the class itself */
+				owner.classTag = referrer_tag_ptr != nullptr ? *referrer_tag_ptr : 0;
+				owner.index = reference_info->field.index;
+			}
+
+			if (*tag_ptr == 0)
+			{
+				*tag_ptr = kSparseTagBase - jlong(findOwner(scan, owner));
+			}
+			else if (scan->taggedOwners.find(*tag_ptr) == scan->taggedOwners.end())
+			{
+				/* A bare age stamp is shared by the epoch, key the array
+				 *   by a scratch tag instead */
+				if (isBareAgeStamp(*tag_ptr))
+				{
+					*tag_ptr = makeScratchTag(*tag_ptr, ++scan->scratchKeys);
+				}
+				scan->taggedOwners[*tag_ptr] = findOwner(scan, owner);
+			}
+		}
+	}
+	return JVMTI_VISIT_OBJECTS;
+}
+
+static jint JNICALL sparseArrayCallback(jlong class_tag, jlong size, jlong* tag_ptr, jint element_count,
+                                        jvmtiPrimitiveType element_type, const void* elements, void* user_data)
+{
+	auto scan = static_cast<SparseScan*>(user_data);
+	size_t owner = 0;
+	ArrayZeroScan zeros;
+	jint elementSize = primitive_type_size(element_type);
+
+	if (isSparseTag(*tag_ptr))
+	{
+		owner = size_t(kSparseTagBase - *tag_ptr);
+		*tag_ptr = kSparseTagBase;
+		if (owner >= scan->owners.size())
+		{
+			owner = 0;
+		}
+	}
+	else if (*tag_ptr > 0)
+	{
+		auto it = scan->taggedOwners.find(*tag_ptr);
+		if (it != scan->taggedOwners.end())
+		{
+			owner = it->second;
+		}
+	}
+
+	scanArrayZeros(elements, size_t(element_count), size_t(elementSize), &zeros);
+
+	OwnerTotals* totals = &scan->owners[owner];
+	if (totals->arrayClassTag == 0)
+	{
+		totals->arrayClassTag = class_tag;
+	}
+	totals->arrays++;
+	totals->bytes += size;
+	totals->elementBytes += jlong(element_count) * elementSize;
+	totals->zeroBytes += jlong(zeros.zeroElements) * elementSize;
+	totals->trailingZeroBytes += jlong(size_t(element_count) - zeros.usedLength) * elementSize;
+	if (element_count > 0 && zeros.usedLength == 0)
+	{
+		totals->zeroFilledArrays++;
+	}
+	return 0;
+}
+
+static jint JNICALL clearSparseTagCallback(jlong class_tag, jlong size, jlong* tag_ptr, jint length, void* user_data)
+{
+	if (isSparseTag(*tag_ptr))
+	{
+		*tag_ptr = 0;
+	}
+	else if (isScratchTag(*tag_ptr))
+	{
+		*tag_ptr &= kAgeMask;
+	}
+	return 0;
+}
+
+static std::string describeOwner(const SparseScan* scan, const ArrayOwner& owner)
+{
+	if (owner.kind == 0)
+	{
+		return "<unattributed>";
+	}
+	if (owner.classTag == 0)
+	{
+		return std::string("<") + reference_kind_name(jvmtiHeapReferenceKind(owner.kind)) + ">";
+	}
+	if (owner.kind == JVMTI_HEAP_REFERENCE_FIELD)
+	{
+		return fieldNameOf(scan->classes, owner.classTag, owner.index);
+	}
+	if (owner.kind == JVMTI_HEAP_REFERENCE_STATIC_FIELD)
+	{
+		return fieldNameOf(scan->classes, owner.classTag, owner.index) + " (static)";
+	}
+
+	std::string text = classNameOf(scan->classes, owner.classTag);
+	text += " (";
+	text += reference_kind_name(jvmtiHeapReferenceKind(owner.kind));
+	text += ')';
+	return text;
+}
+
+static bool moreReclaimable(const OwnerTotals* a, const OwnerTotals* b)
+{
+	return a->trailingZeroBytes > b->trailingZeroBytes;
+}
+
+jint reportSparseArrays(jvmtiEnv* jvmti, const ClassTable* classes, jint top, WalkBudget* budget)
+{
+	jvmtiError err;
+	jvmtiHeapCallbacks callbacks;
+	SparseScan scan;
+	ArrayOwner unattributed = { 0, 0, -1 };
+
+	scan.classes = classes;
+	scan.scratchKeys = 0;
+	scan.budget = budget;
+	findOwner(&scan, unattributed);
+
+	(void)memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.heap_reference_callback = &sparseReferenceCallback;
+	callbacks.array_primitive_value_callback = &sparseArrayCallback;
+
+	countWalkReferences(budget);
+	err = jvmti->FollowReferences(0, nullptr, nullptr, &callbacks, &scan);
+	check_jvmti_error(jvmti, err, "follow references");
+	finishWalkBudget(budget);
+
+	/* Not budgeted, a stopped walk leaves its tags behind as well */
+	(void)memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.heap_iteration_callback = &clearSparseTagCallback;
+	err = jvmti->IterateThroughHeap(JVMTI_HEAP_FILTER_UNTAGGED, nullptr, &callbacks, nullptr);
+	check_jvmti_error(jvmti, err, "iterate through heap");
+
+	OwnerTotals all = {};
+	std::vector<const OwnerTotals*> owners;
+	for (auto it = scan.owners.begin(); it != scan.owners.end(); ++it)
+	{
+		all.arrays += it->arrays;
+		all.bytes += it->bytes;
+		all.zeroBytes += it->zeroBytes;
+		all.trailingZeroBytes += it->trailingZeroBytes;
+		all.zeroFilledArrays += it->zeroFilledArrays;
+		if (it->arrays > 0)
+		{
+			owners.push_back(&*it);
+		}
+	}
+
+	stdout_message("Sparse primitive arrays (%s scanning):\n", arrayScanUsesAvx2() ? "AVX2" : "scalar");
+	stdout_message("  arrays %lld, bytes %lld, zero bytes %lld, all-zero arrays %lld\n",
+	               (long long)all.arrays, (long long)all.bytes, (long long)all.zeroBytes, (long long)all.zeroFilledArrays);
+	stdout_message("  bytes that could be reclaimed by right-sizing: %lld\n", (long long)all.trailingZeroBytes);
+
+	size_t shown = std::min(owners.size(), size_t(top > 0 ? top : 0));
+	std::partial_sort(owners.begin(), owners.begin() + shown, owners.end(), &moreReclaimable);
+
+	stdout_message("\nTop %d owners by reclaimable bytes:\n", int(shown));
+	for (size_t i = 0; i < shown; ++i)
+	{
+		const OwnerTotals* totals = owners[i];
+		stdout_message(" %3d. %s %s: arrays %lld, bytes %lld, zero %.1f%%, trailing zero %lld bytes, all-zero %lld\n",
+		               int(i + 1), describeOwner(&scan, totals->owner).c_str(), classNameOf(classes, totals->arrayClassTag),
+		               (long long)totals->arrays, (long long)totals->bytes,
+		               totals->elementBytes > 0 ? 100.0 * double(totals->zeroBytes) / double(totals->elementBytes) : 0.0,
+		               (long long)totals->trailingZeroBytes, (long long)totals->zeroFilledArrays);
+	}
+
+	return jint(all.arrays);
+}
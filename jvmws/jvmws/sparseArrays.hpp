@@ -0,0 +1,24 @@
+#pragma once
+
+
+#ifndef SPARSE_ARRAYS_H
+#define SPARSE_ARRAYS_H
+
+#include <jni.h>
+#include <ibmjvmti.h>
+
+#include "classTable.hpp"
+#include "walkBudget.hpp"
+
+/* Follows references from the heap roots once, scanning the contents of
+ *   every reachable primitive array for zero elements. Arrays are charged
+ *   to the class and field that first referenced them, and owners are
+ *   printed by the bytes that right-sizing their arrays would reclaim,
+ *   i.e. the trailing zero runs. The walk stops when the budget is spent,
+ *   the arrays scanned so far are reported.
+ *   The classes must have been tagged through the same environment.
+ *   Returns the number of primitive arrays scanned.
+ */
+jint reportSparseArrays(jvmtiEnv* jvmti, const ClassTable* classes, jint top, WalkBudget* budget);
+
+#endif
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+#include <unordered_map>
+#include <algorithm>
+
+#include "agent_util.hpp"
+#include "tagRenderer.hpp"
+
+void initRenderSink(RenderSink* sink, size_t flushAt)
+{
+	sink->buffer.clear();
+	sink->buffer.reserve(flushAt + 1024);
+	sink->flushAt = flushAt;
+	sink->written = 0;
+}
+
+void flushRenderSink(RenderSink* sink)
+{
+	if (!sink->buffer.empty())
+	{
+		stdout_message("%s", sink->buffer.c_str());
+		sink->written += sink->buffer.size();
+		sink->buffer.clear();
+	}
+}
+
+void sinkPrintf(RenderSink* sink, const char* format, ...)
+{
+	char line[1024];
+	va_list args;
+	int length;
+
+	va_start(args, format);
+	length = vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	if (length > 0)
+	{
+		sink->buffer.append(line, std::min(size_t(length), sizeof(line) - 1));
+	}
+	if (sink->buffer.size() >= sink->flushAt)
+	{
+		flushRenderSink(sink);
+	}
+}
+
+/* Field name of a field edge, [index] of an array element */
+static std::string edgeLabel(const ClassTable* classes, const Tag* tag, const TagEdge& edge)
+{
+	if (edge.kind == JVMTI_HEAP_REFERENCE_FIELD)
+	{
+		return fieldNameOf(classes, tag->classTag, edge.index);
+	}
+	if (edge.kind == JVMTI_HEAP_REFERENCE_ARRAY_ELEMENT)
+	{
+		return "[" + std::to_string((long long) edge.index) + "]";
+	}
+	return reference_kind_name(jvmtiHeapReferenceKind(edge.kind));
+}
+
+std::string quoted(const char* text)
+{
+	std::string out;
+	char code[8];
+
+	for (const char* c = text != nullptr ? text : "null"; *c != 0; ++c)
+	{
+		if (*c == '"' || *c == '\\')
+		{
+			out += '\\';
+			out += *c;
+		}
+		else if (static_cast<unsigned char>(*c) < 0x20)
+		{
+			snprintf(code, sizeof(code), "\\u%04x", unsigned(static_cast<unsigned char>(*c)));
+			out += code;
+		}
+		else
+		{
+			out += *c;
+		}
+	}
+	return out;
+}
+
+typedef struct RenderFrame
+{
+	Tag* tag;
+	uint32_t id;
+	jint depth;
+
+	/* Indexes of the children shown, largest first, ties in child order */
+	std::vector<uint32_t> order;
+	size_t next;
+
+	/* Children left out by the depth or fan-out bound */
+	size_t hidden;
+} RenderFrame;
+
+struct LargerChild
+{
+	const std::vector<Tag*>* children;
+
+	bool operator()(uint32_t a, uint32_t b) const
+	{
+		const Tag* x = (*children)[a];
+		const Tag* y = (*children)[b];
+		jlong x_size = x != nullptr ? x->size : 0;
+		jlong y_size = y != nullptr ? y->size : 0;
+		return x_size != y_size ? x_size > y_size : a < b;
+	}
+};
+
+static void openFrame(RenderFrame* frame, Tag* tag, uint32_t id, jint depth, const RenderOptions* options)
+{
+	size_t children = tag != nullptr ? tag->ref_next_tags.size() : 0;
+
+	frame->tag = tag;
+	frame->id = id;
+	frame->depth = depth;
+	frame->next = 0;
+	frame->order.clear();
+	if (depth >= options->maxDepth)
+	{
+		frame->hidden = children;
+		return;
+	}
+
+	for (size_t i = 0; i < children; ++i)
+	{
+		frame->order.push_back(uint32_t(i));
+	}
+	LargerChild larger = { &tag->ref_next_tags };
+	size_t shown = std::min(children, size_t(options->maxChildren > 0 ? options->maxChildren : 0));
+	std::partial_sort(frame->order.begin(), frame->order.begin() + ptrdiff_t(shown), frame->order.end(), larger);
+	frame->order.resize(shown);
+	frame->hidden = children - shown;
+}
+
+static void emitNode(RenderSink* sink, const RenderOptions* options, const RenderFrame* parent, size_t rank,
+                     const std::string& label, const Tag* tag, uint32_t id, jint depth)
+{
+	const char* name = tag != nullptr ? tag->name : nullptr;
+	long long size = tag != nullptr ? (long long)tag->size : 0;
+	std::string indent(size_t(depth) * 2, ' ');
+
+	switch (options->format)
+	{
+	case kRenderText:
+		if (parent == nullptr)
+		{
+			sinkPrintf(sink, "#%u obj: %s (%lld bytes)\n", id, name != nullptr ? name : "null", size);
+		}
+		else
+		{
+			sinkPrintf(sink, "%s|--> %d. %s #%u obj: %s (%lld bytes)\n", indent.c_str(), int(rank), label.c_str(), id,
+			           name != nullptr ? name : "null", size);
+		}
+		break;
+	case kRenderJson:
+		if (parent != nullptr)
+		{
+			sinkPrintf(sink, "%s{\"ref\":\"%s\",\"node\":", rank > 1 ? "," : "", quoted(label.c_str()).c_str());
+		}
+		sinkPrintf(sink, "{\"id\":%u,\"name\":\"%s\",\"size\":%lld,\"refs\":[", id, quoted(name).c_str(), size);
+		break;
+	case kRenderDot:
+		sinkPrintf(sink, "  n%u [label=\"#%u %s\\n%lld bytes\"];\n", id, id, quoted(name).c_str(), size);
+		if (parent != nullptr)
+		{
+			sinkPrintf(sink, "  n%u -> n%u [label=\"%s\"];\n", parent->id, id, quoted(label.c_str()).c_str());
+		}
+		break;
+	}
+}
+
+static void emitBackReference(RenderSink* sink, const RenderOptions* options, const RenderFrame* parent, size_t rank,
+                              const std::string& label, uint32_t id)
+{
+	std::string indent(size_t(parent->depth + 1) * 2, ' ');
+
+	switch (options->format)
+	{
+	case kRenderText:
+		sinkPrintf(sink, "%s|--> %d. %s see #%u\n", indent.c_str(), int(rank), label.c_str(), id);
+		break;
+	case kRenderJson:
+		sinkPrintf(sink, "%s{\"ref\":\"%s\",\"see\":%u}", rank > 1 ? "," : "", quoted(label.c_str()).c_str(), id);
+		break;
+	case kRenderDot:
+		sinkPrintf(sink, "  n%u -> n%u [label=\"%s\", style=dashed];\n", parent->id, id, quoted(label.c_str()).c_str());
+		break;
+	}
+}
+
+static void emitClose(RenderSink* sink, const RenderOptions* options, const RenderFrame* frame, bool child)
+{
+	std::string indent(size_t(frame->depth + 1) * 2, ' ');
+	const char* reason = frame->depth >= options->maxDepth ? "not expanded, max depth" : "not shown";
+
+	switch (options->format)
+	{
+	case kRenderText:
+		if (frame->hidden > 0)
+		{
+			sinkPrintf(sink, "%s... %d more refs %s\n", indent.c_str(), int(frame->hidden), reason);
+		}
+		break;
+	case kRenderJson:
+		sinkPrintf(sink, "],\"more\":%d}%s", int(frame->hidden), child ? "}" : "");
+		break;
+	case kRenderDot:
+		if (frame->hidden > 0)
+		{
+			sinkPrintf(sink, "  m%u [shape=plaintext, label=\"%d more refs\"];\n  n%u -> m%u [style=dotted];\n",
+			           frame->id, int(frame->hidden), frame->id, frame->id);
+		}
+		break;
+	}
+}
+
+jint renderTagGraph(Tag* root, const ClassTable* classes, const RenderOptions* options, RenderSink* sink)
+{
+	std::unordered_map<const Tag*, uint32_t> ids;
+	std::vector<RenderFrame> stack;
+	size_t top = 0;
+	uint32_t count = 1;
+
+	if (options->format == kRenderDot)
+	{
+		sinkPrintf(sink, "digraph heap {\n  node [shape=box];\n");
+	}
+
+	/* The stack keeps its frames across pushes, their order vectors are
+	 *   reused */
+	ids[root] = count;
+	emitNode(sink, options, nullptr, 0, std::string(), root, count, 0);
+	stack.resize(1);
+	openFrame(&stack[0], root, count, 0, options);
+	top = 1;
+
+	while (top > 0)
+	{
+		RenderFrame* frame = &stack[top - 1];
+
+		if (frame->next < frame->order.size())
+		{
+			uint32_t index = frame->order[frame->next++];
+			Tag* child = frame->tag->ref_next_tags[index];
+			std::string label = index < frame->tag->ref_next_edges.size() ?
+				edgeLabel(classes, frame->tag, frame->tag->ref_next_edges[index]) : std::string("?");
+			auto seen = ids.find(child);
+
+			if (seen != ids.end())
+			{
+				emitBackReference(sink, options, frame, frame->next, label, seen->second);
+				continue;
+			}
+
+			ids[child] = ++count;
+			emitNode(sink, options, frame, frame->next, label, child, count, frame->depth + 1);
+			if (top == stack.size())
+			{
+				stack.resize(top + 1);
+				frame = &stack[top - 1];
+			}
+			openFrame(&stack[top], child, count, frame->depth + 1, options);
+			top++;
+		}
+		else
+		{
+			emitClose(sink, options, frame, top > 1);
+			top--;
+		}
+	}
+
+	if (options->format == kRenderJson)
+	{
+		sinkPrintf(sink, "\n");
+	}
+	else if (options->format == kRenderDot)
+	{
+		sinkPrintf(sink, "}\n");
+	}
+	flushRenderSink(sink);
+	return jint(count);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+
+#ifndef TAG_RENDERER_H
+#define TAG_RENDERER_H
+
+#include <vector>
+#include <string>
+
+#include <stddef.h>
+
+#include <jni.h>
+#include <ibmjvmti.h>
+
+#include "classTable.hpp"
+#include "versionCheck.hpp"
+
+/* Renders the reference graph of Tags collected for an object. The walk
+ *   is iterative and numbers every Tag when it is first reached, a Tag met
+ *   again is printed as "see #id" instead of being expanded, so cycles
+ *   and shared objects cost one line. Depth and the children shown per
+ *   Tag are bounded, the largest children go first. The work is linear in
+ *   the Tags and references shown.
+ */
+enum RenderFormat
+{
+	kRenderText,
+	kRenderJson,
+	kRenderDot
+};
+
+typedef struct RenderOptions
+{
+	RenderFormat format;
+	jint maxDepth;
+	jint maxChildren;
+} RenderOptions;
+
+/* Output collected in a buffer and written in large pieces */
+typedef struct RenderSink
+{
+	std::string buffer;
+	size_t flushAt;
+	size_t written;
+} RenderSink;
+
+void initRenderSink(RenderSink* sink, size_t flushAt);
+void sinkPrintf(RenderSink* sink, const char* format, ...);
+void flushRenderSink(RenderSink* sink);
+
+/* Escapes quotes, backslashes and control characters for JSON and DOT,
+ *   nullptr gives "null" */
+std::string quoted(const char* text);
+
+/* Returns the number of Tags rendered */
+jint renderTagGraph(Tag* root, const ClassTable* classes, const RenderOptions* options, RenderSink* sink);
+
+#endif
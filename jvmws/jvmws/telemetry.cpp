@@ -0,0 +1,277 @@
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "agent_util.hpp"
+#include "telemetry.hpp"
+
+static jlong monotonicNanos()
+{
+	return jlong(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void initTelemetry(jvmtiEnv* jvmti, Telemetry* telemetry)
+{
+	jvmtiError err;
+
+	telemetry->origin = monotonicNanos();
+	telemetry->sampleCount = 0;
+	telemetry->pauseCount = 0;
+	telemetry->pauseTotal = 0;
+	telemetry->gcStart = -1;
+	telemetry->collected = false;
+	telemetry->running = false;
+	telemetry->stopping = false;
+	telemetry->runtime = nullptr;
+
+	err = jvmti->CreateRawMonitor("telemetry lock", &telemetry->lock);
+	check_jvmti_error(jvmti, err, "create telemetry lock");
+}
+
+void telemetryGcStart(jvmtiEnv* jvmti, Telemetry* telemetry)
+{
+	jlong now = monotonicNanos();
+
+	jvmti->RawMonitorEnter(telemetry->lock);
+	telemetry->gcStart = now;
+	jvmti->RawMonitorExit(telemetry->lock);
+}
+
+/* Records the pause and wakes the sampling thread for an after-GC sample */
+void telemetryGcFinish(jvmtiEnv* jvmti, Telemetry* telemetry)
+{
+	jlong now = monotonicNanos();
+	GcPause* pause;
+
+	jvmti->RawMonitorEnter(telemetry->lock);
+	if (telemetry->gcStart >= 0)
+	{
+		pause = &telemetry->pauses[telemetry->pauseCount % kTelemetryPauses];
+		pause->start = telemetry->gcStart - telemetry->origin;
+		pause->duration = now - telemetry->gcStart;
+		telemetry->pauseTotal += pause->duration;
+		telemetry->pauseCount++;
+		telemetry->gcStart = -1;
+		telemetry->collected = true;
+		jvmti->RawMonitorNotifyAll(telemetry->lock);
+	}
+	jvmti->RawMonitorExit(telemetry->lock);
+}
+
+/* Runtime.totalMemory() - freeMemory(), no JNI call is made under the lock */
+static bool readHeapOccupancy(JNIEnv* env, Telemetry* telemetry, HeapSample* sample)
+{
+	sample->committed = env->CallLongMethod(telemetry->runtime, telemetry->totalMemory);
+	sample->used = sample->committed - env->CallLongMethod(telemetry->runtime, telemetry->freeMemory);
+	sample->max = env->CallLongMethod(telemetry->runtime, telemetry->maxMemory);
+	if (env->ExceptionCheck())
+	{
+		env->ExceptionClear();
+		return false;
+	}
+	return true;
+}
+
+static void JNICALL telemetryThread(jvmtiEnv* jvmti, JNIEnv* env, void* arg)
+{
+	Telemetry* telemetry = static_cast<Telemetry*>(arg);
+	HeapSample sample;
+	jvmtiError err;
+
+	err = jvmti->RawMonitorEnter(telemetry->lock);
+	check_jvmti_error(jvmti, err, "enter telemetry lock");
+	while (!telemetry->stopping)
+	{
+		if (!telemetry->collected)
+		{
+			err = jvmti->RawMonitorWait(telemetry->lock, kTelemetryPeriodMs);
+			if (err != JVMTI_ERROR_INTERRUPT)
+			{
+				check_jvmti_error(jvmti, err, "wait for telemetry period");
+			}
+		}
+		if (telemetry->stopping)
+		{
+			break;
+		}
+		sample.afterGC = telemetry->collected;
+		sample.collections = telemetry->pauseCount;
+		telemetry->collected = false;
+		jvmti->RawMonitorExit(telemetry->lock);
+
+		bool read = readHeapOccupancy(env, telemetry, &sample);
+
+		jvmti->RawMonitorEnter(telemetry->lock);
+		if (read)
+		{
+			sample.time = monotonicNanos() - telemetry->origin;
+			telemetry->samples[telemetry->sampleCount % kTelemetrySamples] = sample;
+			telemetry->sampleCount++;
+		}
+	}
+	telemetry->running = false;
+	jvmti->RawMonitorExit(telemetry->lock);
+}
+
+void startTelemetryThread(jvmtiEnv* jvmti, JNIEnv* env, Telemetry* telemetry)
+{
+	jclass runtimeClass;
+	jclass threadClass;
+	jmethodID getRuntime;
+	jmethodID constructor;
+	jobject runtime;
+	jobject thread;
+	jvmtiError err;
+
+	runtimeClass = env->FindClass("java/lang/Runtime");
+	threadClass = env->FindClass("java/lang/Thread");
+	if (runtimeClass == nullptr || threadClass == nullptr)
+	{
+		env->ExceptionClear();
+		stdout_message("WARNING: heap telemetry not started, core classes not found\n");
+		return;
+	}
+	getRuntime = env->GetStaticMethodID(runtimeClass, "getRuntime", "()Ljava/lang/Runtime;");
+	telemetry->totalMemory = env->GetMethodID(runtimeClass, "totalMemory", "()J");
+	telemetry->freeMemory = env->GetMethodID(runtimeClass, "freeMemory", "()J");
+	telemetry->maxMemory = env->GetMethodID(runtimeClass, "maxMemory", "()J");
+	constructor = env->GetMethodID(threadClass, "<init>", "(Ljava/lang/String;)V");
+	if (getRuntime == nullptr || telemetry->totalMemory == nullptr || telemetry->freeMemory == nullptr ||
+		telemetry->maxMemory == nullptr || constructor == nullptr)
+	{
+		env->ExceptionClear();
+		stdout_message("WARNING: heap telemetry not started, Runtime methods not found\n");
+		return;
+	}
+
+	runtime = env->CallStaticObjectMethod(runtimeClass, getRuntime);
+	thread = env->NewObject(threadClass, constructor, env->NewStringUTF("jvmws telemetry"));
+	if (runtime == nullptr || thread == nullptr)
+	{
+		env->ExceptionClear();
+		stdout_message("WARNING: heap telemetry not started, thread not created\n");
+		return;
+	}
+	telemetry->runtime = env->NewGlobalRef(runtime);
+	telemetry->running = true;
+
+	err = jvmti->RunAgentThread(thread, &telemetryThread, telemetry, JVMTI_THREAD_MIN_PRIORITY);
+	check_jvmti_error(jvmti, err, "run telemetry thread");
+}
+
+void stopTelemetryThread(jvmtiEnv* jvmti, Telemetry* telemetry)
+{
+	jvmti->RawMonitorEnter(telemetry->lock);
+	telemetry->stopping = true;
+	jvmti->RawMonitorNotifyAll(telemetry->lock);
+	jvmti->RawMonitorExit(telemetry->lock);
+}
+
+/* Nearest-rank percentile of sorted values */
+static double percentileMs(const std::vector<jlong>& sorted, double percent)
+{
+	size_t rank;
+
+	if (sorted.empty())
+	{
+		return 0.0;
+	}
+	rank = size_t(percent / 100.0 * double(sorted.size()) + 0.999999);
+	rank = rank == 0 ? 0 : std::min(rank, sorted.size()) - 1;
+	return double(sorted[rank]) / 1e6;
+}
+
+jint reportTelemetry(jvmtiEnv* jvmti, Telemetry* telemetry, jint last)
+{
+	std::vector<HeapSample> samples;
+	std::vector<jlong> durations;
+	uint64_t sampleCount;
+	uint64_t pauseCount;
+	jlong pauseTotal;
+	jlong elapsed;
+	bool running;
+
+	/* Copy the rings oldest first and leave the lock before printing */
+	jvmti->RawMonitorEnter(telemetry->lock);
+	sampleCount = telemetry->sampleCount;
+	pauseCount = telemetry->pauseCount;
+	pauseTotal = telemetry->pauseTotal;
+	running = telemetry->running;
+	elapsed = monotonicNanos() - telemetry->origin;
+	for (uint64_t i = sampleCount > kTelemetrySamples ? sampleCount - kTelemetrySamples : 0; i < sampleCount; ++i)
+	{
+		samples.push_back(telemetry->samples[i % kTelemetrySamples]);
+	}
+	for (uint64_t i = pauseCount > kTelemetryPauses ? pauseCount - kTelemetryPauses : 0; i < pauseCount; ++i)
+	{
+		durations.push_back(telemetry->pauses[i % kTelemetryPauses].duration);
+	}
+	jvmti->RawMonitorExit(telemetry->lock);
+
+	stdout_message("Heap telemetry over %.1f s, sampling thread %s, %lld samples every %lld ms\n\n",
+		double(elapsed) / 1e9, running ? "running" : "stopped", (long long)sampleCount, (long long)kTelemetryPeriodMs);
+
+	std::sort(durations.begin(), durations.end());
+	stdout_message("Collections %lld, paused %.1f ms, %.3f%% of the time\n", (long long)pauseCount,
+		double(pauseTotal) / 1e6, elapsed > 0 ? 100.0 * double(pauseTotal) / double(elapsed) : 0.0);
+	if (!durations.empty())
+	{
+		stdout_message("Pauses of the last %d collections: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+			int(durations.size()), percentileMs(durations, 50), percentileMs(durations, 90),
+			percentileMs(durations, 99), double(durations.back()) / 1e6);
+	}
+
+	if (samples.empty())
+	{
+		return 0;
+	}
+
+	/* Occupancy right after a collection bounds the live bytes from above,
+	 *   growth between the first and the last of them hints at a leak.
+	 *   The allocation rate only counts intervals without a collection.
+	 */
+	const HeapSample* firstAfterGC = nullptr;
+	const HeapSample* lastAfterGC = nullptr;
+	jlong allocated = 0;
+	jlong allocationTime = 0;
+	for (size_t i = 0; i < samples.size(); ++i)
+	{
+		if (samples[i].afterGC)
+		{
+			firstAfterGC = firstAfterGC == nullptr ? &samples[i] : firstAfterGC;
+			lastAfterGC = &samples[i];
+		}
+		if (i > 0 && samples[i].collections == samples[i - 1].collections && samples[i].used >= samples[i - 1].used)
+		{
+			allocated += samples[i].used - samples[i - 1].used;
+			allocationTime += samples[i].time - samples[i - 1].time;
+		}
+	}
+
+	const HeapSample* now = &samples.back();
+	stdout_message("\nHeap used %lld bytes, committed %lld, max %lld\n",
+		(long long)now->used, (long long)now->committed, (long long)now->max);
+	if (lastAfterGC != nullptr)
+	{
+		stdout_message("Live after GC %lld bytes, %+lld since %.1f s\n", (long long)lastAfterGC->used,
+			(long long)(lastAfterGC->used - firstAfterGC->used), double(firstAfterGC->time) / 1e9);
+	}
+	if (allocationTime > 0)
+	{
+		stdout_message("Allocation rate %.1f MB/s\n", double(allocated) / double(allocationTime) * 1e9 / (1024.0 * 1024.0));
+	}
+
+	size_t shown = std::min(samples.size(), size_t(last > 0 ? last : 0));
+	if (shown > 0)
+	{
+		stdout_message("\n      time s            used       committed  collections\n");
+		for (size_t i = samples.size() - shown; i < samples.size(); ++i)
+		{
+			stdout_message("  %10.3f  %14lld  %14lld  %11lld%s\n", double(samples[i].time) / 1e9,
+				(long long)samples[i].used, (long long)samples[i].committed,
+				(long long)samples[i].collections, samples[i].afterGC ? "  after GC" : "");
+		}
+	}
+	return jint(samples.size());
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+#include <jni.h>
+#include <ibmjvmti.h>
+
+/* Heap telemetry between snapshots. The GC start and finish events time
+ *   every collection pause, an agent thread reads the heap occupancy from
+ *   java.lang.Runtime once a period and right after each collection.
+ *   Both are kept in fixed-size rings, the oldest entries are overwritten.
+ */
+static const uint32_t kTelemetrySamples = 1024;
+static const uint32_t kTelemetryPauses = 1024;
+static const jlong kTelemetryPeriodMs = 1000;
+
+typedef struct HeapSample
+{
+	/* Nanoseconds since the telemetry was created */
+	jlong time;
+	jlong used;
+	jlong committed;
+	jlong max;
+
+	/* Collections finished when the sample was taken */
+	uint64_t collections;
+
+	/* First sample after a collection, used is close to the live bytes */
+	bool afterGC;
+} HeapSample;
+
+typedef struct GcPause
+{
+	jlong start;
+	jlong duration;
+} GcPause;
+
+typedef struct Telemetry
+{
+	/* Guards everything below, entered by the GC events too */
+	jrawMonitorID lock;
+	jlong origin;
+
+	HeapSample samples[kTelemetrySamples];
+	uint64_t sampleCount;
+
+	GcPause pauses[kTelemetryPauses];
+	uint64_t pauseCount;
+	jlong pauseTotal;
+
+	/* Start of the running collection, -1 outside of one */
+	jlong gcStart;
+
+	/* A collection finished since the last sample */
+	bool collected;
+	bool running;
+	bool stopping;
+
+	/* Runtime of the sampling thread */
+	jobject runtime;
+	jmethodID totalMemory;
+	jmethodID freeMemory;
+	jmethodID maxMemory;
+} Telemetry;
+
+/* Called from Agent_OnLoad, the raw monitor is created here */
+void initTelemetry(jvmtiEnv* jvmti, Telemetry* telemetry);
+
+/* GC event handlers, they only take the raw monitor */
+void telemetryGcStart(jvmtiEnv* jvmti, Telemetry* telemetry);
+void telemetryGcFinish(jvmtiEnv* jvmti, Telemetry* telemetry);
+
+/* Starts the sampling thread with RunAgentThread, from VM_INIT */
+void startTelemetryThread(jvmtiEnv* jvmti, JNIEnv* env, Telemetry* telemetry);
+
+/* Lets the sampling thread finish, from VM_DEATH */
+void stopTelemetryThread(jvmtiEnv* jvmti, Telemetry* telemetry);
+
+/* Prints the pause percentiles, occupancy and allocation rate and the last
+ *   samples. Returns the number of samples held. */
+jint reportTelemetry(jvmtiEnv* jvmti, Telemetry* telemetry, jint last);
+
+#endif
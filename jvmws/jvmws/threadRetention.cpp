@@ -0,0 +1,161 @@
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+
+#include "agent_util.hpp"
+#include "analysisTags.hpp"
+#include "threadRetention.hpp"
+
+/* Frames printed for each thread */
+static const size_t kFramesShown = 5;
+
+typedef struct ThreadRetention
+{
+	const ThreadRoot* root;
+	std::string name;
+	uint64_t retained;
+	uint64_t stackRetained;
+	std::vector<const FrameRoot*> frames;
+} ThreadRetention;
+
+/* Thread names by the node of their thread object */
+static std::unordered_map<NodeId, std::string> threadNames(jvmtiEnv* jvmti, JNIEnv* env, const HeapSnapshot* snapshot)
+{
+	jvmtiError err;
+	jint thread_count;
+	jthread* threads;
+	std::unordered_map<NodeId, std::string> names;
+
+	err = jvmti->GetAllThreads(&thread_count, &threads);
+	check_jvmti_error(jvmti, err, "get all threads");
+
+	for (auto i = 0; i < thread_count; ++i)
+	{
+		jlong tag;
+		jvmtiThreadInfo info;
+
+		err = jvmti->GetTag(threads[i], &tag);
+		check_jvmti_error(jvmti, err, "get thread tag");
+		NodeId node = nodeOfTag(&snapshot->graph, snapshot->generation, tag);
+		if (node != kNoNode)
+		{
+			err = jvmti->GetThreadInfo(threads[i], &info);
+			check_jvmti_error(jvmti, err, "get thread info");
+			names[node] = info.name != nullptr ? info.name : "";
+			deallocate(jvmti, reinterpret_cast<unsigned char*>(info.name));
+			env->DeleteLocalRef(info.thread_group);
+			env->DeleteLocalRef(info.context_class_loader);
+		}
+		env->DeleteLocalRef(threads[i]);
+	}
+	deallocate(jvmti, reinterpret_cast<unsigned char*>(threads));
+	return names;
+}
+
+/* "java.util.HashMap.get@12" */
+static std::string methodNameOf(jvmtiEnv* jvmti, JNIEnv* env, const ClassTable* classes, const FrameRoot* frame)
+{
+	jvmtiError err;
+	jclass klass;
+	jlong class_tag = 0;
+	char* name;
+	std::string text;
+
+	if (frame->method == nullptr)
+	{
+		return "<native>";
+	}
+
+	err = jvmti->GetMethodDeclaringClass(frame->method, &klass);
+	if (err != JVMTI_ERROR_NONE)
+	{
+		return "<unloaded>";
+	}
+	err = jvmti->GetTag(klass, &class_tag);
+	check_jvmti_error(jvmti, err, "get class tag");
+	env->DeleteLocalRef(klass);
+
+	err = jvmti->GetMethodName(frame->method, &name, nullptr, nullptr);
+	check_jvmti_error(jvmti, err, "get method name");
+
+	text = classNameOf(classes, class_tag);
+	text += '.';
+	text += name;
+	if (frame->location >= 0)
+	{
+		text += '@' + std::to_string((long long)frame->location);
+	}
+	else
+	{
+		text += " (JNI)";
+	}
+	deallocate(jvmti, reinterpret_cast<unsigned char*>(name));
+	return text;
+}
+
+struct MoreFrameRetained
+{
+	const DominatorTree* tree;
+
+	bool operator()(const FrameRoot* a, const FrameRoot* b) const
+	{
+		return tree->retained[a->node] > tree->retained[b->node];
+	}
+};
+
+static bool moreRetained(const ThreadRetention& a, const ThreadRetention& b)
+{
+	return a.retained > b.retained;
+}
+
+jint reportThreadRetention(jvmtiEnv* jvmti, JNIEnv* env, const HeapSnapshot* snapshot, const ClassTable* classes, jint top)
+{
+	const DominatorTree* tree = &snapshot->dominators;
+	std::unordered_map<NodeId, std::string> names = threadNames(jvmti, env, snapshot);
+	std::vector<ThreadRetention> threads(snapshot->threads.size());
+
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		const ThreadRoot* root = &snapshot->threads[i];
+		auto name = names.find(root->threadObject);
+
+		threads[i].root = root;
+		threads[i].name = name != names.end() ? name->second : "<unnamed>";
+		threads[i].retained = tree->retained[root->node];
+		threads[i].stackRetained = 0;
+	}
+	for (auto it = snapshot->frames.begin(); it != snapshot->frames.end(); ++it)
+	{
+		threads[it->thread].stackRetained += tree->retained[it->node];
+		threads[it->thread].frames.push_back(&*it);
+	}
+
+	size_t shown = std::min(threads.size(), size_t(top > 0 ? top : 0));
+	std::partial_sort(threads.begin(), threads.begin() + shown, threads.end(), &moreRetained);
+
+	stdout_message("Threads with stack roots: %d, frames %d\n", int(threads.size()), int(snapshot->frames.size()));
+	for (size_t i = 0; i < shown; ++i)
+	{
+		ThreadRetention* thread = &threads[i];
+		stdout_message(" %3d. \"%s\" id %lld: retained %lld bytes, held only by its frames %lld bytes\n",
+		               int(i + 1), thread->name.c_str(), (long long)thread->root->threadId,
+		               (long long)thread->retained, (long long)thread->stackRetained);
+
+		MoreFrameRetained moreFrameRetained = { tree };
+		size_t frames = std::min(thread->frames.size(), kFramesShown);
+		std::partial_sort(thread->frames.begin(), thread->frames.begin() + frames, thread->frames.end(), moreFrameRetained);
+		for (size_t f = 0; f < frames; ++f)
+		{
+			const FrameRoot* frame = thread->frames[f];
+			if (tree->retained[frame->node] == 0)
+			{
+				break;
+			}
+			stdout_message("        #%-3d %-60s %14lld bytes\n", int(frame->depth),
+			               methodNameOf(jvmti, env, classes, frame).c_str(), (long long)tree->retained[frame->node]);
+		}
+	}
+
+	return jint(threads.size());
+}
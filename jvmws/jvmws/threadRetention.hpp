@@ -0,0 +1,21 @@
+#pragma once
+
+
+#ifndef THREAD_RETENTION_H
+#define THREAD_RETENTION_H
+
+#include <jni.h>
+#include <ibmjvmti.h>
+
+#include "classTable.hpp"
+#include "heapSnapshot.hpp"
+
+/* Prints the memory each thread keeps alive through its stack and JNI
+ *   local references and its thread object, with the frames holding the
+ *   most. Works on the thread roots of the snapshot, the heap is not walked
+ *   again. jvmti must be the environment the snapshot was tagged through.
+ *   Returns the number of threads with roots.
+ */
+jint reportThreadRetention(jvmtiEnv* jvmti, JNIEnv* env, const HeapSnapshot* snapshot, const ClassTable* classes, jint top);
+
+#endif
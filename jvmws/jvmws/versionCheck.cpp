@@ -38,11 +38,31 @@
  */
 
 #include <vector>
-#include <unordered_map>
 #include <string>
+#include <algorithm>
+#include <memory>
 
 #include "agent_util.hpp"
 #include "versionCheck.hpp"
+#include "duplicates.hpp"
+#include "classTable.hpp"
+#include "sparseArrays.hpp"
+#include "analysisTags.hpp"
+#include "heapSnapshot.hpp"
+#include "fieldRetention.hpp"
+#include "classLoaders.hpp"
+#include "threadRetention.hpp"
+#include "snapshotFile.hpp"
+#include "heapFilter.hpp"
+#include "telemetry.hpp"
+#include "publishedSnapshot.hpp"
+#include "emergencySnapshot.hpp"
+#include "objectAges.hpp"
+#include "fieldWatch.hpp"
+#include "heapPipeline.hpp"
+#include "tagRenderer.hpp"
+#include "graphBrowser.hpp"
+#include "walkBudget.hpp"
 
 
 /* Global agent data structure */
@@ -51,16 +71,46 @@ typedef struct
 	/* JVMTI Environment */
 	jvmtiEnv* jvmti;
 
-	/* Data access Lock */
+	/* Serializes the heap walks, they share the tags and the class table.
+	 *   Readers of published snapshots never take it. */
 	jrawMonitorID lock;
 
+	/* JVMTI Environment owning the tags of the heap analyses */
+	jvmtiEnv* analysis;
+
+	/* Loaded classes, tagged through the analysis environment */
+	ClassTable* classes;
+
+	/* Copy of the class table held by published snapshots, replaced when
+	 *   the version of classes moves past it */
+	std::shared_ptr<const ClassTable>* publishedClasses;
+
+	/* GC pauses and heap occupancy samples */
+	Telemetry* telemetry;
+
+	/* Last snapshot taken, shared with the reader threads */
+	SnapshotStore* snapshots;
+
+	/* JVMTI Environment tagging classes for emergency snapshots, and the
+	 *   memory reserved for them */
+	jvmtiEnv* emergency;
+	EmergencySnapshot* emergencySnapshot;
+
+	/* GC epoch stamped on sampled allocations */
+	AgeTracker* ages;
+
+	/* Field hits counted while a watch window is open */
+	FieldProfiler* fieldWatch;
+
+	/* Pause budget of the heap walks */
+	WalkLimits walkLimits;
+
 } GlobalAgentData;
 
 static GlobalAgentData* gdata;
 
 //static char* gClassName = "sun/misc/Launcher$AppClassLoader";
 static char* gClassName = "org/zheltkov/heapview/Heapview";
-static std::unordered_map<long, char*> nameMap;
 //static char* gClassName = "com/ibm/jvm/ClassLoader";
 
 /* Create major.minor.micro version string */
@@ -99,8 +149,71 @@ static void JNICALL vm_init(jvmtiEnv* jvmti, JNIEnv* env, jthread thread)
 	err = jvmti->GetVersionNumber(&runtime_version);
 	check_jvmti_error(jvmti, err, "get version number");
 	version_check(JVMTI_VERSION, runtime_version);
+
+	startTelemetryThread(jvmti, env, gdata->telemetry);
 }
 
+/* Callback for JVMTI_EVENT_VM_DEATH */
+static void JNICALL vm_death(jvmtiEnv* jvmti, JNIEnv* env)
+{
+	stopTelemetryThread(jvmti, gdata->telemetry);
+}
+
+/* Callback for JVMTI_EVENT_RESOURCE_EXHAUSTED, the first exhaustion of the
+ *   heap or of threads writes an emergency snapshot */
+static void JNICALL resource_exhausted(jvmtiEnv* jvmti, JNIEnv* env, jint flags, const void* reserved, const char* description)
+{
+	if ((flags & (JVMTI_RESOURCE_EXHAUSTED_JAVA_HEAP | JVMTI_RESOURCE_EXHAUSTED_THREADS)) == 0 ||
+		gdata->emergencySnapshot->fired.exchange(true))
+	{
+		return;
+	}
+	writeEmergencySnapshot(gdata->emergency, gdata->analysis, env, gdata->snapshots, gdata->emergencySnapshot,
+	                       description != nullptr ? description : "resource exhausted");
+}
+
+/* Callbacks for JVMTI_EVENT_GARBAGE_COLLECTION_START and _FINISH, only
+ *   raw monitor functions may be called here */
+static void JNICALL gc_start(jvmtiEnv* jvmti)
+{
+	telemetryGcStart(jvmti, gdata->telemetry);
+}
+
+static void JNICALL gc_finish(jvmtiEnv* jvmti)
+{
+	telemetryGcFinish(jvmti, gdata->telemetry);
+	ageTrackerGcFinish(gdata->ages);
+}
+
+/* Callbacks for JVMTI_EVENT_FIELD_ACCESS and _MODIFICATION, enabled only
+ *   during a watch window */
+static void JNICALL field_access(jvmtiEnv* jvmti, JNIEnv* env, jthread thread, jmethodID method, jlocation location,
+                                 jclass field_klass, jobject object, jfieldID field)
+{
+	recordFieldHit(jvmti, gdata->fieldWatch, method, field, false);
+}
+
+static void JNICALL field_modification(jvmtiEnv* jvmti, JNIEnv* env, jthread thread, jmethodID method, jlocation location,
+                                       jclass field_klass, jobject object, jfieldID field, char signature_type, jvalue new_value)
+{
+	recordFieldHit(jvmti, gdata->fieldWatch, method, field, true);
+}
+
+/* Callback for JVMTI_EVENT_THREAD_END, frees the field hit table of the
+ *   thread */
+static void JNICALL thread_end(jvmtiEnv* jvmti, JNIEnv* env, jthread thread)
+{
+	endThreadFieldHits(jvmti, gdata->fieldWatch);
+}
+
+#ifdef JVMWS_SAMPLED_ALLOC
+/* Callback for JVMTI_EVENT_SAMPLED_OBJECT_ALLOC */
+static void JNICALL sampled_object_alloc(jvmtiEnv* jvmti, JNIEnv* env, jthread thread, jobject object, jclass object_klass, jlong size)
+{
+	stampSampledObject(gdata->analysis, gdata->ages, object);
+}
+#endif
+
 static char* getRefKind(jvmtiHeapReferenceKind reference_kind)
 {
 	char * kind;
@@ -254,9 +367,28 @@ static char* getObjRefKind(jvmtiObjectReferenceKind reference_kind)
 	return kind;
 }
 
+typedef struct InstanceWalk
+{
+	int count;
+	WalkBudget* budget;
+} InstanceWalk;
+
+typedef struct ReferenceWalk
+{
+	/* Tags of the objects met for the first time */
+	std::vector<jlong> tags;
+	WalkBudget* budget;
+} ReferenceWalk;
+
 static jvmtiIterationControl JNICALL heabObjectCallback(jlong class_tag, jlong size, jlong* tag_ptr, void* user_data)
 {
-	auto count = static_cast<int*>(user_data);
+	auto walk = static_cast<InstanceWalk*>(user_data);
+	if (!spendWalkBudget(walk->budget, size))
+	{
+		return JVMTI_ITERATION_ABORT;
+	}
+
+	auto count = &walk->count;
 	*count += 1;	
 
 	stdout_message("obj old tag %d\n", *tag_ptr);
@@ -281,11 +413,23 @@ static jvmtiIterationControl JNICALL heabObjectReferencesCallback(jvmtiObjectRef
 		return JVMTI_ITERATION_IGNORE;
 	}
 
+	/* Only objects met for the first time count against the budget */
+	auto walk = static_cast<ReferenceWalk*>(user_data);
+	if (*tag_ptr == 0 && !spendWalkBudget(walk->budget, size))
+	{
+		return JVMTI_ITERATION_ABORT;
+	}
+
 	auto t = pointerToTag(*tag_ptr);
 	auto rbt = pointerToTag(referrer_tag);
  	*tag_ptr = tagToPointer(t);
 		
+	TagEdge edge;
+	edge.kind = reference_kind;
+	edge.index = referrer_index;
+
 	rbt->ref_next_tags.push_back(t);
+	rbt->ref_next_edges.push_back(edge);
 	t->ref_back_tags.push_back(rbt);
 	
 	auto kind = getObjRefKind(reference_kind);
@@ -293,9 +437,9 @@ static jvmtiIterationControl JNICALL heabObjectReferencesCallback(jvmtiObjectRef
 
 	if (strcmp(t->name,"new") == 0)
 	{
+		t->size = size;
  		//store all tags
-		std::vector<jlong>* tag_ptr_list = (std::vector<jlong>*)(ptrdiff_t)(void*)user_data;
-		(*tag_ptr_list).push_back(*tag_ptr);		
+		walk->tags.push_back(*tag_ptr);		
 	}	
 	return JVMTI_ITERATION_CONTINUE;
 }
@@ -307,75 +451,145 @@ void callGC()
 	check_jvmti_error(gdata->jvmti, error, "force garbage collection");
 }
 
-char* getClassSignature(JNIEnv* env, jobject object)
+/* Holds gdata->lock for the scope of a heap walk */
+struct AgentDataLock
 {
-	char* classSignature;		
-	gdata->jvmti->GetClassSignature(env->GetObjectClass(object), &classSignature, nullptr);	
-	return  classSignature;
+	AgentDataLock()
+	{
+		jvmtiError err = gdata->jvmti->RawMonitorEnter(gdata->lock);
+		check_jvmti_error(gdata->jvmti, err, "enter agent data lock");
+	}
+
+	~AgentDataLock()
+	{
+		gdata->jvmti->RawMonitorExit(gdata->lock);
+	}
+};
+
+/* The GC before a budgeted walk, skipped while walks are limited. Call
+ *   with gdata->lock held. */
+static void collectBeforeWalk()
+{
+	if (walkLimited(&gdata->walkLimits))
+	{
+		stdout_message("Forced GC skipped, heap walks are budgeted\n");
+		return;
+	}
+	callGC();
 }
 
-void updateTag(JNIEnv* env, jobject object)
+/* Starts the budget of a heap walk with the configured limits. Call with
+ *   gdata->lock held. */
+static WalkBudget* startWalk(WalkBudget* budget)
 {
-	char* objectSignature = getClassSignature(env, object);
-	jint hashCode;
-	gdata->jvmti->GetObjectHashCode(object, &hashCode);
-	strcat(objectSignature, std::to_string((long long) hashCode).c_str());
+	startWalkBudget(budget, &gdata->walkLimits);
+	return budget;
+}
 
-	jlong tag_ptr;
-	gdata->jvmti->GetTag(object, &tag_ptr);
+/* Hands the coverage of a walk to the walkCoverage field of the Heapview
+ *   that asked for it, within the same call, so concurrent queries never
+ *   see each other's */
+static void returnWalkCoverage(JNIEnv* env, jobject callerObject, const WalkBudget* budget)
+{
+	jclass klass = env->GetObjectClass(callerObject);
+	jfieldID field = env->GetFieldID(klass, "walkCoverage", "I");
 
-	Tag* tag = (Tag*)(ptrdiff_t)(void*)tag_ptr;
-	tag->name = objectSignature;	
+	env->DeleteLocalRef(klass);
+	if (field == nullptr)
+	{
+		env->ExceptionClear();
+		return;
+	}
+	env->SetIntField(callerObject, field, walkCoverage(budget));
 }
 
-static jint level;
-
-void printRefNextTags(std::vector<Tag*> tagList)
+/* The published snapshot to estimate the coverage of a walk the budget
+ *   stopped, nullptr after a complete walk or without a snapshot */
+static PublishedSnapshot* partialWalkSnapshot(const WalkBudget* budget)
 {
-	if (tagList.size() > 0)
-	{
-		level++;
-		auto index = 1;
-		stdout_message("has %d refs:\n", tagList.size());	
-		for (std::vector<Tag*>::iterator it = tagList.begin(); it != tagList.end(); ++it)
-		{
-			stdout_message(" %s|--> %d. ",std::string(level, ' '), index++);
-			printTag(*it);			
-		}
-		level--;
-	} else
-	{
-		stdout_message("\n");	
-	}	
+	return budget->exhausted ? acquireSnapshot(gdata->snapshots) : nullptr;
 }
 
-void printTag(Tag* tag)
+/* Prints the partial result marker of a walk over the whole heap, the
+ *   coverage estimated by expected on the published snapshot */
+static void reportPartialWalk(WalkBudget* budget, uint64_t (*expected)(const HeapSnapshot*), const char* walk)
 {
-	if (tag != nullptr)
+	PublishedSnapshot* published = partialWalkSnapshot(budget);
+	if (published != nullptr)
 	{
-		stdout_message("obj: %s ", tag->name);	
-		
-		if (tag->isArray && tag->value != nullptr)
-		{
-			//stdout_message("val: %s", tag->value);		
-		}
-		
- 		printRefNextTags(tag->ref_next_tags);								
+		budget->expected = expected(&published->snapshot);
+		releaseSnapshot(published);
 	}
-	else
+	reportWalkBudget(budget, walk);
+}
+
+/* Takes a snapshot with a copy of the class table and publishes it, the
+ *   caller gets a reference. Call with gdata->lock held. */
+static PublishedSnapshot* captureAndPublish(JNIEnv* env)
+{
+	PublishedSnapshot* published = new PublishedSnapshot();
+
+	callGC();
+
+	refreshClassTable(gdata->analysis, env, gdata->classes);
+	captureHeapSnapshot(gdata->analysis, gdata->classes, &published->snapshot);
+	std::shared_ptr<const ClassTable>& shared = *gdata->publishedClasses;
+	if (shared == nullptr || shared->version != gdata->classes->version)
 	{
-		stdout_message("tag is null.");	
+		shared = std::make_shared<const ClassTable>(*gdata->classes);
 	}
+	published->classes = shared;
+	return publishSnapshot(gdata->snapshots, published);
 }
 
-void printObject(JNIEnv* env, jobject object)
+/* The caller deallocates the signature */
+char* getClassSignature(JNIEnv* env, jobject object)
+{
+	char* classSignature = nullptr;
+	jclass klass = env->GetObjectClass(object);
+	gdata->jvmti->GetClassSignature(klass, &classSignature, nullptr);
+	env->DeleteLocalRef(klass);
+	return  classSignature;
+}
+
+/* Class tag of the object's class in the analysis environment */
+jlong getClassTag(JNIEnv* env, jobject object)
+{
+	jlong class_tag = 0;
+	jclass klass = env->GetObjectClass(object);
+	gdata->analysis->GetTag(klass, &class_tag);
+	env->DeleteLocalRef(klass);
+	return isClassTag(class_tag) ? class_tag : 0;
+}
+
+/* Default bounds of the printed reference graph */
+static const jint kRenderDepth = 16;
+static const jint kRenderChildren = 32;
+
+/* Renders the Tag graph of a collected object, returns the Tags rendered
+ *   or -1 when the object has no Tag */
+static jint renderObject(JNIEnv* env, jobject object, const RenderOptions* options)
 {
 	jlong tag_ptr;
 	gdata->jvmti->GetTag(object, &tag_ptr);
 	Tag* tag = (Tag*)(ptrdiff_t)(void*)tag_ptr;
+	RenderSink sink;
 
-	level = 1;
-	printTag(tag);	
+	if (tag == nullptr)
+	{
+		stdout_message("tag is null.\n");
+		return -1;
+	}
+	initRenderSink(&sink, 64 * 1024);
+	jint rendered = renderTagGraph(tag, gdata->classes, options, &sink);
+	stdout_message("\nrendered %d objects\n", rendered);
+	return rendered;
+}
+
+void printObject(JNIEnv* env, jobject object)
+{
+	RenderOptions options = { kRenderText, kRenderDepth, kRenderChildren };
+	renderObject(env, object, &options);
 }
 
 jlong setTag(Tag* t, jobject object)
@@ -388,16 +602,28 @@ jlong setTag(Tag* t, jobject object)
 	return tag_ptr;
 }
 
+/* Name of a Tag, the class signature followed by the identity hash */
+static char* makeTagName(const char* signature, jint hashCode)
+{
+	std::string name = std::string(signature) + std::to_string((long long) hashCode);
+	char* buf = new char[name.size() + 1];
+
+	memcpy(buf, name.c_str(), name.size() + 1);
+	return buf;
+}
+
 //----------------------------------------------------------
 jlong addNewTag(jobject object, JNIEnv *env)
 {	
 	char * signature = getClassSignature(env, object);
-	jint hashCode;
+	jint hashCode = 0;
 	gdata->jvmti->GetObjectHashCode(object, &hashCode);
-	strcat(signature, std::to_string((long long) hashCode).c_str());
  
  	auto t = new Tag();
-	t->name = signature;
+	t->name = makeTagName(signature != nullptr ? signature : "?", hashCode);
+	deallocate(gdata->jvmti, reinterpret_cast<unsigned char*>(signature));
+	t->classTag = getClassTag(env, object);
+	gdata->jvmti->GetObjectSize(object, &t->size);
 
 	return setTag(t, object);
 }
@@ -412,83 +638,145 @@ jlong addNewTag(char* className, JNIEnv *env)
 	return setTag(t, klass);
 }
 //----------------------------------------------------------
-void getAllTaggedObjects(JNIEnv* env, std::vector<jlong> tag_ptr_list, jint * out_count, jobject** out_objects, jlong** out_tags, jint level)
+/* Tags resolved per GetObjectsWithTags call. Bounds the local references
+ *   and JVMTI buffers alive at once however large the reachable set is. */
+static const jint kResolveChunk = 1024;
+
+/* Names the Tag of a resolved object and keeps the value of char arrays.
+ *   Signature and array-ness come from the class table, only classes not
+ *   in it yet are asked for. */
+static void resolveTag(JNIEnv* env, jobject object, Tag* tag, std::vector<jchar>& chars)
 {
-	if (tag_ptr_list.size() > 0) {
-		jint found_count = 0;
-		jlong* tags = &tag_ptr_list[0];
-		jobject* found_objects;
-		jlong* found_tags;
+	jlong class_tag = 0;
+	jint hashCode = 0;
+	jclass klass = env->GetObjectClass(object);
+	const ClassInfo* info;
+	char primitiveArrayType = 0;
 
-		gdata->jvmti->GetObjectsWithTags(tag_ptr_list.size(), tags, &found_count, &found_objects, &found_tags);
-	
-		stdout_message("%s found count %d\n", std::string(level, ' '), found_count);
+	gdata->analysis->GetTag(klass, &class_tag);
+	gdata->jvmti->GetObjectHashCode(object, &hashCode);
+	info = findClassInfo(gdata->classes, class_tag);
+	if (info != nullptr)
+	{
+		tag->name = makeTagName(info->signature.c_str(), hashCode);
+		tag->classTag = class_tag;
+		primitiveArrayType = info->primitiveArrayType;
+	}
+	else
+	{
+		char* signature = nullptr;
+		gdata->jvmti->GetClassSignature(klass, &signature, nullptr);
+		tag->name = makeTagName(signature != nullptr ? signature : "?", hashCode);
+		tag->classTag = 0;
+		if (signature != nullptr && signature[0] == '[' && signature[2] == '\0')
+		{
+			primitiveArrayType = signature[1];
+		}
+		deallocate(gdata->jvmti, reinterpret_cast<unsigned char*>(signature));
+	}
+	env->DeleteLocalRef(klass);
+
+	tag->isArray = false;
+	if (primitiveArrayType == 'C')
+	{
+		jsize length = env->GetArrayLength((jcharArray)object);
+		char* buf = new char[length + 1];
+
+		chars.resize(size_t(length));
+		if (length > 0)
+		{
+			env->GetCharArrayRegion((jcharArray)object, 0, length, &chars[0]);
+		}
+		for (jsize j = 0; j < length; ++j)
+		{
+			buf[j] = char(chars[j]);
+		}
+		buf[length] = '\0';
 
-		for (auto i = 0; i < found_count; ++i)
+		tag->isArray = true;
+		tag->value = buf;
+
+		stdout_message("val:%s\n", tag->value);
+	}
+}
+
+/* Resolves the objects of the collected Tag pointers chunk by chunk, each
+ *   in a local frame of its own. Returns the number of objects found. */
+jint getAllTaggedObjects(JNIEnv* env, const std::vector<jlong>& tag_ptr_list, jint level)
+{
+	jint total = 0;
+	std::vector<jchar> chars;
+
+	for (size_t first = 0; first < tag_ptr_list.size(); first += size_t(kResolveChunk))
+	{
+		jint chunk = jint(std::min(tag_ptr_list.size() - first, size_t(kResolveChunk)));
+		jint found_count = 0;
+		jobject* found_objects = nullptr;
+		jlong* found_tags = nullptr;
+		jvmtiError err;
+
+		/* The found objects plus the class of the one being resolved */
+		if (env->PushLocalFrame(chunk + 1) != 0)
 		{
-			jobject found_object = found_objects[i];
-			Tag* found_tag = pointerToTag(found_tags[i]);
-
-			updateTag(env, found_object);		
-
-     		found_tag->isArray = false;
-			jboolean isArrayClass;
-			gdata->jvmti->IsArrayClass(env->GetObjectClass(found_object), &isArrayClass);
-			
-			if (isArrayClass)
-			{					
-				if (strstr(found_tag->name, "[C") != nullptr)
-				{
-					jint lenght = env->GetArrayLength((jcharArray)found_object);
-					char* buf = new char[lenght + 1];
-					jboolean isCopy;
-					jchar* value = env->GetCharArrayElements((jcharArray)found_object, &isCopy);
-					for (auto j = 0; j < lenght; ++j){ buf[j] = value[j];}
-					buf[lenght] = '\0';				
-				
-					found_tag->isArray = true;
-					found_tag->value = buf;
-					found_tag->value[lenght] = '\0';
-
-					stdout_message("val:%s\n", found_tag->value);
-				}				
-			}						
+			stdout_message("ERROR: no room for %d local references\n", chunk + 1);
+			break;
 		}
+		err = gdata->jvmti->GetObjectsWithTags(chunk, &tag_ptr_list[first], &found_count, &found_objects, &found_tags);
+		check_jvmti_error(gdata->jvmti, err, "get objects with tags");
 
-		/*
-		for (auto i = 0; i < found_count; ++i)
+		for (jint i = 0; i < found_count; ++i)
 		{
-			jobject found_object = found_objects[i];
-			printObject(env, found_object);
+			resolveTag(env, found_objects[i], pointerToTag(found_tags[i]), chars);
 		}
-		*/
-	
-		*out_count = found_count;
-		*out_objects = found_objects;
-		*out_tags = found_tags;
+		total += found_count;
+
+		deallocate(gdata->jvmti, reinterpret_cast<unsigned char*>(found_objects));
+		deallocate(gdata->jvmti, reinterpret_cast<unsigned char*>(found_tags));
+		env->PopLocalFrame(nullptr);
 	}
+
+	stdout_message("%s found count %d\n", std::string(level, ' ').c_str(), total);
+	return total;
 }
 
 void iterateOverObjects(JNIEnv* env, jobject object, jint level)
 {
-	std::vector<jlong> tag_ptr_list;
+	ReferenceWalk walk;
+	WalkBudget budget;
+	walk.budget = startWalk(&budget);
 
-	stdout_message("%s tag list size  %d\n", std::string(level, ' '),  tag_ptr_list.size());
-	gdata->jvmti->IterateOverObjectsReachableFromObject(object, &heabObjectReferencesCallback, (void*)&tag_ptr_list);
-	stdout_message("%s tag list size  %d\n", std::string(level, ' '), tag_ptr_list.size());
+	stdout_message("%s tag list size  %d\n", std::string(level, ' ').c_str(),  walk.tags.size());
+	gdata->jvmti->IterateOverObjectsReachableFromObject(object, &heabObjectReferencesCallback, (void*)&walk);
+	finishWalkBudget(walk.budget);
+	stdout_message("%s tag list size  %d\n", std::string(level, ' ').c_str(), walk.tags.size());
 
-	jint found_count = 0;
-	jobject* found_objects;
-	jlong* found_tags;
+	getAllTaggedObjects(env, walk.tags, level);
 
-	getAllTaggedObjects(env, tag_ptr_list, &found_count, &found_objects, &found_tags, level);
+	PublishedSnapshot* published = partialWalkSnapshot(walk.budget);
+	if (published != nullptr)
+	{
+		jlong node_tag = 0;
+		gdata->analysis->GetTag(object, &node_tag);
+		NodeId node = nodeOfTag(&published->snapshot.graph, published->snapshot.generation, node_tag);
+		if (node != kNoNode)
+		{
+			walk.budget->expected = snapshotReachable(&published->snapshot, node);
+		}
+		releaseSnapshot(published);
+	}
+	reportWalkBudget(walk.budget, "references");
 }
 
-JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_references(JNIEnv *env, jobject callerObject, jobject object)
+/* Tags the object and everything reachable from it with the reference
+ *   graph. Call with gdata->lock held. */
+static void collectReferences(JNIEnv* env, jobject object)
 {
 	stdout_message("param obj %d\n", object);
 	
-	callGC();
+	collectBeforeWalk();
+
+	/* Field layouts for the edge labels */
+	refreshClassTable(gdata->analysis, env, gdata->classes);
 		
 	std::vector<jlong> tag_ptr_list;	
 	
@@ -499,12 +787,36 @@ JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_references(JNIEnv *en
 	iterateOverObjects(env, object, level);
 
 	stdout_message("\n");
+}
+
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_references(JNIEnv *env, jobject callerObject, jobject object)
+{
+	AgentDataLock lock;
+
+	collectReferences(env, object);
 	printObject(env, object);
 	
 	return 0;
 
 }
 
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_renderReferences(JNIEnv* env, jobject callerObject, jobject object,
+                                                                         jint format, jint maxDepth, jint maxChildren)
+{
+	AgentDataLock lock;
+
+	if (format < kRenderText || format > kRenderDot)
+	{
+		stdout_message("ERROR: unknown render format %d\n", format);
+		return -1;
+	}
+
+	collectReferences(env, object);
+
+	RenderOptions options = { RenderFormat(format), maxDepth, maxChildren };
+	return renderObject(env, object, &options);
+}
+
 void printCapabilities(jvmtiCapabilities capabilities)
 {
 	stdout_message("\n Capabilities:\n \
@@ -594,17 +906,21 @@ void printCapabilities(jvmtiCapabilities capabilities)
 
 JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_instances(JNIEnv *env, jobject callerObject)
 {
+	AgentDataLock lock;
 	jclass klass;
 	jvmtiError err;
 
-	callGC();
+	collectBeforeWalk();
 
 	stdout_message("Incstances:\n\n");
 
 	klass = env->FindClass(gClassName);
 	stdout_message("Viewed class %s %d\n", gClassName, klass);	
 
-	auto count = 0;
+	InstanceWalk walk;
+	WalkBudget budget;
+	walk.count = 0;
+	walk.budget = startWalk(&budget);
 
 	if (klass != nullptr)
 	{
@@ -614,11 +930,434 @@ JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_instances(JNIEnv *env
 		stdout_message("tag to jklass %d\n", tag_ptr);
 		gdata->jvmti->SetTag(klass, tag_ptr);
 
-		err = gdata->jvmti->IterateOverInstancesOfClass(klass, JVMTI_HEAP_OBJECT_UNTAGGED, &heabObjectCallback, &count);
+		err = gdata->jvmti->IterateOverInstancesOfClass(klass, JVMTI_HEAP_OBJECT_UNTAGGED, &heabObjectCallback, &walk);
 		check_jvmti_error(gdata->jvmti, err, "iterate over instances of class");
+		finishWalkBudget(walk.budget);
+
+		PublishedSnapshot* published = partialWalkSnapshot(walk.budget);
+		if (published != nullptr)
+		{
+			jlong class_tag = 0;
+			gdata->analysis->GetTag(klass, &class_tag);
+			if (isClassTag(class_tag))
+			{
+				walk.budget->expected = snapshotInstances(&published->snapshot, uint32_t(class_tag));
+			}
+			releaseSnapshot(published);
+		}
+		reportWalkBudget(walk.budget, "instances");
 	}
 
-	return count;
+	returnWalkCoverage(env, callerObject, walk.budget);
+	return walk.count;
+}
+
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_duplicates(JNIEnv *env, jobject callerObject, jint top)
+{
+	AgentDataLock lock;
+
+	collectBeforeWalk();
+
+	stdout_message("Duplicates:\n\n");
+
+	WalkBudget budget;
+	jint duplicates = reportDuplicateArrays(gdata->jvmti, top, startWalk(&budget));
+	reportPartialWalk(&budget, &snapshotObjects, "duplicates");
+	returnWalkCoverage(env, callerObject, &budget);
+	return duplicates;
+}
+
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_sparseArrays(JNIEnv *env, jobject callerObject, jint top)
+{
+	AgentDataLock lock;
+
+	collectBeforeWalk();
+
+	stdout_message("Sparse arrays:\n\n");
+
+	refreshClassTable(gdata->analysis, env, gdata->classes);
+	WalkBudget budget;
+	jint arrays = reportSparseArrays(gdata->analysis, gdata->classes, top, startWalk(&budget));
+	reportPartialWalk(&budget, &snapshotReferences, "sparse arrays");
+	returnWalkCoverage(env, callerObject, &budget);
+	return arrays;
+}
+
+/* The snapshot reports run on the snapshot they publish, after the lock
+ *   is left, so the next walk can start while they print */
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_retainedByField(JNIEnv *env, jobject callerObject, jint top)
+{
+	PublishedSnapshot* published;
+	jint fields;
+
+	stdout_message("Retained by field:\n\n");
+	{
+		AgentDataLock lock;
+		published = captureAndPublish(env);
+	}
+	fields = reportRetainedByField(&published->snapshot, published->classes.get(), top);
+	releaseSnapshot(published);
+	return fields;
+}
+
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_classLoaders(JNIEnv *env, jobject callerObject, jint top)
+{
+	PublishedSnapshot* published;
+	jint leaks;
+
+	stdout_message("Class loaders:\n\n");
+	{
+		AgentDataLock lock;
+		published = captureAndPublish(env);
+	}
+	leaks = reportClassLoaders(&published->snapshot, published->classes.get(), top);
+	releaseSnapshot(published);
+	return leaks;
+}
+
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_threadRetention(JNIEnv *env, jobject callerObject, jint top)
+{
+	AgentDataLock lock;
+	PublishedSnapshot* published;
+	jint threads;
+
+	stdout_message("Retained by thread:\n\n");
+
+	/* Thread objects are found by their node tags, no other walk may
+	 *   retag them before the report is done */
+	published = captureAndPublish(env);
+	threads = reportThreadRetention(gdata->analysis, env, &published->snapshot, published->classes.get(), top);
+	releaseSnapshot(published);
+	return threads;
+}
+
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_saveSnapshot(JNIEnv *env, jobject callerObject, jstring path)
+{
+	PublishedSnapshot* published;
+	const char* file;
+	bool written;
+	jint objects;
+
+	file = env->GetStringUTFChars(path, nullptr);
+	if (file == nullptr)
+	{
+		return -1;
+	}
+	{
+		AgentDataLock lock;
+		published = captureAndPublish(env);
+	}
+	objects = jint(graphNodeCount(&published->snapshot.graph) - 1);
+	written = writeSnapshotFile(file, &published->snapshot, published->classes.get());
+	if (written)
+	{
+		stdout_message("Snapshot of %d objects written to %s\n", int(objects), file);
+	}
+	env->ReleaseStringUTFChars(path, file);
+	releaseSnapshot(published);
+
+	return written ? objects : -1;
+}
+
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_publishSnapshot(JNIEnv *env, jobject callerObject)
+{
+	PublishedSnapshot* published;
+	jint objects;
+	{
+		AgentDataLock lock;
+		published = captureAndPublish(env);
+	}
+	objects = jint(graphNodeCount(&published->snapshot.graph) - 1);
+	stdout_message("Snapshot #%lld of %d objects published\n", (long long)published->sequence, int(objects));
+	releaseSnapshot(published);
+	return objects;
+}
+
+/* Reads the published snapshot without walking the heap or taking the
+ *   lock, any number of threads may call it while a walk runs */
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_snapshotSummary(JNIEnv *env, jobject callerObject, jint top)
+{
+	PublishedSnapshot* published = acquireSnapshot(gdata->snapshots);
+	std::vector<ClassHistogramEntry> histogram;
+	const HeapGraph* graph;
+	jint objects;
+
+	if (published == nullptr)
+	{
+		stdout_message("No snapshot published yet\n");
+		return -1;
+	}
+	graph = &published->snapshot.graph;
+	objects = jint(graphNodeCount(graph) - 1);
+	stdout_message("Snapshot #%lld, %d objects, %d threads, %lld bytes reachable\n\n",
+		(long long)published->sequence, int(objects), int(published->snapshot.threads.size()),
+		(long long)published->snapshot.dominators.retained[kRootNode]);
+
+	computeClassHistogram(graph, &published->snapshot.dominators, &histogram);
+	size_t shown = std::min(histogram.size(), size_t(top > 0 ? top : 0));
+	stdout_message("Classes with instances: %d\n", int(histogram.size()));
+	for (size_t i = 0; i < shown; ++i)
+	{
+		stdout_message(" %3d. %-60s instances %10lld, shallow %14lld bytes, largest retained %14lld bytes\n",
+		               int(i + 1), classNameOf(published->classes.get(), histogram[i].classId), (long long)histogram[i].instances,
+		               (long long)histogram[i].shallow, (long long)histogram[i].maxRetained);
+	}
+	releaseSnapshot(published);
+	return objects;
+}
+
+static void printLargeObjects(const PublishedSnapshot* published, const LargeObject* heap, uint32_t count, jint top)
+{
+	LargeObject sorted[kLargestObjects];
+	uint32_t shown = std::min(sortLargestObjects(heap, count, sorted), uint32_t(top > 0 ? top : 0));
+
+	for (uint32_t i = 0; i < shown; ++i)
+	{
+		const LargeObject* object = &sorted[i];
+		std::string length = object->length >= 0 ? ", length " + std::to_string((long long)object->length) : "";
+
+		stdout_message(" %3d. #%-10u tag 0x%016llx %-50s %14lld bytes, retained %14lld%s\n", int(i + 1),
+		               unsigned(object->node), (unsigned long long)object->tag,
+		               classNameOf(published->classes.get(), object->classId), (long long)object->size,
+		               (long long)published->snapshot.dominators.retained[object->node], length.c_str());
+	}
+}
+
+/* Largest instances and arrays of the published snapshot, by node id and
+ *   the node tag they keep until the next capture */
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_largestObjects(JNIEnv *env, jobject callerObject, jint top)
+{
+	PublishedSnapshot* published = acquireSnapshot(gdata->snapshots);
+	const LargestObjects* largest;
+
+	if (published == nullptr)
+	{
+		stdout_message("No snapshot published yet\n");
+		return -1;
+	}
+	largest = &published->snapshot.largest;
+	stdout_message("Snapshot #%lld, largest instances:\n", (long long)published->sequence);
+	printLargeObjects(published, largest->objects, largest->objectCount, top);
+	stdout_message("\nLargest arrays:\n");
+	printLargeObjects(published, largest->arrays, largest->arrayCount, top);
+
+	jint kept = jint(largest->objectCount + largest->arrayCount);
+	releaseSnapshot(published);
+	return kept;
+}
+
+/* Collection overhead of the published snapshot, lock free */
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_collectionOverhead(JNIEnv *env, jobject callerObject, jint top)
+{
+	PublishedSnapshot* published = acquireSnapshot(gdata->snapshots);
+
+	if (published == nullptr)
+	{
+		stdout_message("No snapshot published yet\n");
+		return -1;
+	}
+	stdout_message("Snapshot #%lld, ", (long long)published->sequence);
+	jint collections = reportCollectionOverhead(&published->snapshot.graph, &published->snapshot.collections,
+	                                            published->classes.get(), top);
+	releaseSnapshot(published);
+	return collections;
+}
+
+JNIEXPORT jstring JNICALL Java_org_zheltkov_heapview_Heapview_browseEdges(JNIEnv *env, jobject callerObject, jint node,
+                                                                       jboolean incoming, jboolean byRetained, jint limit,
+                                                                       jstring cursor)
+{
+	PublishedSnapshot* published = acquireSnapshot(gdata->snapshots);
+	BrowseRequest request;
+	std::string page;
+
+	if (published == nullptr)
+	{
+		return env->NewStringUTF("{\"error\":\"no snapshot published\"}");
+	}
+
+	request.node = node >= 0 ? NodeId(node) : kNoNode;
+	request.direction = incoming ? kBrowseIn : kBrowseOut;
+	request.order = byRetained ? kByRetained : kByShallow;
+	request.limit = uint32_t(limit > 0 ? limit : 0);
+	if (cursor != nullptr)
+	{
+		const char* text = env->GetStringUTFChars(cursor, nullptr);
+		if (text != nullptr)
+		{
+			request.cursor = text;
+			env->ReleaseStringUTFChars(cursor, text);
+		}
+	}
+
+	browseEdges(published, &request, &page);
+	releaseSnapshot(published);
+	return env->NewStringUTF(page.c_str());
+}
+
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_filterObjects(JNIEnv *env, jobject callerObject, jstring expression, jint top)
+{
+	AgentDataLock lock;
+	HeapFilter filter;
+	std::string error;
+	const char* text;
+	bool compiled;
+
+	collectBeforeWalk();
+
+	refreshClassTable(gdata->analysis, env, gdata->classes);
+
+	text = env->GetStringUTFChars(expression, nullptr);
+	if (text == nullptr)
+	{
+		return -1;
+	}
+	stdout_message("Objects matching %s:\n\n", text);
+	compiled = compileHeapFilter(text, gdata->classes, &filter, &error);
+	env->ReleaseStringUTFChars(expression, text);
+
+	if (!compiled)
+	{
+		stdout_message("ERROR: %s\n", error.c_str());
+		return -1;
+	}
+	WalkBudget budget;
+	jint matched = reportFilteredObjects(gdata->analysis, &filter, gdata->classes, top, startWalk(&budget));
+	reportPartialWalk(&budget, filter.referenceKinds != 0 ? &snapshotReferences : &snapshotObjects, "filter");
+	returnWalkCoverage(env, callerObject, &budget);
+	return matched;
+}
+
+/* Size accounting, class histogram, largest objects and duplicates in a
+ *   single heap walk, of the objects matching filter when it is not empty */
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_dashboard(JNIEnv *env, jobject callerObject, jstring expression, jint top)
+{
+	AgentDataLock lock;
+	HeapFilter filter;
+	std::string error;
+	const char* text;
+	bool filtered;
+	bool compiled = true;
+
+	collectBeforeWalk();
+
+	refreshClassTable(gdata->analysis, env, gdata->classes);
+
+	text = env->GetStringUTFChars(expression, nullptr);
+	if (text == nullptr)
+	{
+		return -1;
+	}
+	filtered = text[0] != 0;
+	if (filtered)
+	{
+		stdout_message("Heap dashboard of objects matching %s:\n\n", text);
+		compiled = compileHeapFilter(text, gdata->classes, &filter, &error);
+		if (compiled && !isShapeFilter(&filter))
+		{
+			error = "only class, size and length clauses can share the walk";
+			compiled = false;
+		}
+	}
+	else
+	{
+		stdout_message("Heap dashboard:\n\n");
+	}
+	env->ReleaseStringUTFChars(expression, text);
+
+	if (!compiled)
+	{
+		stdout_message("ERROR: %s\n", error.c_str());
+		return -1;
+	}
+	WalkBudget budget;
+	jint objects = reportHeapDashboard(gdata->analysis, filtered ? &filter : nullptr, gdata->classes, top, startWalk(&budget));
+	reportPartialWalk(&budget, &snapshotObjects, "dashboard");
+	returnWalkCoverage(env, callerObject, &budget);
+	return objects;
+}
+
+/* Limits every budgeted heap walk, 0 for no limit */
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_walkBudget(JNIEnv *env, jobject callerObject, jint millis, jint objects)
+{
+	AgentDataLock lock;
+
+	gdata->walkLimits.millis = millis > 0 ? millis : 0;
+	gdata->walkLimits.objects = objects > 0 ? objects : 0;
+	stdout_message("Heap walk budget: %d ms, %d objects\n", gdata->walkLimits.millis, gdata->walkLimits.objects);
+	return 0;
+}
+
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_telemetry(JNIEnv *env, jobject callerObject, jint last)
+{
+	return reportTelemetry(gdata->jvmti, gdata->telemetry, last);
+}
+
+/* Writes an emergency snapshot now, the one written on exhaustion is kept
+ *   armed */
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_emergencySnapshot(JNIEnv *env, jobject callerObject)
+{
+	return jint(writeEmergencySnapshot(gdata->emergency, gdata->analysis, env, gdata->snapshots,
+	                                   gdata->emergencySnapshot, "requested"));
+}
+
+/* Watches the fields of the classes matching pattern for seconds, then
+ *   clears the watches and prints the hits by field and method */
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_watchFields(JNIEnv *env, jobject callerObject, jstring pattern, jint seconds, jint top)
+{
+	const char* text;
+	jint watched;
+
+	text = env->GetStringUTFChars(pattern, nullptr);
+	if (text == nullptr)
+	{
+		return -1;
+	}
+	{
+		AgentDataLock lock;
+
+		refreshClassTable(gdata->analysis, env, gdata->classes);
+		watched = startFieldWatches(gdata->jvmti, gdata->analysis, env, gdata->fieldWatch, gdata->classes, text);
+	}
+	if (watched <= 0)
+	{
+		stdout_message(watched < 0 ? "A field watch is running already\n" : "No fields of classes matching %s\n", text);
+		env->ReleaseStringUTFChars(pattern, text);
+		return -1;
+	}
+	stdout_message("Watching %d fields of classes matching %s for %d s\n", int(watched), text, int(seconds));
+	env->ReleaseStringUTFChars(pattern, text);
+
+	waitFieldWatches(gdata->jvmti, gdata->fieldWatch, seconds);
+	stopFieldWatches(gdata->jvmti, env, gdata->fieldWatch);
+
+	AgentDataLock lock;
+	return reportFieldHits(gdata->jvmti, gdata->analysis, env, gdata->fieldWatch, gdata->classes, top);
+}
+
+/* Samples allocations every intervalKB kilobytes on average, 0 stops it */
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_trackAges(JNIEnv *env, jobject callerObject, jint intervalKB)
+{
+	jint interval = intervalKB > 0 ? intervalKB * 1024 : 0;
+
+	if (!setAgeSampling(gdata->jvmti, gdata->ages, interval))
+	{
+		stdout_message("Allocation sampling is not available in this VM\n");
+		return -1;
+	}
+	return 0;
+}
+
+JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_objectAges(JNIEnv *env, jobject callerObject, jint top)
+{
+	AgentDataLock lock;
+
+	refreshClassTable(gdata->analysis, env, gdata->classes);
+	WalkBudget budget;
+	jint stamped = reportObjectAges(gdata->analysis, gdata->ages, gdata->classes, top, startWalk(&budget));
+	reportPartialWalk(&budget, &snapshotObjects, "object ages");
+	returnWalkCoverage(env, callerObject, &budget);
+	return stamped;
 }
 
 /* Agent_OnLoad() is called first, we prepare for a VM_INIT event here. */
@@ -630,7 +1369,15 @@ Agent_OnLoad(JavaVM* vm, char* options, void* reserved)
 	jvmtiError err;
 	jvmtiEventCallbacks callbacks;
 	jvmtiCapabilities capabilities;
+	jvmtiCapabilities potential;
+	bool sampling;
 	jvmtiEnv* jvmti;
+	jvmtiEnv* analysis;
+	jvmtiEnv* emergency;
+	char token[1024];
+	char emergencyPath[1024] = "jvmws-emergency.txt";
+	jint agesKB = 0;
+	char* next;
 
 
 	(void)memset(static_cast<void*>(&data), 0, sizeof(data));
@@ -646,6 +1393,9 @@ Agent_OnLoad(JavaVM* vm, char* options, void* reserved)
 	/* Here we save the jvmtiEnv* for Agent_OnUnload(). */
 	gdata->jvmti = jvmti;
 
+	err = jvmti->CreateRawMonitor("agent data", &gdata->lock);
+	check_jvmti_error(jvmti, err, "create agent data lock");
+
 	/* Immediately after getting the jvmtiEnv* we need to ask for the
 	*   capabilities this agent will need.
 	*/
@@ -657,15 +1407,107 @@ Agent_OnLoad(JavaVM* vm, char* options, void* reserved)
 	capabilities.can_get_line_numbers = 1;
 	capabilities.can_generate_vm_object_alloc_events = 1;
 	capabilities.can_generate_field_access_events = 1;
+	capabilities.can_generate_field_modification_events = 1;
+	capabilities.can_generate_garbage_collection_events = 1;
+	capabilities.can_generate_resource_exhaustion_heap_events = 1;
+	capabilities.can_generate_resource_exhaustion_threads_events = 1;
+
+	/* Allocation sampling needs a JDK 11 VM, object ages are off without it */
+	(void)memset(&potential, 0, sizeof(potential));
+	jvmti->GetPotentialCapabilities(&potential);
+#ifdef JVMWS_SAMPLED_ALLOC
+	capabilities.can_generate_sampled_object_alloc_events = potential.can_generate_sampled_object_alloc_events;
+	sampling = potential.can_generate_sampled_object_alloc_events != 0;
+#else
+	sampling = false;
+#endif
 	err = jvmti->AddCapabilities(&capabilities);
 
 	//printCapabilities(capabilities);
 
 	check_jvmti_error(jvmti, err, "Unable to get necessary JVMTI capabilities.");
 
+	/* A second environment keeps the class and object tags of the heap
+	*   analyses apart from the Tag pointers set through the first one.
+	*/
+	rc = vm->GetEnv(reinterpret_cast<void **>(&analysis), JVMTI_VERSION);
+	if (rc != JNI_OK)
+	{
+		fatal_error("ERROR: Unable to create analysis jvmtiEnv, GetEnv failed, error=%d\n", rc);
+		return -1;
+	}
+	gdata->analysis = analysis;
+	gdata->classes = new ClassTable();
+	gdata->publishedClasses = new std::shared_ptr<const ClassTable>();
+
+	(void)memset(&capabilities, 0, sizeof(capabilities));
+	capabilities.can_tag_objects = 1;
+	err = analysis->AddCapabilities(&capabilities);
+	check_jvmti_error(analysis, err, "Unable to get analysis JVMTI capabilities.");
+
+	gdata->telemetry = new Telemetry();
+	initTelemetry(jvmti, gdata->telemetry);
+
+	gdata->snapshots = new SnapshotStore();
+	initSnapshotStore(gdata->snapshots);
+
+	gdata->fieldWatch = new FieldProfiler();
+	initFieldProfiler(jvmti, gdata->fieldWatch);
+
+	gdata->ages = new AgeTracker();
+	initAgeTracker(gdata->ages, sampling);
+
+	/* A third environment tags the classes for emergency snapshots, whose
+	*   memory is reserved now. Options: oom=PATH of the snapshot file,
+	*   ages=KB to sample allocation ages from the start, budget=MS to
+	*   bound the pause of every budgeted heap walk.
+	*/
+	rc = vm->GetEnv(reinterpret_cast<void **>(&emergency), JVMTI_VERSION);
+	if (rc != JNI_OK)
+	{
+		fatal_error("ERROR: Unable to create emergency jvmtiEnv, GetEnv failed, error=%d\n", rc);
+		return -1;
+	}
+	gdata->emergency = emergency;
+
+	(void)memset(&capabilities, 0, sizeof(capabilities));
+	capabilities.can_tag_objects = 1;
+	err = emergency->AddCapabilities(&capabilities);
+	check_jvmti_error(emergency, err, "Unable to get emergency JVMTI capabilities.");
+
+	next = get_token(options, ",", token, sizeof(token));
+	while (next != nullptr)
+	{
+		if (strncmp(token, "oom=", 4) == 0)
+		{
+			(void)snprintf(emergencyPath, sizeof(emergencyPath), "%s", token + 4);
+		}
+		else if (strncmp(token, "ages=", 5) == 0)
+		{
+			agesKB = jint(atoi(token + 5));
+		}
+		else if (strncmp(token, "budget=", 7) == 0)
+		{
+			gdata->walkLimits.millis = jint(atoi(token + 7));
+		}
+		next = get_token(next, ",", token, sizeof(token));
+	}
+	gdata->emergencySnapshot = new EmergencySnapshot();
+	reserveEmergencySnapshot(gdata->emergencySnapshot, emergencyPath);
+
 	/* Set callbacks and enable event notifications */
 	memset(&callbacks, 0, sizeof(callbacks));
 	callbacks.VMInit = &vm_init;
+	callbacks.VMDeath = &vm_death;
+	callbacks.GarbageCollectionStart = &gc_start;
+	callbacks.GarbageCollectionFinish = &gc_finish;
+	callbacks.ResourceExhausted = &resource_exhausted;
+#ifdef JVMWS_SAMPLED_ALLOC
+	callbacks.SampledObjectAlloc = &sampled_object_alloc;
+#endif
+	callbacks.FieldAccess = &field_access;
+	callbacks.FieldModification = &field_modification;
+	callbacks.ThreadEnd = &thread_end;
 
 	err = jvmti->SetEventCallbacks(&callbacks, sizeof(callbacks));
 	check_jvmti_error(jvmti, err, "set event callbacks");
@@ -673,6 +1515,26 @@ Agent_OnLoad(JavaVM* vm, char* options, void* reserved)
 	err = jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_VM_INIT, nullptr);
 	check_jvmti_error(jvmti, err, "set event notify");
 
+	err = jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_VM_DEATH, nullptr);
+	check_jvmti_error(jvmti, err, "set vm death notify");
+
+	err = jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_GARBAGE_COLLECTION_START, nullptr);
+	check_jvmti_error(jvmti, err, "set gc start notify");
+
+	err = jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_GARBAGE_COLLECTION_FINISH, nullptr);
+	check_jvmti_error(jvmti, err, "set gc finish notify");
+
+	err = jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_RESOURCE_EXHAUSTED, nullptr);
+	check_jvmti_error(jvmti, err, "set resource exhausted notify");
+
+	err = jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_THREAD_END, nullptr);
+	check_jvmti_error(jvmti, err, "set thread end notify");
+
+	if (agesKB > 0)
+	{
+		setAgeSampling(jvmti, gdata->ages, agesKB * 1024);
+	}
+
 	return JNI_OK;
 }
 
@@ -680,4 +1542,9 @@ Agent_OnLoad(JavaVM* vm, char* options, void* reserved)
 JNIEXPORT void JNICALL
 Agent_OnUnload(JavaVM* vm)
 {
+	clearSnapshotStore(gdata->snapshots);
+	delete gdata->classes;
+	gdata->classes = nullptr;
+	delete gdata->publishedClasses;
+	gdata->publishedClasses = nullptr;
 }
@@ -8,6 +8,12 @@
 #include <ibmjvmti.h>
 
 
+typedef struct TagEdge
+{
+	jvmtiObjectReferenceKind kind;
+	jint index;
+} TagEdge;
+
 typedef struct Tag
 {
 	jmethodID method;
@@ -16,12 +22,13 @@ typedef struct Tag
 	char* value;
 	jboolean isArray;
 	jint hashCode;	
+	jlong classTag;
+	jlong size;
 	std::vector<Tag*> ref_back_tags;	
 	std::vector<Tag*> ref_next_tags;
+	std::vector<TagEdge> ref_next_edges;
 } Tag;
 
-void printTag(Tag* tag);
-
 #ifdef __cplusplus
 extern "C"
 {
@@ -30,9 +37,65 @@ extern "C"
 	/* find references */
 	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_references(JNIEnv* env, jobject callerObject, jobject object);
 
+	/* render the references as text, JSON or DOT with depth and fan-out bounds */
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_renderReferences(JNIEnv* env, jobject callerObject, jobject object,
+	                                                                         jint format, jint maxDepth, jint maxChildren);
+
 	/* find instances */
 	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_instances(JNIEnv* env, jobject callerObject);
 
+	/* find duplicated array and String values */
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_duplicates(JNIEnv* env, jobject callerObject, jint top);
+
+	/* find zero-filled and oversized primitive arrays */
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_sparseArrays(JNIEnv* env, jobject callerObject, jint top);
+
+	/* find the fields retaining the most memory */
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_retainedByField(JNIEnv* env, jobject callerObject, jint top);
+
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_classLoaders(JNIEnv* env, jobject callerObject, jint top);
+
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_threadRetention(JNIEnv* env, jobject callerObject, jint top);
+
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_saveSnapshot(JNIEnv* env, jobject callerObject, jstring path);
+
+	/* take a snapshot and publish it for snapshotSummary */
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_publishSnapshot(JNIEnv* env, jobject callerObject);
+
+	/* class histogram of the published snapshot, lock free */
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_snapshotSummary(JNIEnv* env, jobject callerObject, jint top);
+
+	/* largest instances and arrays of the published snapshot */
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_largestObjects(JNIEnv* env, jobject callerObject, jint top);
+
+	/* empty and oversized collections of the published snapshot */
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_collectionOverhead(JNIEnv* env, jobject callerObject, jint top);
+
+	/* one page of a node's edges in the published snapshot, as JSON */
+	JNIEXPORT jstring JNICALL Java_org_zheltkov_heapview_Heapview_browseEdges(JNIEnv* env, jobject callerObject, jint node,
+	                                                                       jboolean incoming, jboolean byRetained, jint limit,
+	                                                                       jstring cursor);
+
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_filterObjects(JNIEnv* env, jobject callerObject, jstring expression, jint top);
+
+	/* several analyses in one heap walk */
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_dashboard(JNIEnv* env, jobject callerObject, jstring expression, jint top);
+
+	/* pause budget of the heap walks, each budgeted query leaves the
+	 * coverage of its walk in the walkCoverage field of its caller */
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_walkBudget(JNIEnv* env, jobject callerObject, jint millis, jint objects);
+
+	/* GC pause percentiles and heap occupancy samples of the telemetry thread */
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_telemetry(JNIEnv* env, jobject callerObject, jint last);
+
+	/* write an emergency snapshot now, as on heap or thread exhaustion */
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_emergencySnapshot(JNIEnv* env, jobject callerObject);
+	/* field access and modification hits over a time window */
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_watchFields(JNIEnv* env, jobject callerObject, jstring pattern, jint seconds, jint top);
+
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_trackAges(JNIEnv* env, jobject callerObject, jint intervalKB);
+	JNIEXPORT jint JNICALL Java_org_zheltkov_heapview_Heapview_objectAges(JNIEnv* env, jobject callerObject, jint top);
+
 	/* Agent_OnLoad() is called first, we prepare for a VM_INIT event here. */
 	JNIEXPORT jint JNICALL Agent_OnLoad(JavaVM* vm, char* options, void* reserved);
 
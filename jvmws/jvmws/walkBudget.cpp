@@ -0,0 +1,135 @@
+#include <chrono>
+#include <vector>
+
+#include "agent_util.hpp"
+#include "walkBudget.hpp"
+
+jlong walkClock()
+{
+	return jlong(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void startWalkBudget(WalkBudget* budget, const WalkLimits* limits)
+{
+	budget->started = walkClock();
+	budget->deadline = limits->millis > 0 ? budget->started + jlong(limits->millis) * 1000000 : 0;
+	budget->elapsed = 0;
+	budget->maxObjects = uint64_t(limits->objects > 0 ? limits->objects : 0);
+	budget->objects = 0;
+	budget->bytes = 0;
+	budget->unit = "objects";
+	budget->untilClock = kBudgetStride;
+	budget->exhausted = false;
+	budget->expected = 0;
+}
+
+void finishWalkBudget(WalkBudget* budget)
+{
+	budget->elapsed = walkClock() - budget->started;
+}
+
+jint walkCoverage(const WalkBudget* budget)
+{
+	if (!budget->exhausted)
+	{
+		return 100;
+	}
+	if (budget->expected == 0)
+	{
+		return -1;
+	}
+	/* The heap changed since the snapshot, never claim a complete walk */
+	uint64_t percent = budget->objects * 100 / budget->expected;
+	return jint(percent < 99 ? percent : 99);
+}
+
+void reportWalkBudget(const WalkBudget* budget, const char* walk)
+{
+	jint coverage = walkCoverage(budget);
+
+	if (!budget->exhausted)
+	{
+		return;
+	}
+	stdout_message("PARTIAL %s: stopped by the pause budget after %llu %s, %llu bytes, %lld ms\n", walk,
+	               (unsigned long long)budget->objects, budget->unit, (unsigned long long)budget->bytes,
+	               (long long)(budget->elapsed / 1000000));
+	if (coverage >= 0)
+	{
+		stdout_message("PARTIAL %s: about %d%% of %llu %s in the published snapshot\n", walk, coverage,
+		               (unsigned long long)budget->expected, budget->unit);
+	}
+	else
+	{
+		stdout_message("PARTIAL %s: coverage unknown, publish a snapshot for an estimate\n", walk);
+	}
+}
+
+uint64_t snapshotInstances(const HeapSnapshot* snapshot, uint32_t classId)
+{
+	const HeapGraph* graph = &snapshot->graph;
+	uint64_t instances = 0;
+
+	for (size_t n = 1; n < graphNodeCount(graph); ++n)
+	{
+		if (graph->classIds[n] == classId && graph->flags[n] == 0)
+		{
+			instances++;
+		}
+	}
+	return instances;
+}
+
+uint64_t snapshotReachable(const HeapSnapshot* snapshot, NodeId node)
+{
+	const HeapGraph* graph = &snapshot->graph;
+	std::vector<bool> seen(graphNodeCount(graph), false);
+	std::vector<NodeId> pending;
+	uint64_t reachable = 0;
+
+	if (node >= graphNodeCount(graph))
+	{
+		return 0;
+	}
+	seen[node] = true;
+	pending.push_back(node);
+	while (!pending.empty())
+	{
+		NodeId from = pending.back();
+		pending.pop_back();
+		reachable++;
+		for (uint64_t e = graph->edgeStarts[from]; e < graph->edgeStarts[from + 1]; ++e)
+		{
+			uint32_t kind = edgeLabelKind(graph->edgeLabels[e]);
+			NodeId to = graph->edgeTargets[e];
+			if ((kind == JVMTI_HEAP_REFERENCE_FIELD || kind == JVMTI_HEAP_REFERENCE_ARRAY_ELEMENT) && !seen[to])
+			{
+				seen[to] = true;
+				pending.push_back(to);
+			}
+		}
+	}
+	/* Without the node itself */
+	return reachable - 1;
+}
+
+uint64_t snapshotObjects(const HeapSnapshot* snapshot)
+{
+	const HeapGraph* graph = &snapshot->graph;
+	uint64_t objects = 0;
+
+	for (size_t n = 1; n < graphNodeCount(graph); ++n)
+	{
+		if ((graph->flags[n] & kNodeIsVirtual) == 0)
+		{
+			objects++;
+		}
+	}
+	return objects;
+}
+
+uint64_t snapshotReferences(const HeapSnapshot* snapshot)
+{
+	return uint64_t(snapshot->graph.edgeTargets.size());
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+
+#ifndef WALK_BUDGET_H
+#define WALK_BUDGET_H
+
+#include <stdint.h>
+
+#include <jni.h>
+#include <ibmjvmti.h>
+
+#include "heapSnapshot.hpp"
+
+/* Pause budgets of the heap walks. A walk stops the application for its
+ *   whole length, a budget bounds it by time, by objects visited, or both.
+ *   The callbacks count every object and read the clock once per
+ *   kBudgetStride objects; once the budget is spent they abort the walk
+ *   and what was gathered so far is reported as partial, with the share
+ *   of the complete walk estimated from the published snapshot. A walk
+ *   following references reports an object once per referrer and cannot
+ *   tell the first report apart, it spends the budget per reference.
+ */
+static const uint32_t kBudgetStride = 256;
+
+/* 0 for no limit */
+typedef struct WalkLimits
+{
+	jint millis;
+	jint objects;
+} WalkLimits;
+
+/* A forced GC has no bound on its pause, so while limits are set the
+ *   budgeted queries skip the collection they otherwise start with. Their
+ *   walks then also visit garbage that is not collected yet. */
+inline bool walkLimited(const WalkLimits* limits)
+{
+	return limits->millis > 0 || limits->objects > 0;
+}
+
+typedef struct WalkBudget
+{
+	/* Steady clock nanoseconds, the deadline 0 without a time limit */
+	jlong started;
+	jlong deadline;
+	jlong elapsed;
+
+	/* Objects, or references for a walk following references */
+	uint64_t maxObjects;
+	uint64_t objects;
+	uint64_t bytes;
+	const char* unit;
+
+	/* Objects left until the next clock read */
+	uint32_t untilClock;
+	bool exhausted;
+
+	/* Objects the complete walk would visit, 0 when not known */
+	uint64_t expected;
+} WalkBudget;
+
+jlong walkClock();
+
+void startWalkBudget(WalkBudget* budget, const WalkLimits* limits);
+
+/* Counts an object, false when the budget is spent and the walk must stop.
+ *   Only a refused object marks the budget exhausted, a walk that ends
+ *   right at the limit is complete. */
+inline bool spendWalkBudget(WalkBudget* budget, jlong size)
+{
+	if (budget->exhausted)
+	{
+		return false;
+	}
+	if (budget->maxObjects > 0 && budget->objects >= budget->maxObjects)
+	{
+		budget->exhausted = true;
+	}
+	else if (budget->deadline > 0 && --budget->untilClock == 0)
+	{
+		budget->untilClock = kBudgetStride;
+		budget->exhausted = walkClock() >= budget->deadline;
+	}
+	if (budget->exhausted)
+	{
+		return false;
+	}
+	budget->objects++;
+	budget->bytes += uint64_t(size);
+	return true;
+}
+
+/* For walks following references, before the walk */
+inline void countWalkReferences(WalkBudget* budget)
+{
+	budget->unit = "references";
+}
+
+void finishWalkBudget(WalkBudget* budget);
+
+/* 100 for a complete walk, the estimated percent covered by a partial
+ *   one, -1 when it cannot be estimated */
+jint walkCoverage(const WalkBudget* budget);
+
+/* Prints the partial result marker, nothing for a complete walk */
+void reportWalkBudget(const WalkBudget* budget, const char* walk);
+
+/* Estimates of a complete walk from a snapshot: the instances of a class,
+ *   the objects reachable from a node through fields and array elements
+ *   without the node, all objects */
+uint64_t snapshotInstances(const HeapSnapshot* snapshot, uint32_t classId);
+uint64_t snapshotReachable(const HeapSnapshot* snapshot, NodeId node);
+uint64_t snapshotObjects(const HeapSnapshot* snapshot);
+
+/* The references of all objects and roots, for walks following references */
+uint64_t snapshotReferences(const HeapSnapshot* snapshot);
+
+#endif